@@ -0,0 +1,86 @@
+from func_timeout import FunctionTimedOut
+from pathlib import Path
+import json
+
+from utils.cmd_manager import CMDManager
+from utils.log_parser import LogParser
+from utils.sed_generator import generate_sed_cmd
+from utils.color_printer import print_GOOD, print_WARNING
+from utils.func_timer import print_func_time
+
+
+input_path = './params'
+output_path = './results'
+exp_name = 'value_sweep'
+
+# common params
+with (Path(input_path) / f'common.json').open(mode='r') as f:
+    params = json.load(f)
+home_dir      = params['home_dir']
+ycsb_dir      = f'{home_dir}/SMART/ycsb'
+cluster_ips   = params['cluster_ips']
+master_ip     = params['master_ip']
+cmake_options = params['cmake_options']
+
+# exp params
+with (Path(input_path) / f'{exp_name}.json').open(mode='r') as f:
+    exp_params = json.load(f)
+workload, workload_name   = exp_params['workload_names']
+target_epoch              = exp_params['target_epoch']
+CN_num, client_num_per_CN = exp_params['client_num']
+MN_num                    = exp_params['MN_num']
+key_type                  = exp_params['key_size']
+value_sizes               = exp_params['value_size']
+cache_size                = exp_params['cache_size']
+
+
+@print_func_time
+def main(cmd: CMDManager, tp: LogParser):
+    metrics = ['Throughput', 'P50 Latency', 'P99 Latency']
+    sweep_data = {
+        'workload': workload,
+        'value_sizes': value_sizes,
+        'metrics': metrics,
+        'Y_data': {}
+    }
+    project_dir = f"{home_dir}/SMART"
+    work_dir = f"{project_dir}/build"
+    env_cmd = f"cd {work_dir}"
+
+    # build once, the value size is a runtime argument of ycsb_test (leaves keep an 8B value descriptor)
+    sed_cmd = generate_sed_cmd('./include/Common.h', False, 8 if key_type == 'randint' else 32, 8, cache_size, MN_num)
+    BUILD_PROJECT = f"cd {project_dir} && {sed_cmd} && mkdir -p build && cd build && cmake {cmake_options['SMART']} -DVAR_LEN_VALUE=on .. && make clean && make -j"
+    cmd.all_execute(BUILD_PROJECT, CN_num)
+
+    for value_size in value_sizes:
+        CLEAR_MEMC = f"{env_cmd} && /bin/bash ../script/restartMemc.sh"
+        SPLIT_WORKLOADS = f"{env_cmd} && python3 {ycsb_dir}/split_workload.py {workload_name} {key_type} {CN_num} {client_num_per_CN}"
+        YCSB_TEST = f"{env_cmd} && ./ycsb_test {CN_num} {client_num_per_CN} 2 {key_type} {workload_name} 0 {value_size}"
+        KILL_PROCESS = f"{env_cmd} && killall -9 ycsb_test"
+
+        cmd.all_execute(SPLIT_WORKLOADS, CN_num)
+        while True:
+            try:
+                cmd.one_execute(CLEAR_MEMC)
+                cmd.all_execute(KILL_PROCESS, CN_num)
+                logs = cmd.all_long_execute(YCSB_TEST, CN_num)
+                p50_lat, p99_lat = cmd.get_cluster_lats(str(Path(project_dir) / 'us_lat'), CN_num, target_epoch)
+                tpt, _, _, _ = tp.get_statistics(logs, target_epoch)
+                break
+            except (FunctionTimedOut, Exception) as e:
+                print_WARNING(f"Error! Retry... {e}")
+
+        print_GOOD(f"[FINISHED POINT] value_size={value_size} tpt={tpt} p50_lat={p50_lat} p99_lat={p99_lat}")
+        sweep_data['Y_data'][str(value_size)] = {metrics[0]: tpt, metrics[1]: p50_lat, metrics[2]: p99_lat}
+    # save data
+    Path(output_path).mkdir(exist_ok=True)
+    with (Path(output_path) / f'{exp_name}.json').open(mode='w') as f:
+        json.dump(sweep_data, f, indent=2)
+
+
+if __name__ == '__main__':
+    cmd = CMDManager(cluster_ips, master_ip)
+    tp = LogParser()
+    t = main(cmd, tp)
+    with (Path(output_path) / 'time.log').open(mode="a+") as f:
+        f.write(f"{exp_name}.py execution time: {int(t//60)} min {int(t%60)} s\n")
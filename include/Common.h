@@ -21,9 +21,8 @@
 #define MAX_MACHINE 20
 #define MEMORY_NODE_NUM 2
 #define CPU_PHYSICAL_CORE_NUM 72  // [CONFIG]
-#define MAX_CORO_NUM 8
+#define MAX_CORO_NUM 64  // the coroutine count of a thread is given at run time, up to it
 
-#define LATENCY_WINDOWS 100000
 #define ALLOC_ALLIGN_BIT 8
 #define MAX_KEY_SPACE_SIZE 60000000
 // #define KEY_SPACE_LIMIT
@@ -72,12 +71,28 @@ inline int bits_in(std::uint64_t u) {
 using CoroYield = boost::coroutines::symmetric_coroutine<void>::yield_type;
 using CoroCall = boost::coroutines::symmetric_coroutine<void>::call_type;
 
-using CheckFunc = std::function<bool ()>;
-using CoroQueue = std::queue<std::pair<uint16_t, CheckFunc> >;
+// stack allocator of coroutines, stacks are kept in a per-thread pool and reused by the coroutines created later
+struct CoroStackPool {
+  void allocate(boost::coroutines::stack_context &ctx, std::size_t size);
+  void deallocate(boost::coroutines::stack_context &ctx);
+};
+
+// marks a waiting coroutine as ready, coro_master resumes the ready ones of its thread
+struct CoroWaker {
+  std::atomic<uint64_t> *ready;  // bitmap of the coroutines of a thread
+  int coro_id;
+  // a coroutine waits on one local lock at a time, linked into its wait list by the ticket it waits for
+  uint16_t wait_ticket;
+  CoroWaker *wait_next;
+
+  void wake() const { ready->fetch_or(1ULL << coro_id); }
+};
+static_assert(MAX_CORO_NUM <= 64);
+
 struct CoroContext {
   CoroYield *yield;
   CoroCall *master;
-  CoroQueue *busy_waiting_queue;
+  CoroWaker *waker;
   int coro_id;
 };
 
@@ -92,23 +107,49 @@ constexpr uint16_t kCacheLineSize = 64;
 // Remote Allocation
 constexpr uint64_t dsmSize           = 64;        // GB  [CONFIG]
 constexpr uint64_t kChunkSize        = 16 * MB;   // B
+constexpr uint64_t kReclaimGracePeriod = 100 * 1000 * 1000;  // ns, removed leaves/nodes are reused no earlier, as other CNs may read them
 
 // Rdma Buffer
 constexpr uint64_t rdmaBufferSize    = 4;         // GB  [CONFIG]
 constexpr int64_t kPerThreadRdmaBuf  = rdmaBufferSize * define::GB / MAX_APP_THREAD;
-constexpr int64_t kPerCoroRdmaBuf    = kPerThreadRdmaBuf / MAX_CORO_NUM;
+constexpr int64_t kMinPerCoroRdmaBuf = kPerThreadRdmaBuf / MAX_CORO_NUM;  // the buffer of a thread is carved by its coroutine count
+
+// Coroutine
+constexpr uint64_t kCoroStackSize    = 128 * 1024;  // B, tree operations need a few KB
 
 // Cache (MB)
 constexpr int kIndexCacheSize = 600;
+constexpr int kIndexCacheClockWeight = 4;  // CLOCK sweeps a hit entry right below the root gets before eviction, one less per level down
 
 // KV
+#ifdef TREE_ENABLE_VAR_LEN_KEY
+constexpr uint32_t keyLen = 64;  // max key length (< 256 as bounded by the node depth), shorter keys are zero-padded  [CONFIG]
+#else
 constexpr uint32_t keyLen = 8;
+#endif
+static_assert(keyLen < 256);
 constexpr uint32_t simulatedValLen = 8;
-constexpr uint32_t allocAlignLeafSize = ROUND_UP(keyLen + simulatedValLen + 8 + 2, ALLOC_ALLIGN_BIT);
+#ifdef TREE_ENABLE_VAR_LEN_VALUE
+constexpr uint32_t inlineValLenMax = 128;  // longer values are stored in the value log instead of inline in leaves  [CONFIG]
+constexpr uint32_t valLenMax = 4096;
+constexpr uint64_t kValueLogSegSize = 4 * MB;  // value log space a thread allocates at a time
+static_assert(simulatedValLen == sizeof(uint64_t));  // leaves keep an 8B value descriptor
+static_assert(kValueLogSegSize <= kChunkSize);
+#if defined(TREE_ENABLE_WRITE_COMBINING) || defined(TREE_ENABLE_READ_DELEGATION)
+#error "write combining and read delegation only hand over 8B values"
+#endif
+#else
+constexpr uint32_t inlineValLenMax = 0;
+#endif
+constexpr uint32_t allocAlignLeafSize = ROUND_UP(keyLen + simulatedValLen + inlineValLenMax + 8 + 2, ALLOC_ALLIGN_BIT);
 
 // Tree
 constexpr uint64_t kRootPointerStoreOffest = kChunkSize / 2;
 static_assert(kRootPointerStoreOffest % sizeof(uint64_t) == 0);
+constexpr uint64_t kBulkLoadExtentSize = 4 * MB;  // remote space bulk_load() lays out and writes at a time, staged in the range buffer
+static_assert(kBulkLoadExtentSize * 3 / 2 <= kPerThreadRdmaBuf);
+constexpr int kBulkLoadCacheDepth = 3;  // bulk loaded nodes no deeper than it are put into the cache
+constexpr int kCollapseRetryMax = 1024;  // retries of collapse_node() to put a claimed leaf back while writers take their entries back
 
 // Internal Node
 constexpr uint32_t allocationPageSize = 8 + 8 + 256 * 8;
@@ -116,6 +157,11 @@ constexpr uint32_t allocAlignPageSize = ROUND_UP(allocationPageSize, ALLOC_ALLIG
 
 // Internal Entry
 constexpr uint32_t kvLenBit        = 7;
+#if defined(TREE_ENABLE_VAR_LEN_KEY) || defined(TREE_ENABLE_VAR_LEN_VALUE)
+constexpr uint32_t kvLenUnit       = 8;  // kv_len records leaf size in 8B units
+#else
+constexpr uint32_t kvLenUnit       = 1;
+#endif
 constexpr uint32_t nodeTypeNumBit  = 5;
 constexpr uint32_t mnIdBit         = 8;
 constexpr uint32_t offsetBit       = 48 - ALLOC_ALLIGN_BIT;
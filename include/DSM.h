@@ -2,11 +2,16 @@
 #define __DSM_H__
 
 #include <atomic>
+#include <map>
+#include <mutex>
+#include <condition_variable>
 
 #include "RdmaCache.h"
 #include "Config.h"
 #include "Connection.h"
+#ifndef DSM_LOOPBACK
 #include "DSMKeeper.h"
+#endif
 #include "GlobalAddress.h"
 #include "LocalAllocator.h"
 #include "RdmaBuffer.h"
@@ -15,14 +20,14 @@
 
 class DSMKeeper;
 class Directory;
+class LoopbackDirectory;
 
 class DSM {
 
 public:
   void registerThread();
-  void loadKeySpace(const std::string& load_workloads_path, bool is_str);
-  Key getRandomKey();
-  Key getNoComflictKey(uint64_t key_hash, uint64_t global_thread_id, uint64_t global_thread_num);
+  // splits the rdma buffer of the thread among its coroutines
+  void carveRdmaBuffer(int coro_cnt);
   static DSM *getInstance(const DSMConfig &conf);
 
   uint16_t getMyNodeID() { return myNodeID; }
@@ -145,6 +150,28 @@ public:
   bool poll_rdma_cq_once(uint64_t &wr_id);
   int poll_rdma_cq_batch_once(uint64_t *wr_ids, int count);
 
+#ifdef DSM_LOOPBACK
+  // single CN: nothing to aggregate or exchange
+  uint64_t sum(uint64_t value) { return value; }
+
+  size_t Put(uint64_t key, const void *value, size_t count) {
+    {
+      std::lock_guard<std::mutex> guard(loopback_kv_lock);
+      loopback_kv[key] = std::string((const char *)value, count);
+    }
+    loopback_kv_cv.notify_all();
+    return count;
+  }
+
+  // blocks until the key is put, as memGet does
+  size_t Get(uint64_t key, void *value) {
+    std::unique_lock<std::mutex> guard(loopback_kv_lock);
+    std::map<uint64_t, std::string>::const_iterator it;
+    loopback_kv_cv.wait(guard, [&](){ return (it = loopback_kv.find(key)) != loopback_kv.end(); });
+    memcpy(value, it->second.data(), it->second.size());
+    return it->second.size();
+  }
+#else
   uint64_t sum(uint64_t value) {
     static uint64_t count = 0;
     return keeper->sum(std::string("sum-") + std::to_string(count++), value);
@@ -167,12 +194,16 @@ public:
 
     return size;
   }
+#endif
 
 private:
   DSM(const DSMConfig &conf);
   ~DSM();
 
   void initRDMAConnection();
+#ifdef DSM_LOOPBACK
+  GlobalAddress loopback_alloc_chunck(uint16_t node_id);
+#endif
   void fill_keys_dest(RdmaOpRegion &ror, GlobalAddress addr, bool is_chip);
 
   DSMConfig conf;
@@ -188,7 +219,6 @@ private:
 
   uint64_t baseAddr;
   uint32_t myNodeID;
-  uint64_t keySpaceSize;
 
   RemoteConnection *remoteInfo;
   ThreadConnection *thCon[MAX_APP_THREAD];
@@ -196,11 +226,20 @@ private:
   DSMKeeper *keeper;
 
   Directory *dirAgent[NR_DIRECTORY];
-  Key keyBuffer[MAX_KEY_SPACE_SIZE];
+#ifdef DSM_LOOPBACK
+  LoopbackDirectory *loopbackDir[MEMORY_NODE_NUM];
+  std::map<uint64_t, std::string> loopback_kv;
+  std::mutex loopback_kv_lock;
+  std::condition_variable loopback_kv_cv;
+#endif
 
 public:
   bool is_register() { return thread_id != -1; }
+#ifdef DSM_LOOPBACK
+  void barrier(const std::string &ss) {}
+#else
   void barrier(const std::string &ss) { keeper->barrier(ss); }
+#endif
 
   char *get_rdma_buffer() { return rdma_buffer; }
   RdmaBuffer &get_rbuf(int coro_id) { return rbuf[coro_id]; }
@@ -244,11 +283,16 @@ inline GlobalAddress DSM::alloc(size_t size, bool align) {
   bool need_chunk = true;
   GlobalAddress addr = local_allocator.malloc(size, need_chunk, align);
   if (need_chunk)  {
+#ifdef DSM_LOOPBACK
+    GlobalAddress chunk_addr = loopback_alloc_chunck(cur_target_node);
+    local_allocator.set_chunck(chunk_addr);
+#else
     RawMessage m;
     m.type = RpcType::MALLOC;
 
     this->rpc_call_dir(m, cur_target_node, cur_target_dir_id);
     local_allocator.set_chunck(rpc_wait()->addr);
+#endif
 
     // retry
     addr = local_allocator.malloc(size, need_chunk, align);
@@ -0,0 +1,95 @@
+#if !defined(_HISTOGRAM_H_)
+#define _HISTOGRAM_H_
+
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <istream>
+#include <ostream>
+
+// log-linear (HDR style) histogram of latencies in ns: exact below 128ns, then 64 buckets per power of two (< 1.6% error)
+class alignas(64) Histogram {
+public:
+  static const int kSubBucketBits = 6;
+  static const int kSubBucketCnt  = 1 << kSubBucketBits;
+  static const int kMaxBits       = 36;  // values from 2^36 ns (~69s) on are counted in the last bucket
+  static const int kBucketCnt     = (kMaxBits - kSubBucketBits + 1) * kSubBucketCnt;
+
+  Histogram() { clear(); }
+
+  void clear() {
+    memset(counts, 0, sizeof(counts));
+    total = 0;
+    max_ns = 0;
+  }
+
+  void record(uint64_t ns) {
+    counts[bucket_idx(ns)] ++;
+    total ++;
+    max_ns = std::max(max_ns, ns);
+  }
+
+  void merge(const Histogram &other) {
+    for (int i = 0; i < kBucketCnt; ++ i) {
+      counts[i] += other.counts[i];
+    }
+    total += other.total;
+    max_ns = std::max(max_ns, other.max_ns);
+  }
+
+  uint64_t count() const { return total; }
+
+  uint64_t max() const { return max_ns; }
+
+  // the lowest value of the bucket holding the p-th (0 ~ 1) value
+  uint64_t percentile(double p) const {
+    if (total == 0) return 0;
+    uint64_t target = std::max<uint64_t>(1, p * total), cum = 0;
+    for (int i = 0; i < kBucketCnt; ++ i) {
+      cum += counts[i];
+      if (cum >= target) return bucket_value(i);
+    }
+    return bucket_value(kBucketCnt - 1);
+  }
+
+  // "us\tcnt" per non-empty bucket, histograms of different CNs are merged by adding up the counts of the same us
+  void save(std::ostream &out) const {
+    char line[64];
+    for (int i = 0; i < kBucketCnt; ++ i) if (counts[i]) {
+      int len = snprintf(line, sizeof(line), "%.3f\t%lu\n", bucket_value(i) / 1000.0, counts[i]);
+      out.write(line, len);
+    }
+  }
+
+  void load(std::istream &in) {
+    double us;
+    uint64_t cnt;
+    while (in >> us >> cnt) {
+      auto ns = (uint64_t)(us * 1000 + 0.5);
+      counts[bucket_idx(ns)] += cnt;
+      total += cnt;
+      max_ns = std::max(max_ns, ns);
+    }
+  }
+
+  static int bucket_idx(uint64_t ns) {
+    ns = std::min<uint64_t>(ns, (1ull << kMaxBits) - 1);
+    if (ns < 2 * kSubBucketCnt) return ns;
+    int shift = 63 - __builtin_clzll(ns) - kSubBucketBits;
+    return (shift + 1) * kSubBucketCnt + (ns >> shift) - kSubBucketCnt;
+  }
+
+  static uint64_t bucket_value(int idx) {
+    if (idx < 2 * kSubBucketCnt) return idx;
+    int shift = idx / kSubBucketCnt - 1;
+    return (uint64_t)(idx % kSubBucketCnt + kSubBucketCnt) << shift;
+  }
+
+private:
+  uint64_t counts[kBucketCnt];
+  uint64_t total;
+  uint64_t max_ns;
+};
+
+#endif // _HISTOGRAM_H_
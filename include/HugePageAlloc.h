@@ -15,6 +15,12 @@ inline void *hugePageAlloc(size_t size) {
 
     void *res = mmap(NULL, size, PROT_READ | PROT_WRITE,
                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#ifdef DSM_LOOPBACK
+    if (res == MAP_FAILED) {  // nothing to register with a NIC, normal pages are fine
+        res = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+#endif
     if (res == MAP_FAILED) {
         Debug::notifyError("%s mmap failed!\n", getIP());
     }
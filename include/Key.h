@@ -115,24 +115,48 @@ inline Key int2key(uint64_t key) {
   key = key % (kKeyMax - kKeyMin) + kKeyMin;
 #endif
   Key res{};
+#ifndef TREE_ENABLE_VAR_LEN_KEY
   for (int i = 1; i <= (int)define::keyLen; ++ i) {
     auto shr = (define::keyLen - i) * 8;
     res.at(i - 1) = (shr >= 64u ? 0 : ((key >> shr) & ((1 << 8) - 1))); // Is equivalent to padding zero for short key
   }
+#else
+  for (int i = 0; i < (int)sizeof(uint64_t); ++ i) {  // an 8-byte key zero-padded behind
+    res.at(i) = (key >> ((sizeof(uint64_t) - 1 - i) * 8)) & ((1 << 8) - 1);
+  }
+#endif
   return res;
 }
 
 inline Key str2key(const std::string &key) {
-  // assert(key.size() <= define::keyLen);
+#ifdef TREE_ENABLE_VAR_LEN_KEY
+  assert(key.size() <= define::keyLen);
+#endif
   Key res{};
-  std::copy(key.begin(), key.size() <= define::keyLen ? key.end() : key.begin() + define::keyLen, res.begin());
+  std::copy(key.begin(), key.size() <= define::keyLen ? key.end() : key.begin() + define::keyLen, res.begin());  // truncated w/o TREE_ENABLE_VAR_LEN_KEY
   return res;
 }
 
 inline uint64_t key2int(const Key& key) {
   uint64_t res = 0;
+#ifndef TREE_ENABLE_VAR_LEN_KEY
   for (auto a : key) res = (res << 8) + a;
+#else
+  for (int i = 0; i < (int)sizeof(uint64_t); ++ i) res = (res << 8) + key.at(i);
+#endif
   return res;
 }
 
+// length w/o the zero padding, i.e., the bytes stored in leaves
+inline uint32_t get_key_len(const Key& key) {
+#ifndef TREE_ENABLE_VAR_LEN_KEY
+  UNUSED(key);
+  return define::keyLen;
+#else
+  int len = define::keyLen;
+  while (len > 0 && key.at(len - 1) == 0) -- len;
+  return len;
+#endif
+}
+
 #endif // _KEY_H_
@@ -11,6 +11,8 @@
 #include <set>
 #include <atomic>
 #include <mutex>
+#include <vector>
+#include <tbb/concurrent_queue.h>
 
 
 #define MAX_HANDOVER_TYPE_NUM 2
@@ -21,28 +23,98 @@ enum HandoverType {
 };
 
 
-struct LocalLockNode {
-  // read waiting queue
-  std::atomic<uint8_t> read_current;
-  std::atomic<uint8_t> read_ticket;
-  volatile bool read_handover;
+// the key a time window is for, kept inline and versioned so that it can be claimed and compared without allocation
+class LocalLockKey {
+public:
+  LocalLockKey() : word(0) {}
+
+  // claim the empty key for k, true if it is (or already was) k
+  bool claim(const Key& k) {
+    while (true) {
+      uint64_t w = word.load(std::memory_order_acquire);
+      if ((w & kStatusMask) == EMPTY) {
+        if (word.compare_exchange_weak(w, (w & ~kStatusMask) + kVersionUnit + BUSY)) {
+          key = k;
+          word.store((w & ~kStatusMask) + kVersionUnit + READY, std::memory_order_release);
+          return true;
+        }
+        continue;
+      }
+      bool same;
+      if (_read(w, k, same)) return same;
+    }
+  }
 
-  // write waiting queue
-  std::atomic<uint8_t> write_current;
-  std::atomic<uint8_t> write_ticket;
+  bool match(const Key& k) const {
+    while (true) {
+      uint64_t w = word.load(std::memory_order_acquire);
+      if ((w & kStatusMask) == EMPTY) return false;
+      bool same;
+      if (_read(w, k, same)) return same;
+    }
+  }
+
+  // only by the lock holder
+  void set(const Key& k) {
+    uint64_t w = (word.load(std::memory_order_relaxed) & ~kStatusMask) + kVersionUnit;
+    word.store(w + BUSY, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    key = k;
+    word.store(w + READY, std::memory_order_release);
+  }
+
+  void clear() {
+    uint64_t w = word.load(std::memory_order_relaxed);
+    word.store((w & ~kStatusMask) + kVersionUnit + EMPTY, std::memory_order_release);
+  }
+
+private:
+  // compare with a stable snapshot of the key, false if it has to be retried
+  bool _read(uint64_t w, const Key& k, bool& same) const {
+    if ((w & kStatusMask) == BUSY) return false;
+    same = (key == k);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return word.load(std::memory_order_relaxed) == w;
+  }
+
+  enum Status : uint64_t {EMPTY, BUSY, READY};
+  static const uint64_t kStatusMask = 0x3;
+  static const uint64_t kVersionUnit = 0x4;
+  std::atomic<uint64_t> word;  // [version | status]
+  Key key;
+};
+
+
+// tickets of the lock queues, wide enough for every coroutine of a CN to wait on one lock, e.g. of a hot key
+using LockTicket = uint16_t;
+static_assert(MAX_APP_THREAD * MAX_CORO_NUM < (1 << 16));
+
+
+// coroutines waiting on a lock queue, woken up by the release that passes the lock to them; linked through their
+// wakers in the order they queued, so a state only grows with the actual waiters
+struct LocalWaitList {
+  std::atomic<int> num{0};
+  std::mutex lock;
+  CoroWaker* head = nullptr;
+  CoroWaker* tail = nullptr;
+};
+
+
+// per-key state of a time window (delegation / combining / handover), only allocated while the lock is in use
+struct LocalLockState {
+  volatile bool read_handover;
   volatile bool write_handover;
 
-  /* ----- auxiliary variables for simplicity  TODO: dynamic allocate ----- */
   // identical time window start time
   std::atomic<bool> window_start;
-  std::atomic<uint8_t> read_window;
-  std::atomic<uint8_t> write_window;
+  std::atomic<LockTicket> read_window;
+  std::atomic<LockTicket> write_window;
   std::mutex r_lock;
   std::mutex w_lock;
 
   // hash conflict
-  std::atomic<Key*> unique_read_key;
-  std::atomic<Key*> unique_write_key;
+  LocalLockKey unique_read_key;
+  LocalLockKey unique_write_key;
   GlobalAddress unique_addr;
 
   // read delegation
@@ -59,93 +131,210 @@ struct LocalLockNode {
   // lock handover
   int handover_cnt;
 
-  LocalLockNode() : read_current(0), read_ticket(0), read_handover(0), write_current(0), write_ticket(0), write_handover(0),
-                    window_start(0), read_window(0), write_window(0),
-                    unique_read_key(0), unique_write_key(0), unique_addr(0), handover_cnt(0) {}
+  LocalWaitList read_waiters;
+  LocalWaitList write_waiters;
+
+  LocalLockState() {
+    reset();
+  }
+
+  void reset() {
+    read_handover = write_handover = false;
+    window_start = false;
+    read_window = write_window = 0;
+    unique_read_key.clear();
+    unique_write_key.clear();
+    unique_addr = GlobalAddress::Null();
+    handover_cnt = 0;
+  }
 };
 
 
+// the hot part: ticket locks, and the state pinned by every client between acquire and release
+struct LocalLockNode {
+  // read waiting queue
+  std::atomic<LockTicket> read_current;
+  std::atomic<LockTicket> read_ticket;
+
+  // write waiting queue
+  std::atomic<LockTicket> write_current;
+  std::atomic<LockTicket> write_ticket;
+
+  std::atomic<uint64_t> state;  // [pin count (16 bit) | LocalLockState* (48 bit)], freed with the last unpin
+};
+static_assert(sizeof(LocalLockNode) == 16);
+
+
 class LocalLockTable {
 public:
-  LocalLockTable() {}
+  // zero pages are mapped on first touch, so only the locks in use are resident
+  LocalLockTable() : local_locks((LocalLockNode *)calloc(define::kLocalLockNum, sizeof(LocalLockNode))) {}
+  ~LocalLockTable() { free(local_locks); }
 
   // read-delegation
-  std::pair<bool, bool> acquire_local_read_lock(const Key& k, CoroQueue *waiting_queue = nullptr, CoroContext *cxt = nullptr, int coro_id = 0);
+  std::pair<bool, bool> acquire_local_read_lock(const Key& k, CoroContext *cxt = nullptr);
   void release_local_read_lock(const Key& k, std::pair<bool, bool> acquire_ret, bool& res, Value& ret_value);
 
   // write-combining
-  std::pair<bool, bool> acquire_local_write_lock(const Key& k, const Value& v, CoroQueue *waiting_queue = nullptr, CoroContext *cxt = nullptr, int coro_id = 0);
+  std::pair<bool, bool> acquire_local_write_lock(const Key& k, const Value& v, CoroContext *cxt = nullptr);
   bool get_combining_value(const Key& k, Value& v);
   void release_local_write_lock(const Key& k, std::pair<bool, bool> acquire_ret);
 
   /* ---- baseline ---- */
   // lock-handover
-  bool acquire_local_lock(const GlobalAddress& addr, CoroQueue *waiting_queue = nullptr, CoroContext *cxt = nullptr, int coro_id = 0);
+  bool acquire_local_lock(const GlobalAddress& addr, CoroContext *cxt = nullptr);
   using RemoteFunc = std::function<void (const GlobalAddress &)>;
   void release_local_lock(const GlobalAddress& addr, RemoteFunc unlock_func);
   void release_local_lock(const GlobalAddress& addr, RemoteFunc unlock_func, RemoteFunc write_without_unlock, RemoteFunc write_and_unlock);
 
   // cas-handover
-  bool acquire_local_lock(const Key& k, CoroQueue *waiting_queue = nullptr, CoroContext *cxt = nullptr, int coro_id = 0);
+  bool acquire_local_lock(const Key& k, CoroContext *cxt = nullptr);
   void release_local_lock(const Key& k, bool& res, InternalEntry& ret_p);
 
   // write_testing
-  bool acquire_local_write_lock(const GlobalAddress& addr, const Value& v, CoroQueue *waiting_queue = nullptr, CoroContext *cxt = nullptr, int coro_id = 0);
+  bool acquire_local_write_lock(const GlobalAddress& addr, const Value& v, CoroContext *cxt = nullptr);
   using RemoteWriteBackFunc = std::function<void (const Value&)>;
   void release_local_write_lock(const GlobalAddress& addr, RemoteFunc unlock_func, const Value& v, RemoteWriteBackFunc write_func);
 
   // read-testing
-  bool acquire_local_read_lock(const GlobalAddress& addr, CoroQueue *waiting_queue = nullptr, CoroContext *cxt = nullptr, int coro_id = 0);
+  bool acquire_local_read_lock(const GlobalAddress& addr, CoroContext *cxt = nullptr);
   void release_local_read_lock(const GlobalAddress& addr, bool& res, Value& ret_value);
 
+private:
+  LocalLockState* _pin(LocalLockNode& node);
+  LocalLockState* _pinned(LocalLockNode& node) const { return (LocalLockState *)(node.state.load() & kStatePtrMask); }
+  void _unpin(LocalLockNode& node);
+  void _wait(std::atomic<LockTicket>& current, LocalWaitList& waiters, LockTicket ticket, CoroContext *cxt);
+  void _pass(std::atomic<LockTicket>& current, LocalWaitList& waiters);
+
+  static const uint64_t kStatePin = 1ULL << 48;
+  static const uint64_t kStatePtrMask = kStatePin - 1;
+  static const int kStateCacheSize = 64;  // states a thread keeps for reuse
+  static inline thread_local std::vector<LocalLockState*> state_cache;
+  static inline tbb::concurrent_queue<LocalLockState*> free_states;
+
 private:
   Hash hasher;
-  LocalLockNode local_locks[define::kLocalLockNum];
+  LocalLockNode* local_locks;
 };
 
 
-// read-delegation
-inline std::pair<bool, bool> LocalLockTable::acquire_local_read_lock(const Key& k, CoroQueue *waiting_queue, CoroContext *cxt, int coro_id) {
-  auto &node = local_locks[hasher.get_hashed_lock_index(k)];
+inline LocalLockState* LocalLockTable::_pin(LocalLockNode& node) {
+  uint64_t word = node.state.fetch_add(kStatePin) + kStatePin;
+  if (word & kStatePtrMask) {
+    return (LocalLockState *)(word & kStatePtrMask);
+  }
+  // the first client in the window installs a state, which stays as long as the node is pinned
+  LocalLockState* new_state = nullptr;
+  if (!state_cache.empty()) {
+    new_state = state_cache.back();
+    state_cache.pop_back();
+  }
+  else if (!free_states.try_pop(new_state)) {
+    new_state = new LocalLockState();
+  }
+  assert(((uint64_t)new_state & ~kStatePtrMask) == 0);
+  while (!(word & kStatePtrMask)) {
+    if (node.state.compare_exchange_weak(word, word | (uint64_t)new_state)) {
+      return new_state;
+    }
+  }
+  state_cache.push_back(new_state);  // installed by another client
+  return (LocalLockState *)(word & kStatePtrMask);
+}
 
-  Key* unique_key = nullptr;
-  Key* new_key = new Key(k);
-  bool res = node.unique_read_key.compare_exchange_strong(unique_key, new_key);
-  if (!res) {
-    delete new_key;
-    if (*unique_key != k) {  // conflict keys
-      return std::make_pair(false, true);
+
+inline void LocalLockTable::_unpin(LocalLockNode& node) {
+  uint64_t word = node.state.load();
+  while (true) {
+    if (word >> 48 == 1) {  // the window closes
+      if (node.state.compare_exchange_weak(word, 0)) {
+        auto state = (LocalLockState *)(word & kStatePtrMask);
+        state->reset();
+        if ((int)state_cache.size() < kStateCacheSize) state_cache.push_back(state);
+        else free_states.push(state);
+        return;
+      }
+    }
+    else if (node.state.compare_exchange_weak(word, word - kStatePin)) {
+      return;
     }
   }
+}
 
-  uint8_t ticket = node.read_ticket.fetch_add(1);  // acquire local lock
-  uint8_t current = node.read_current.load(std::memory_order_relaxed);
 
-  while (ticket != current) { // lock failed
+inline void LocalLockTable::_wait(std::atomic<LockTicket>& current, LocalWaitList& waiters, LockTicket ticket, CoroContext *cxt) {
+  while (ticket != current.load(std::memory_order_relaxed)) { // lock failed
     if (cxt != nullptr) {
-      waiting_queue->push(std::make_pair(coro_id, [=, &node](){
-        return ticket == node.read_current.load(std::memory_order_relaxed);
-      }));
+      auto waker = cxt->waker;
+      std::unique_lock<std::mutex> guard(waiters.lock);
+      // counted before checking current, so a release passing the lock meanwhile either is seen or sees the waiter
+      waiters.num.fetch_add(1);
+      if (ticket == current.load()) {
+        waiters.num.fetch_sub(1);
+        return;
+      }
+      waker->wait_ticket = ticket;
+      waker->wait_next = nullptr;
+      if (waiters.tail) waiters.tail->wait_next = waker;
+      else waiters.head = waker;
+      waiters.tail = waker;
+      guard.unlock();
       (*cxt->yield)(*cxt->master);
     }
-    current = node.read_current.load(std::memory_order_relaxed);
-  }
-  unique_key = node.unique_read_key.load();
-  if (!unique_key || *unique_key != k) {  // conflict keys
-    if (node.read_window) {
-      -- node.read_window;
-      if (!node.read_window && !node.write_window) {
-        node.window_start = false;
+  }
+}
+
+
+inline void LocalLockTable::_pass(std::atomic<LockTicket>& current, LocalWaitList& waiters) {
+  LockTicket next = current.fetch_add(1) + 1;
+  if (waiters.num.load() == 0) return;
+  CoroWaker* waker = nullptr;
+  {
+    std::lock_guard<std::mutex> guard(waiters.lock);
+    for (CoroWaker *prev = nullptr, *w = waiters.head; w; prev = w, w = w->wait_next) {
+      if (w->wait_ticket == next) {  // mostly the head, as waiters queue in ticket order
+        if (prev) prev->wait_next = w->wait_next;
+        else waiters.head = w->wait_next;
+        if (waiters.tail == w) waiters.tail = prev;
+        waiters.num.fetch_sub(1);
+        waker = w;
+        break;
+      }
+    }
+  }
+  if (waker) waker->wake();
+}
+
+
+// read-delegation
+inline std::pair<bool, bool> LocalLockTable::acquire_local_read_lock(const Key& k, CoroContext *cxt) {
+  auto &node = local_locks[hasher.get_hashed_lock_index(k)];
+  auto state = _pin(node);
+
+  if (!state->unique_read_key.claim(k)) {  // conflict keys
+    _unpin(node);
+    return std::make_pair(false, true);
+  }
+
+  LockTicket ticket = node.read_ticket.fetch_add(1);  // acquire local lock
+  _wait(node.read_current, state->read_waiters, ticket, cxt);
+  if (!state->unique_read_key.match(k)) {  // conflict keys
+    if (state->read_window) {
+      -- state->read_window;
+      if (!state->read_window && !state->write_window) {
+        state->window_start = false;
       }
     }
-    // node.read_handover = false;
-    node.read_current.fetch_add(1);
+    // state->read_handover = false;
+    _pass(node.read_current, state->read_waiters);
+    _unpin(node);
     return std::make_pair(false, true);
   }
-  if (!node.read_window) {
-    node.read_handover = false;
+  if (!state->read_window) {
+    state->read_handover = false;
   }
-  return std::make_pair(node.read_handover, false);
+  return std::make_pair(state->read_handover, false);
 }
 
 // read-delegation
@@ -153,108 +342,97 @@ inline void LocalLockTable::release_local_read_lock(const Key& k, std::pair<bool
   if (acquire_ret.second) return;
 
   auto &node = local_locks[hasher.get_hashed_lock_index(k)];
+  auto state = _pinned(node);
 
-  if (!node.read_handover) {  // winner
-    node.res = res;
-    node.ret_value = ret_value;
+  if (!state->read_handover) {  // winner
+    state->res = res;
+    state->ret_value = ret_value;
   }
   else {  // losers accept the ret val from winner
-    res = node.res;
-    ret_value = node.ret_value;
+    res = state->res;
+    ret_value = state->ret_value;
   }
 
-  uint8_t ticket = node.read_ticket.load(std::memory_order_relaxed);
-  uint8_t current = node.read_current.load(std::memory_order_relaxed);
+  LockTicket ticket = node.read_ticket.load(std::memory_order_relaxed);
+  LockTicket current = node.read_current.load(std::memory_order_relaxed);
 
   bool start_window = false;
-  if (!node.read_handover && node.window_start.compare_exchange_strong(start_window, true)) {
+  if (!state->read_handover && state->window_start.compare_exchange_strong(start_window, true)) {
     // read time window start
-    node.read_window = ((1UL << 8) + ticket - current) % (1UL << 8);
+    state->read_window = ((1UL << 16) + ticket - current) % (1UL << 16);
 
-    node.w_lock.lock();
+    state->w_lock.lock();
     auto w_current = node.write_current.load(std::memory_order_relaxed);
-    node.write_window = ((1UL << 8) + node.write_ticket.load(std::memory_order_relaxed) - w_current) % (1UL << 8);
-    node.w_lock.unlock();
+    state->write_window = ((1UL << 16) + node.write_ticket.load(std::memory_order_relaxed) - w_current) % (1UL << 16);
+    state->w_lock.unlock();
   }
 
-  node.read_handover = ticket != (uint8_t)(current + 1);
+  state->read_handover = ticket != (LockTicket)(current + 1);
 
-  if (!node.read_handover) {  // next epoch
-    node.unique_read_key = nullptr;
+  if (!state->read_handover) {  // next epoch
+    state->unique_read_key.clear();
   }
 
-  node.r_lock.lock();
-  if (node.read_window) {
-    -- node.read_window;
-    if (!node.read_window && !node.write_window) {
-      node.window_start = false;
+  state->r_lock.lock();
+  if (state->read_window) {
+    -- state->read_window;
+    if (!state->read_window && !state->write_window) {
+      state->window_start = false;
     }
   }
-  node.read_current.fetch_add(1);
-  node.r_lock.unlock();
+  _pass(node.read_current, state->read_waiters);
+  state->r_lock.unlock();
 
+  _unpin(node);
   return;
 }
 
 // write-combining
-inline std::pair<bool, bool> LocalLockTable::acquire_local_write_lock(const Key& k, const Value& v, CoroQueue *waiting_queue, CoroContext *cxt, int coro_id) {
+inline std::pair<bool, bool> LocalLockTable::acquire_local_write_lock(const Key& k, const Value& v, CoroContext *cxt) {
   auto &node = local_locks[hasher.get_hashed_lock_index(k)];
+  auto state = _pin(node);
 
-  Key* unique_key = nullptr;
-  Key* new_key = new Key(k);
-  bool res = node.unique_write_key.compare_exchange_strong(unique_key, new_key);
-  if (!res) {
-    delete new_key;
-    if (*unique_key != k) {  // conflict keys
-      return std::make_pair(false, true);
-    }
+  if (!state->unique_write_key.claim(k)) {  // conflict keys
+    _unpin(node);
+    return std::make_pair(false, true);
   }
 
-  node.wc_lock.lock();
-  node.wc_buffer = v;     // local overwrite (combining)
-  node.wc_lock.unlock();
-
-  uint8_t ticket = node.write_ticket.fetch_add(1);  // acquire local lock
-  uint8_t current = node.write_current.load(std::memory_order_relaxed);
+  state->wc_lock.lock();
+  state->wc_buffer = v;     // local overwrite (combining)
+  state->wc_lock.unlock();
 
-  while (ticket != current) { // lock failed
-    if (cxt != nullptr) {
-      waiting_queue->push(std::make_pair(coro_id, [=, &node](){
-        return ticket == node.write_current.load(std::memory_order_relaxed);
-      }));
-      (*cxt->yield)(*cxt->master);
-    }
-    current = node.write_current.load(std::memory_order_relaxed);
-  }
-  unique_key = node.unique_write_key.load();
-  if (!unique_key || *unique_key != k) {  // conflict keys
-    if (node.write_window) {
-      -- node.write_window;
-      if (!node.read_window && !node.write_window) {
-        node.window_start = false;
+  LockTicket ticket = node.write_ticket.fetch_add(1);  // acquire local lock
+  _wait(node.write_current, state->write_waiters, ticket, cxt);
+  if (!state->unique_write_key.match(k)) {  // conflict keys
+    if (state->write_window) {
+      -- state->write_window;
+      if (!state->read_window && !state->write_window) {
+        state->window_start = false;
       }
     }
-    // node.write_handover = false;
-    node.write_current.fetch_add(1);
+    // state->write_handover = false;
+    _pass(node.write_current, state->write_waiters);
+    _unpin(node);
     return std::make_pair(false, true);
   }
-  if (!node.write_window) {
-    node.write_handover = false;
+  if (!state->write_window) {
+    state->write_handover = false;
   }
-  return std::make_pair(node.write_handover, false);
+  return std::make_pair(state->write_handover, false);
 }
 
 // write-combining
 inline bool LocalLockTable::get_combining_value(const Key& k, Value& v) {
   auto &node = local_locks[hasher.get_hashed_lock_index(k)];
+  auto state = _pin(node);
   bool res = false;
-  Key* unique_key = node.unique_write_key.load();
-  if (unique_key && *unique_key == k) {  // wc
-    node.wc_lock.lock();
-    res = node.wc_buffer != v;
-    v = node.wc_buffer;
-    node.wc_lock.unlock();
+  if (state->unique_write_key.match(k)) {  // wc
+    state->wc_lock.lock();
+    res = state->wc_buffer != v;
+    v = state->wc_buffer;
+    state->wc_lock.unlock();
   }
+  _unpin(node);
   return res;
 }
 
@@ -263,110 +441,106 @@ inline void LocalLockTable::release_local_write_lock(const Key& k, std::pair<boo
   if (acquire_ret.second) return;
 
   auto &node = local_locks[hasher.get_hashed_lock_index(k)];
+  auto state = _pinned(node);
 
-  uint8_t ticket = node.write_ticket.load(std::memory_order_relaxed);
-  uint8_t current = node.write_current.load(std::memory_order_relaxed);
+  LockTicket ticket = node.write_ticket.load(std::memory_order_relaxed);
+  LockTicket current = node.write_current.load(std::memory_order_relaxed);
 
   bool start_window = false;
-  if (!node.write_handover && node.window_start.compare_exchange_strong(start_window, true)) {
+  if (!state->write_handover && state->window_start.compare_exchange_strong(start_window, true)) {
     // write time window start
-    node.r_lock.lock();
+    state->r_lock.lock();
     auto r_current = node.read_current.load(std::memory_order_relaxed);
-    node.read_window = ((1UL << 8) + node.read_ticket.load(std::memory_order_relaxed) - r_current) % (1UL << 8);
-    node.r_lock.unlock();
+    state->read_window = ((1UL << 16) + node.read_ticket.load(std::memory_order_relaxed) - r_current) % (1UL << 16);
+    state->r_lock.unlock();
 
-    node.write_window = ((1UL << 8) + ticket - current) % (1UL << 8);
+    state->write_window = ((1UL << 16) + ticket - current) % (1UL << 16);
   }
 
-  node.write_handover = ticket != (uint8_t)(current + 1);
+  state->write_handover = ticket != (LockTicket)(current + 1);
 
-  if (!node.write_handover) {  // next epoch
-    node.unique_write_key = nullptr;
+  if (!state->write_handover) {  // next epoch
+    state->unique_write_key.clear();
   }
 
-  node.w_lock.lock();
-  if (node.write_window) {
-    -- node.write_window;
-    if (!node.read_window && !node.write_window) {
-      node.window_start = false;
+  state->w_lock.lock();
+  if (state->write_window) {
+    -- state->write_window;
+    if (!state->read_window && !state->write_window) {
+      state->window_start = false;
     }
   }
-  node.write_current.fetch_add(1);
-  node.w_lock.unlock();
+  _pass(node.write_current, state->write_waiters);
+  state->w_lock.unlock();
 
+  _unpin(node);
   return;
 }
 
 // lock-handover
-inline bool LocalLockTable::acquire_local_lock(const GlobalAddress& addr, CoroQueue *waiting_queue, CoroContext *cxt, int coro_id) {
+inline bool LocalLockTable::acquire_local_lock(const GlobalAddress& addr, CoroContext *cxt) {
   auto &node = local_locks[hasher.get_hashed_lock_index(addr)];
+  auto state = _pin(node);
 
-  uint8_t ticket = node.write_ticket.fetch_add(1);
-  uint8_t current = node.write_current.load(std::memory_order_relaxed);
-
-  while (ticket != current) { // lock failed
-    if (cxt != nullptr) {
-      waiting_queue->push(std::make_pair(coro_id, [=, &node](){
-        return ticket == node.write_current.load(std::memory_order_relaxed);
-      }));
-      (*cxt->yield)(*cxt->master);
-    }
-    current = node.write_current.load(std::memory_order_relaxed);
-  }
+  LockTicket ticket = node.write_ticket.fetch_add(1);
+  _wait(node.write_current, state->write_waiters, ticket, cxt);
 
-  if (!node.write_handover) {  // winner
-    node.unique_addr = addr;
+  if (!state->write_handover) {  // winner
+    state->unique_addr = addr;
   }
-  // if (node.unique_addr == addr) {
-  //   node.handover_cnt ++;
+  // if (state->unique_addr == addr) {
+  //   state->handover_cnt ++;
   // }
-  return node.write_handover && node.unique_addr == addr;  // only if updating at the same k can this update handover
+  return state->write_handover && state->unique_addr == addr;  // only if updating at the same k can this update handover
 }
 
 // lock-handover
 inline void LocalLockTable::release_local_lock(const GlobalAddress& addr, RemoteFunc unlock_func) {
   auto &node = local_locks[hasher.get_hashed_lock_index(addr)];
+  auto state = _pinned(node);
 
-  uint8_t ticket = node.write_ticket.load(std::memory_order_relaxed);
-  uint8_t current = node.write_current.load(std::memory_order_relaxed);
+  LockTicket ticket = node.write_ticket.load(std::memory_order_relaxed);
+  LockTicket current = node.write_current.load(std::memory_order_relaxed);
 
-  node.write_handover = ticket != (uint8_t)(current + 1);
-  if (node.handover_cnt ++ > MAX_HOCL_HANDOVER) {
-    node.write_handover = false;
+  state->write_handover = ticket != (LockTicket)(current + 1);
+  if (state->handover_cnt ++ > MAX_HOCL_HANDOVER) {
+    state->write_handover = false;
   }
-  if (!node.write_handover) {
-    node.handover_cnt = 0;
+  if (!state->write_handover) {
+    state->handover_cnt = 0;
   }
 
-  if (node.unique_addr != addr) {
+  if (state->unique_addr != addr) {
     unlock_func(addr);
   }
-  if (!node.write_handover) {
-    unlock_func(node.unique_addr);
+  if (!state->write_handover) {
+    unlock_func(state->unique_addr);
   }
 
-  node.write_current.fetch_add(1);
+  _pass(node.write_current, state->write_waiters);
+  _unpin(node);
   return;
 }
 
 // lock-handover + embedding lock
 inline void LocalLockTable::release_local_lock(const GlobalAddress& addr, RemoteFunc unlock_func, RemoteFunc write_without_unlock, RemoteFunc write_and_unlock) {
   auto &node = local_locks[hasher.get_hashed_lock_index(addr)];
+  auto state = _pinned(node);
 
-  uint8_t ticket = node.write_ticket.load(std::memory_order_relaxed);
-  uint8_t current = node.write_current.load(std::memory_order_relaxed);
+  LockTicket ticket = node.write_ticket.load(std::memory_order_relaxed);
+  LockTicket current = node.write_current.load(std::memory_order_relaxed);
 
-  node.write_handover = ticket != (uint8_t)(current + 1);
-  if (node.handover_cnt ++ > MAX_HOCL_HANDOVER) {
-    node.write_handover = false;
+  state->write_handover = ticket != (LockTicket)(current + 1);
+  if (state->handover_cnt ++ > MAX_HOCL_HANDOVER) {
+    state->write_handover = false;
   }
-  if (!node.write_handover) {
-    node.handover_cnt = 0;
+  if (!state->write_handover) {
+    state->handover_cnt = 0;
   }
 
-  if (!node.write_handover) {
-    if (node.unique_addr != addr) {
-      unlock_func(node.unique_addr);
+  if (!state->write_handover) {
+    if (state->unique_addr != addr) {
+      unlock_func(state->unique_addr);
       write_and_unlock(addr);
     }
     else {
@@ -374,7 +548,7 @@ inline void LocalLockTable::release_local_lock(const GlobalAddress& addr, Remote
     }
   }
   else {
-    if (node.unique_addr != addr) {
+    if (state->unique_addr != addr) {
       write_and_unlock(addr);
     }
     else {
@@ -382,165 +556,141 @@ inline void LocalLockTable::release_local_lock(const GlobalAddress& addr, Remote
     }
   }
 
-  node.write_current.fetch_add(1);
+  _pass(node.write_current, state->write_waiters);
+  _unpin(node);
   return;
 }
 
 // cas-handover
-inline bool LocalLockTable::acquire_local_lock(const Key& k, CoroQueue *waiting_queue, CoroContext *cxt, int coro_id) {
+inline bool LocalLockTable::acquire_local_lock(const Key& k, CoroContext *cxt) {
   auto &node = local_locks[hasher.get_hashed_lock_index(k)];
+  auto state = _pin(node);
 
-  uint8_t ticket = node.write_ticket.fetch_add(1);
-  uint8_t current = node.write_current.load(std::memory_order_relaxed);
+  LockTicket ticket = node.write_ticket.fetch_add(1);
+  _wait(node.write_current, state->write_waiters, ticket, cxt);
 
-  while (ticket != current) { // lock failed
-    if (cxt != nullptr) {
-      waiting_queue->push(std::make_pair(coro_id, [=, &node](){
-        return ticket == node.write_current.load(std::memory_order_relaxed);
-      }));
-      (*cxt->yield)(*cxt->master);
-    }
-    current = node.write_current.load(std::memory_order_relaxed);
+  if (!state->write_handover) {  // winner
+    state->unique_write_key.set(k);
   }
-
-  if (!node.write_handover) {  // winner
-    auto old_key = node.unique_write_key.load(std::memory_order_relaxed);
-    node.unique_write_key = new Key(k);
-    if(old_key) delete old_key;
-  }
-  // if (*node.unique_write_key == k) {
-  //   node.handover_cnt ++;
+  // if (*state->unique_write_key == k) {
+  //   state->handover_cnt ++;
   // }
-  auto unique_key = node.unique_write_key.load(std::memory_order_relaxed);
-  return node.write_handover && (unique_key && *unique_key == k);  // only if updating at the same k can this update handover
+  return state->write_handover && state->unique_write_key.match(k);  // only if updating at the same k can this update handover
 }
 
 // cas-handover
 inline void LocalLockTable::release_local_lock(const Key& k, bool& res, InternalEntry& ret_p) {
   auto &node = local_locks[hasher.get_hashed_lock_index(k)];
+  auto state = _pinned(node);
 
-  auto unique_key = node.unique_write_key.load(std::memory_order_relaxed);
-  if (unique_key && *unique_key == k) {
-    if (!node.write_handover) {  // winner
-      node.res = res;
-      node.ret_p = ret_p;
+  if (state->unique_write_key.match(k)) {
+    if (!state->write_handover) {  // winner
+      state->res = res;
+      state->ret_p = ret_p;
     }
     else {
-      res = node.res;
-      ret_p = node.ret_p;
+      res = state->res;
+      ret_p = state->ret_p;
     }
   }
 
-  uint8_t ticket = node.write_ticket.load(std::memory_order_relaxed);
-  uint8_t current = node.write_current.load(std::memory_order_relaxed);
+  LockTicket ticket = node.write_ticket.load(std::memory_order_relaxed);
+  LockTicket current = node.write_current.load(std::memory_order_relaxed);
 
-  node.write_handover = ticket != (uint8_t)(current + 1);
-  if (node.handover_cnt ++ > MAX_HOCL_HANDOVER) {
-    node.write_handover = false;
+  state->write_handover = ticket != (LockTicket)(current + 1);
+  if (state->handover_cnt ++ > MAX_HOCL_HANDOVER) {
+    state->write_handover = false;
   }
-  if (!node.write_handover) {
-    node.handover_cnt = 0;
+  if (!state->write_handover) {
+    state->handover_cnt = 0;
   }
 
-  node.write_current.fetch_add(1);
+  _pass(node.write_current, state->write_waiters);
+  _unpin(node);
   return;
 }
 
 // write-testing
-inline bool LocalLockTable::acquire_local_write_lock(const GlobalAddress& addr, const Value& v, CoroQueue *waiting_queue, CoroContext *cxt, int coro_id) {
+inline bool LocalLockTable::acquire_local_write_lock(const GlobalAddress& addr, const Value& v, CoroContext *cxt) {
   auto &node = local_locks[hasher.get_hashed_lock_index(addr)];
+  auto state = _pin(node);
 
-  node.wc_lock.lock();
-  node.wc_buffer = v;     // local overwrite (combining)
-  node.wc_lock.unlock();
-
-  uint8_t ticket = node.write_ticket.fetch_add(1);
-  uint8_t current = node.write_current.load(std::memory_order_relaxed);
+  state->wc_lock.lock();
+  state->wc_buffer = v;     // local overwrite (combining)
+  state->wc_lock.unlock();
 
-  while (ticket != current) { // lock failed
-    if (cxt != nullptr) {
-      waiting_queue->push(std::make_pair(coro_id, [=, &node](){
-        return ticket == node.write_current.load(std::memory_order_relaxed);
-      }));
-      (*cxt->yield)(*cxt->master);
-    }
-    current = node.write_current.load(std::memory_order_relaxed);
-  }
+  LockTicket ticket = node.write_ticket.fetch_add(1);
+  _wait(node.write_current, state->write_waiters, ticket, cxt);
 
-  if (!node.write_handover) {  // winner
-    node.unique_addr = addr;
+  if (!state->write_handover) {  // winner
+    state->unique_addr = addr;
   }
-  return node.write_handover && node.unique_addr == addr;  // only if updating at the same k can this update handover
+  return state->write_handover && state->unique_addr == addr;  // only if updating at the same k can this update handover
 }
 
 // write-testing
 inline void LocalLockTable::release_local_write_lock(const GlobalAddress& addr, RemoteFunc unlock_func, const Value& v, RemoteWriteBackFunc write_func) {
   auto &node = local_locks[hasher.get_hashed_lock_index(addr)];
+  auto state = _pinned(node);
 
-  if (!node.write_handover) {
+  if (!state->write_handover) {
     // unlock lock_node.unique_key
-    node.wc_lock.lock();
-    Value wc_v = node.wc_buffer;
-    node.wc_lock.unlock();
+    state->wc_lock.lock();
+    Value wc_v = state->wc_buffer;
+    state->wc_lock.unlock();
     write_func(wc_v);
-    unlock_func(node.unique_addr);
+    unlock_func(state->unique_addr);
   }
-  if (node.unique_addr != addr) {
+  if (state->unique_addr != addr) {
     write_func(v);
     unlock_func(addr);
   }
 
-  uint8_t ticket = node.write_ticket.load(std::memory_order_relaxed);
-  uint8_t current = node.write_current.load(std::memory_order_relaxed);
+  LockTicket ticket = node.write_ticket.load(std::memory_order_relaxed);
+  LockTicket current = node.write_current.load(std::memory_order_relaxed);
 
-  node.write_handover = ticket != (uint8_t)(current + 1);
+  state->write_handover = ticket != (LockTicket)(current + 1);
 
-  node.write_current.fetch_add(1);
+  _pass(node.write_current, state->write_waiters);
+  _unpin(node);
   return;
 }
 
 // read-testing
-inline bool LocalLockTable::acquire_local_read_lock(const GlobalAddress& addr, CoroQueue *waiting_queue, CoroContext *cxt, int coro_id) {
+inline bool LocalLockTable::acquire_local_read_lock(const GlobalAddress& addr, CoroContext *cxt) {
   auto &node = local_locks[hasher.get_hashed_lock_index(addr)];
+  auto state = _pin(node);
 
-  uint8_t ticket = node.read_ticket.fetch_add(1);
-  uint8_t current = node.read_current.load(std::memory_order_relaxed);
-
-  while (ticket != current) { // lock failed
-    if (cxt != nullptr) {
-      waiting_queue->push(std::make_pair(coro_id, [=, &node](){
-        return ticket == node.read_current.load(std::memory_order_relaxed);
-      }));
-      (*cxt->yield)(*cxt->master);
-    }
-    current = node.read_current.load(std::memory_order_relaxed);
-  }
+  LockTicket ticket = node.read_ticket.fetch_add(1);
+  _wait(node.read_current, state->read_waiters, ticket, cxt);
 
-  if (!node.read_handover) {  // winner
-    node.unique_addr = addr;
+  if (!state->read_handover) {  // winner
+    state->unique_addr = addr;
   }
-  return node.read_handover && node.unique_addr == addr;  // only if updating at the same k can this update handover
+  return state->read_handover && state->unique_addr == addr;  // only if updating at the same k can this update handover
 }
 
 // read-testing
 inline void LocalLockTable::release_local_read_lock(const GlobalAddress& addr, bool& res, Value& ret_value) {
   auto &node = local_locks[hasher.get_hashed_lock_index(addr)];
+  auto state = _pinned(node);
 
-  uint8_t ticket = node.read_ticket.load(std::memory_order_relaxed);
-  uint8_t current = node.read_current.load(std::memory_order_relaxed);
+  LockTicket ticket = node.read_ticket.load(std::memory_order_relaxed);
+  LockTicket current = node.read_current.load(std::memory_order_relaxed);
 
-  if (node.unique_addr == addr) {  // hash conflict clients is not involved in ret value handover
-    if (!node.read_handover) {  // winner
-      node.res = res;
-      node.ret_value = ret_value;
+  if (state->unique_addr == addr) {  // hash conflict clients is not involved in ret value handover
+    if (!state->read_handover) {  // winner
+      state->res = res;
+      state->ret_value = ret_value;
     }
     else {  // losers accept the ret val from winner
-      res = node.res;
-      ret_value = node.ret_value;
+      res = state->res;
+      ret_value = state->ret_value;
     }
   }
-  node.read_handover = ticket != (uint8_t)(current + 1);
-  node.read_current.fetch_add(1);
+  state->read_handover = ticket != (LockTicket)(current + 1);
+  _pass(node.read_current, state->read_waiters);
+  _unpin(node);
   return;
 }
 
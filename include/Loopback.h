@@ -0,0 +1,51 @@
+#ifndef __LOOPBACK_H__
+#define __LOOPBACK_H__
+
+#include "Common.h"
+#include "Connection.h"
+#include "GlobalAllocator.h"
+#include "Rdma.h"
+#include "WRLock.h"
+
+// Single-host transport (DSM_LOOPBACK).
+// Memory-node regions are local memfd mappings and one-sided verbs are executed
+// by the posting thread itself. Signaled work requests push their wr_id into a
+// software CQ, so pollWithCQ/pollOnce keep returning coro ids to coro_master.
+
+constexpr int kLoopbackCQDepth = kQPMaxDepth;
+
+// owned by one app thread: posted and polled by the same thread
+struct LoopbackCQ {
+  uint64_t wr_ids[kLoopbackCQDepth];
+  uint32_t head;
+  uint32_t tail;
+
+  LoopbackCQ() : head(0), tail(0) {}
+};
+
+//// loopback/Resource.cpp
+ibv_cq *createLoopbackCQ();
+ibv_qp *createLoopbackQP(ibv_cq *cq);
+
+void *loopbackRegionAlloc(size_t size);
+void loopbackRegionFree(void *addr, size_t size);
+
+
+// memory server of one MN, replaces the Directory thread and its MALLOC rpc
+class LoopbackDirectory {
+public:
+  LoopbackDirectory(RemoteConnection *remoteInfo, uint64_t dsmSize, uint16_t nodeID);
+  ~LoopbackDirectory();
+
+  GlobalAddress alloc_chunck();
+
+private:
+  void *dsmPool;
+  uint64_t dsmSize;
+  void *lockPool;
+
+  WRLock lock;
+  GlobalAllocator *chunckAlloc;
+};
+
+#endif /* __LOOPBACK_H__ */
@@ -0,0 +1,99 @@
+#if !defined(_METRICS_H_)
+#define _METRICS_H_
+
+#include "Tree.h"
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+
+enum MetricType {
+  LOCK_FAIL,
+  TRY_WRITE_OP,
+  WRITE_HANDOVER_NUM,
+  TRY_READ_OP,
+  READ_HANDOVER_NUM,
+  TRY_READ_LEAF,
+  READ_LEAF_RETRY,
+  LEAF_CACHE_INVALID,
+  TRY_READ_NODE,
+  READ_NODE_REPAIR,
+  ROOT_READ_SAVED,
+  METRIC_NUM
+};
+
+constexpr const char *kMetricName[METRIC_NUM] = {
+  "lock_fail", "try_write_op", "write_handover", "try_read_op", "read_handover", "try_read_leaf",
+  "read_leaf_retry", "leaf_cache_invalid", "try_read_node", "read_node_repair", "root_read_saved"
+};
+
+
+// counters of one thread, only written by it; a single writer needs no locked instruction, and the relaxed
+// atomics let other threads snapshot the counters at any time
+class alignas(define::kCacheLineSize) ThreadMetrics {
+public:
+  void inc(MetricType t, uint64_t n = 1) { add(cnt[t], n); }
+  void inc_node_type(int type) { add(read_node_type[type], 1); }
+  void inc_retry(int flag) { add(retry_cnt[flag], 1); }
+
+  // hit: the fraction of the path of an operation found in the index cache
+  void add_cache_hit(double hit) {
+    cache_hit.store(cache_hit.load(std::memory_order_relaxed) + hit, std::memory_order_relaxed);
+    cache_miss.store(cache_miss.load(std::memory_order_relaxed) + (1 - hit), std::memory_order_relaxed);
+  }
+
+private:
+  static void add(std::atomic<uint64_t> &c, uint64_t n) {
+    c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  friend class Metrics;
+  std::atomic<uint64_t> cnt[METRIC_NUM] = {};
+  std::atomic<uint64_t> read_node_type[MAX_NODE_TYPE_NUM] = {};
+  std::atomic<uint64_t> retry_cnt[MAX_FLAG_NUM] = {};
+  std::atomic<double> cache_hit{0}, cache_miss{0};
+};
+
+
+// counters merged over the threads; they only grow, so the counters of an interval are the difference of two snapshots
+struct MetricsSnapshot {
+  uint64_t cnt[METRIC_NUM];
+  uint64_t read_node_type[MAX_NODE_TYPE_NUM];
+  uint64_t retry_cnt[MAX_FLAG_NUM];
+  double cache_hit;
+  double cache_miss;
+
+  uint64_t operator[](MetricType t) const { return cnt[t]; }
+  double rate(MetricType t, MetricType base) const { return cnt[t] * 1.0 / cnt[base]; }
+  double cache_hit_rate() const { return cache_hit / (cache_hit + cache_miss); }
+
+  MetricsSnapshot operator-(const MetricsSnapshot &pre) const;
+  std::string to_prometheus(int node_id) const;
+};
+
+
+class Metrics {
+public:
+  ~Metrics() { stop_exporter(); }
+
+  ThreadMetrics &operator[](int thread_id) { return threads[thread_id]; }
+  MetricsSnapshot snapshot() const;
+
+  // exports snapshots in the Prometheus text format every interval: target is either a file, rewritten
+  // atomically, or a port (e.g. "9100"), served over HTTP on localhost
+  void start_exporter(const std::string &target, int node_id, int interval_ms = 1000);
+  void stop_exporter();
+
+private:
+  void export_to_file(const std::string &path, int node_id, int interval_ms);
+  void export_to_socket(int port, int node_id, int interval_ms);
+
+  ThreadMetrics threads[MAX_APP_THREAD];
+  std::thread exporter;
+  std::atomic<bool> exporter_stop{false};
+};
+
+extern Metrics metrics;
+
+#endif // _METRICS_H_
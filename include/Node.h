@@ -18,6 +18,38 @@ static_assert(sizeof(PackedGAddr) == 6);
 
 static CRCProcessor crc_processor;
 
+
+#ifdef TREE_ENABLE_VAR_LEN_VALUE
+/*
+  Value descriptor, kept in the leaf in place of an 8B value.
+  Values no longer than define::inlineValLenMax are stored inline behind the leaf key (null addr),
+  longer ones in the append-only value log.
+*/
+class ValueDesc {
+public:
+  union {
+  struct {
+    uint64_t val_len : 16;
+    uint64_t mn_id   : define::mnIdBit;
+    uint64_t offset  : 48 - define::mnIdBit;
+  };
+  Value val;
+  };
+
+public:
+  ValueDesc(const Value& val) : val(val) {}
+  ValueDesc(uint32_t val_len, const GlobalAddress& addr) : val_len(val_len), mn_id(addr.nodeID), offset(addr.offset) {}
+
+  operator Value() const { return val; }
+  bool is_inline() const { return val_len <= define::inlineValLenMax; }
+  uint32_t inline_len() const { return is_inline() ? val_len : 0; }
+  GlobalAddress addr() const { return GlobalAddress(mn_id, offset); }
+} __attribute__((packed));
+
+static_assert(sizeof(ValueDesc) == sizeof(Value));
+#endif
+
+
 /*
   Leaf Node
 */
@@ -25,7 +57,6 @@ class Leaf {
 public:
   // for invalidation
   GlobalAddress rev_ptr;
-  // TODO: add key len & value len for out-of-place updates
 
   union {
   struct {
@@ -37,8 +68,10 @@ public:
 
   uint64_t checksum;  // checksum(kv)
 
+#ifndef TREE_ENABLE_VAR_LEN_KEY
   // kv
   Key key;
+#endif
   union {
   Value value;
   uint8_t _padding[define::simulatedValLen];
@@ -52,24 +85,77 @@ public:
   uint8_t lock_byte;
   };
 
+#ifdef TREE_ENABLE_VAR_LEN_KEY
+  // key out of line, only the first key_len bytes are stored on MNs
+  uint8_t key_len;
+  Key key;
+#endif
+  // an inline value (TREE_ENABLE_VAR_LEN_VALUE) is stored right behind the key
+
 public:
   Leaf() {}
-  Leaf(const Key& key, const Value& value, const GlobalAddress& rev_ptr) : rev_ptr(rev_ptr), f_padding(0), valid(1), key(key), value(value), lock_byte(0) { set_consistent(); }
+#ifndef TREE_ENABLE_VAR_LEN_VALUE
+  Leaf(const Key& key, const Value& value, const GlobalAddress& rev_ptr) : rev_ptr(rev_ptr), f_padding(0), valid(1), value(value), lock_byte(0) { set_key(key); set_consistent(); }
+#else
+  Leaf(const Key& key, const Value& value, const GlobalAddress& rev_ptr, const char *inline_val) : rev_ptr(rev_ptr), f_padding(0), valid(1), value(value), lock_byte(0) {
+    set_key(key);
+    memcpy(get_inline_value(), inline_val, ValueDesc(value).inline_len());
+    set_consistent();
+  }
+#endif
 
+#ifndef TREE_ENABLE_VAR_LEN_KEY
+  void set_key(const Key& k) { key = k; }
   const Key& get_key() const { return key; }
+  uint32_t key_end() const { return sizeof(Leaf); }
+  static uint32_t key_end_of(const Key&) { return sizeof(Leaf); }
+#else
+  void set_key(const Key& k) { key_len = get_key_len(k); key = k; }
+  Key get_key() const {  // bytes behind key_len are not read from MNs
+    Key res{};
+    std::copy(key.begin(), key.begin() + stored_key_len(), res.begin());
+    return res;
+  }
+  uint32_t key_end() const { return STRUCT_OFFSET(Leaf, key) + stored_key_len(); }
+  static uint32_t key_end_of(const Key& k) { return STRUCT_OFFSET(Leaf, key) + get_key_len(k); }
+  uint32_t stored_key_len() const { return std::min((uint32_t)key_len, define::keyLen); }
+#endif
+
+#ifndef TREE_ENABLE_VAR_LEN_VALUE
+  uint32_t size() const { return key_end(); }
+  static uint32_t size_of(const Key& k, const Value&) { return key_end_of(k); }
+  void set_value(const Value& val) { value = val; }
+#else
+  uint32_t size() const { return key_end() + ValueDesc(value).inline_len(); }
+  static uint32_t size_of(const Key& k, const Value& v) { return key_end_of(k) + ValueDesc(v).inline_len(); }
+  char *get_inline_value() { return (char *)this + key_end(); }
+  const char *get_inline_value() const { return (const char *)this + key_end(); }
+  void set_value(const Value& val, const char *inline_val) {
+    value = val;
+    memcpy(get_inline_value(), inline_val, ValueDesc(val).inline_len());
+  }
+#endif
   Value get_value() const { return value; }
   bool is_valid(const GlobalAddress& p_ptr, bool from_cache) const { return valid && (!from_cache || p_ptr == rev_ptr); }
   bool is_consistent() const {
-    crc_processor.reset();
-    crc_processor.process_bytes((char *)&key, sizeof(Key) + sizeof(uint8_t) * define::simulatedValLen);
-    return crc_processor.checksum() == checksum;
+    return get_checksum() == checksum;
   }
 
-  void set_value(const Value& val) { value = val; }
   void set_consistent() {
+    checksum = get_checksum();
+  }
+  uint64_t get_checksum() const {
     crc_processor.reset();
+#ifndef TREE_ENABLE_VAR_LEN_KEY
     crc_processor.process_bytes((char *)&key, sizeof(Key) + sizeof(uint8_t) * define::simulatedValLen);
-    checksum = crc_processor.checksum();
+#else
+    crc_processor.process_bytes((char *)&value, sizeof(uint8_t) * define::simulatedValLen);
+    crc_processor.process_bytes((char *)&key_len, sizeof(uint8_t) + stored_key_len());
+#endif
+#ifdef TREE_ENABLE_VAR_LEN_VALUE
+    crc_processor.process_bytes(get_inline_value(), ValueDesc(value).inline_len());
+#endif
+    return crc_processor.checksum();
   }
   void unlock() { w_lock = 0; };
   void lock() { w_lock = 1; };
@@ -83,6 +169,10 @@ public:
 } __attribute__((packed));
 
 
+static_assert(sizeof(Leaf) + define::inlineValLenMax + define::kvLenUnit <= define::allocAlignLeafSize);
+static_assert(sizeof(Leaf) + define::inlineValLenMax < (1 << define::kvLenBit) * define::kvLenUnit);  // fits in kv_len
+
+
 /*
   Header
 */
@@ -253,6 +343,15 @@ public:
   GlobalAddress addr() const {
     return GlobalAddress{packed_addr.mn_id, packed_addr.offset << ALLOC_ALLIGN_BIT};
   }
+
+  // bytes to read for the leaf, kv_len is in units of define::kvLenUnit (0: too big to record)
+  uint32_t leaf_size() const {
+    return kv_len ? kv_len * define::kvLenUnit : sizeof(Leaf);
+  }
+  static uint8_t leaf_kv_len(uint32_t leaf_size) {
+    auto kv_len = (leaf_size + define::kvLenUnit - 1) / define::kvLenUnit;
+    return kv_len < (1UL << define::kvLenBit) ? kv_len : 0;
+  }
 } __attribute__((packed));
 
 inline bool operator==(const InternalEntry &lhs, const InternalEntry &rhs) { return lhs.val == rhs.val; }
@@ -325,4 +424,40 @@ struct ScanContext {
               from(from), to(to), l_state(l_state), r_state(r_state) {}
 };
 
+
+// an entry of the ordered scan frontier: waiting to be read, or a leaf resolved in key order
+struct ScanItem {
+  ScanContext sc;
+  bool resolved;
+  Key k;
+  Value v;
+  ScanItem() {}
+  ScanItem(const ScanContext& sc) : sc(sc), resolved(false) {}
+  ScanItem(const Key& k, const Value& v) : resolved(true), k(k), v(v) {}
+};
+
+
+// the traversal state of a key in a batched multi_search
+struct SearchContext {
+  InternalEntry e;
+  GlobalAddress e_ptr;
+  int depth;
+  int cache_depth;
+  bool from_cache;
+  volatile CacheEntry** entry_ptr_ptr;
+  CacheEntry* entry_ptr;
+};
+
+
+// an open node of a bulk loaded tree, its page collects the closed children
+struct LoadingNode {
+  GlobalAddress addr;
+  int pos;        // the depth of the partial telling its children apart
+  int extent_id;  // the extent its page is laid out in
+  int cnt;
+  Key k;          // a key in the subtree
+  InternalPage page;
+  LoadingNode(const GlobalAddress& addr, int pos, int extent_id, const Key& k) : addr(addr), pos(pos), extent_id(extent_id), cnt(0), k(k) {}
+};
+
 #endif // _NODE_H_
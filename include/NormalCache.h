@@ -17,12 +17,12 @@ struct CacheEntry {
   uint8_t depth;
   GlobalAddress addr;
   std::vector<InternalEntry> records;
-  // faa
-  // volatile mutable uint64_t counter;
+  // CLOCK reference weight, reset on hits
+  volatile uint8_t ref;
 
-  CacheEntry() {}
+  CacheEntry() : ref(0) {}
   CacheEntry(const InternalPage* p_node, const GlobalAddress& addr) :
-             depth(p_node->hdr.depth + p_node->hdr.partial_len), addr(addr) {
+             depth(p_node->hdr.depth + p_node->hdr.partial_len), addr(addr), ref(0) {
     for (int i = 0; i < node_type_to_num(p_node->hdr.type()); ++ i) {
       const auto& e = p_node->records[i];
       records.push_back(e);
@@ -5,104 +5,207 @@
 #include "Node.h"
 #include "NormalCache.h"
 
-#include <tbb/concurrent_hash_map.h>
-#include <tbb/concurrent_unordered_map.h>
 #include <tbb/concurrent_queue.h>
 // #include <tbb/concurrent_vector.h>
 #include <vector>
 #include <queue>
 #include <atomic>
-#include <stack>
+#include <algorithm>
+#include <string>
+#include <emmintrin.h>
 
 
+class CacheNode;
+
+// tombstones of a value being unlinked from its node
+#define CACHE_DEAD_ENTRY ((CacheEntry *)0x1)
+#define CACHE_DEAD_NODE  ((CacheNode *)0x1)
+
 struct CacheNodeValue {
   volatile CacheEntry* cache_entry;
-  volatile void * next;
+  CacheNode* volatile next;
+  CacheNode* volatile* owner;  // where the node holding the value is linked, to unlink the value on eviction
+  uint8_t partial;
+
+  CacheNodeValue() :  cache_entry(nullptr), next(nullptr), owner(nullptr), partial(0) {}
+  CacheNodeValue(CacheEntry* cache_entry, CacheNode* next) :
+                 cache_entry(cache_entry), next(next), owner(nullptr), partial(0) {}
 
-  CacheNodeValue() :  cache_entry(nullptr), next(nullptr) {}
-  CacheNodeValue(CacheEntry* cache_entry, void *next) :
-                 cache_entry(cache_entry), next(next) {}
+  bool is_dead() const { return cache_entry == CACHE_DEAD_ENTRY; }
+  CacheEntry* entry() const { auto e = (CacheEntry *)cache_entry; return e == CACHE_DEAD_ENTRY ? nullptr : e; }
+  CacheNode* child() const { CacheNode* n = next; return n == CACHE_DEAD_NODE ? nullptr : n; }
+};
+
+
+// byte array to index the cache (at most define::keyLen - 1 bytes), a view of a key or of a buffer on the stack
+struct CacheKeyView {
+  const uint8_t* bytes;
+  int len;
+
+  CacheKeyView(const uint8_t* bytes, int len) : bytes(bytes), len(len) {}
+
+  uint8_t operator[](int i) const { return bytes[i]; }
+  int size() const { return len; }
+  uint8_t back() const { return bytes[len - 1]; }
 };
 
 
 class CacheHeader {
 public:
   uint8_t depth;
-  std::vector<uint8_t> partial;
+  uint8_t partial_len;
+  uint8_t partial[define::keyLen];
 
-  CacheHeader() : depth(0) {}
+  CacheHeader() : depth(0), partial_len(0) {}
 
-  CacheHeader(const std::vector<uint8_t>& byte_array, int depth, int partial_len) : depth(depth) {
-    for (int i = 0; i < partial_len; ++ i) {
-      partial.push_back(byte_array[depth + i]);
-    }
+  CacheHeader(const CacheKeyView& byte_array, int depth, int partial_len) : depth(depth), partial_len(partial_len) {
+    memcpy(partial, byte_array.bytes + depth, partial_len);
   }
 
-  static CacheHeader* split_header(const CacheHeader* old_hdr, int diff_idx) {
-    auto new_hdr = new CacheHeader();
-    for (int i = diff_idx + 1; i < (int)old_hdr->partial.size(); ++ i) new_hdr->partial.push_back(old_hdr->partial[i]);
-    new_hdr->depth = old_hdr->depth + diff_idx + 1;
+  static CacheHeader split_header(const CacheHeader& old_hdr, int diff_idx) {
+    auto new_hdr = CacheHeader();
+    new_hdr.partial_len = old_hdr.partial_len - diff_idx - 1;
+    memcpy(new_hdr.partial, old_hdr.partial + diff_idx + 1, new_hdr.partial_len);
+    new_hdr.depth = old_hdr.depth + diff_idx + 1;
     return new_hdr;
   }
-
-  uint64_t content_size() const {
-    return sizeof(uint8_t) + sizeof(uint8_t) * partial.size();
-  }
 };
 
 
-class no_hash {
-public:
-  no_hash() {}
-  uint8_t operator() (const uint8_t& key) const { return key; }
+/*
+  node: [header, records], in ART-style layouts of growing sizes
+  A published node is immutable: adding a child or splitting the header
+  makes a new copy and CASes it into the parent value (or the cache root).
+  The values are allocated apart, so that their addresses stay valid across copies.
+*/
+enum CacheNodeType : uint8_t {
+  CACHE_NODE_4,
+  CACHE_NODE_16,
+  CACHE_NODE_48,
+  CACHE_NODE_256,
 };
-using CacheMap = tbb::concurrent_unordered_map<uint8_t, CacheNodeValue, no_hash>;
 
 
-/*
-  node: [header, records]
-*/
 class CacheNode {
 public:
-  volatile CacheHeader* header;
-  CacheMap records;  // value is const
+  CacheHeader hdr;
+  CacheNodeType type;
+  uint16_t num;
 
-  CacheNode() {
-    header = new CacheHeader();
-  }
+  CacheNode(CacheNodeType type, const CacheHeader& hdr) : hdr(hdr), type(type), num(0) {}
 
-  // insert leaf node
-  CacheNode(const std::vector<uint8_t>& byte_array, int start, CacheEntry* new_entry) {
-    header = new CacheHeader(byte_array, start, byte_array.size() - start - 1);
-    records[byte_array.back()] = CacheNodeValue(new_entry, nullptr);
-  }
+  CacheNodeValue* find(uint8_t partial) const;
+  template <class F>
+  void for_each(F func) const;
+
+  // a copy with the given header and an optional new child, grown if full; dead values are dropped
+  CacheNode* copy(const CacheHeader& new_hdr, int partial = -1, CacheNodeValue* value = nullptr) const;
+  // all values are dead
+  bool is_empty() const;
 
+  // memory consumed by the node and its values
+  uint64_t content_size() const;
+
+  static CacheNode* create(CacheNodeType type, const CacheHeader& hdr);
+  // insert leaf node, entry_value is the value holding new_entry
+  static CacheNode* create(const CacheKeyView& byte_array, int start, CacheEntry* new_entry, CacheNodeValue* &entry_value);
   // split internal node
-  CacheNode(const std::vector<uint8_t>& byte_array, int start, int partial_len,
-            uint8_t partial_1, CacheNode* next_node, uint8_t partial_2, CacheEntry* new_entry, CacheNode* &nested_node) {
-    header = new CacheHeader(byte_array, start, partial_len);
-    if (partial_1 == partial_2) {  // split for insert new_entry at old header
-      records[partial_1] = CacheNodeValue(new_entry, next_node);
+  static CacheNode* create(const CacheKeyView& byte_array, int start, int partial_len,
+                           uint8_t partial_1, CacheNode* next_node, uint8_t partial_2, CacheEntry* new_entry, CacheNode* &nested_node, CacheNodeValue* &entry_value);
+  // the values are shared with the copies, so only those of an unpublished node can be freed with it
+  static void destroy(CacheNode* node, bool with_values = false);
+
+private:
+  void append(uint8_t partial, CacheNodeValue* value);
+};
+
+
+class CacheNode4 : public CacheNode {
+public:
+  uint8_t keys[4];
+  CacheNodeValue* children[4];
+
+  CacheNode4(const CacheHeader& hdr) : CacheNode(CACHE_NODE_4, hdr) {}
+
+  void add(uint8_t partial, CacheNodeValue* value) { value->partial = partial; keys[num] = partial; children[num ++] = value; }
+};
+
+
+class CacheNode16 : public CacheNode {
+public:
+  uint8_t keys[16];
+  CacheNodeValue* children[16];
+
+  CacheNode16(const CacheHeader& hdr) : CacheNode(CACHE_NODE_16, hdr) {}
+};
+
+
+class CacheNode48 : public CacheNode {
+public:
+  uint8_t child_index[256];  // 0: empty, i: children[i - 1]
+  CacheNodeValue* children[48];
+
+  CacheNode48(const CacheHeader& hdr) : CacheNode(CACHE_NODE_48, hdr) { memset(child_index, 0, sizeof(child_index)); }
+};
+
+
+class CacheNode256 : public CacheNode {
+public:
+  CacheNodeValue* children[256];
+
+  CacheNode256(const CacheHeader& hdr) : CacheNode(CACHE_NODE_256, hdr) { memset(children, 0, sizeof(children)); }
+};
+
+
+inline CacheNodeValue* CacheNode::find(uint8_t partial) const {
+  switch (type) {
+    case CACHE_NODE_4: {
+      auto node = (const CacheNode4 *)this;
+      for (int i = 0; i < num; ++ i) {
+        if (node->keys[i] == partial) return node->children[i];
+      }
+      return nullptr;
     }
-    else {
-      records[partial_1] = CacheNodeValue(nullptr, next_node);
-      if (start + partial_len >= (int)byte_array.size() - 1) {  // insert entry directly
-        nested_node = nullptr;
-        records[partial_2] = CacheNodeValue(new_entry, nullptr);
+    case CACHE_NODE_16: {
+      auto node = (const CacheNode16 *)this;
+      auto cmp = _mm_cmpeq_epi8(_mm_set1_epi8(partial), _mm_loadu_si128((const __m128i *)node->keys));
+      int mask = _mm_movemask_epi8(cmp) & ((1 << num) - 1);
+      return mask ? node->children[__builtin_ctz(mask)] : nullptr;
+    }
+    case CACHE_NODE_48: {
+      auto node = (const CacheNode48 *)this;
+      return node->child_index[partial] ? node->children[node->child_index[partial] - 1] : nullptr;
+    }
+    default:
+      return ((const CacheNode256 *)this)->children[partial];
+  }
+}
+
+
+template <class F>
+void CacheNode::for_each(F func) const {
+  switch (type) {
+    case CACHE_NODE_4:
+      for (int i = 0; i < num; ++ i) func(((const CacheNode4 *)this)->keys[i], ((const CacheNode4 *)this)->children[i]);
+      break;
+    case CACHE_NODE_16:
+      for (int i = 0; i < num; ++ i) func(((const CacheNode16 *)this)->keys[i], ((const CacheNode16 *)this)->children[i]);
+      break;
+    case CACHE_NODE_48: {
+      auto node = (const CacheNode48 *)this;
+      for (int i = 0; i < 256; ++ i) {
+        if (node->child_index[i]) func((uint8_t)i, node->children[node->child_index[i] - 1]);
       }
-      else {  // insert leaf node
-        nested_node = new CacheNode(byte_array, start + partial_len + 1, new_entry);
-        records[partial_2] = CacheNodeValue(nullptr, nested_node);
+      break;
+    }
+    default: {
+      auto node = (const CacheNode256 *)this;
+      for (int i = 0; i < 256; ++ i) {
+        if (node->children[i]) func((uint8_t)i, node->children[i]);
       }
     }
   }
-
-  uint64_t content_size() const {
-    return ((CacheHeader *)header)->content_size() + (sizeof(uint8_t) + sizeof(CacheEntry *) + sizeof(CacheNode *)) * records.size();
-  }
-
-  ~CacheNode() { delete header; }
-};
+}
 
 
 /*
@@ -118,19 +221,9 @@ public:
     free_size.fetch_add(-_size);
   }
 
-  using NodeSizeMap = tbb::concurrent_hash_map<CacheNode*, uint64_t>;
-  void consume_by_node(CacheNode* node) {
+  void consume_by_node(const CacheNode* node) {
 #ifdef CACHE_ENABLE_ART
-    auto new_size = node->content_size();
-    NodeSizeMap::accessor w_entry;
-    auto new_inserted = node_mem_size.insert(w_entry, node);
-    auto old_size = new_inserted ? 0 : w_entry->second;
-    if (new_size == old_size) {
-      return;
-    }
-    w_entry->second = new_size;
-    // free_size -= new_size - old_size;
-    free_size.fetch_add(-new_size + old_size);
+    consume(node->content_size());
 #else
     return;  // emulate normal cache
 #endif
@@ -140,16 +233,22 @@ public:
     free_size.fetch_add(_size);
   }
 
+  void free_by_node(const CacheNode* node) {
+#ifdef CACHE_ENABLE_ART
+    free(node->content_size());
+#else
+    return;  // emulate normal cache
+#endif
+  }
+
   int64_t remain_size() const {
     return free_size.load();
   }
 
 private:
   std::atomic<int64_t> free_size;
-  NodeSizeMap node_mem_size;
 };
 
-
 struct SearchRet {
   volatile CacheEntry** entry_ptr_ptr;
   CacheEntry* entry_ptr;
@@ -161,6 +260,37 @@ struct SearchRet {
 };
 
 
+// the cache entries on the path of a lookup, deepest on top
+class SearchRetStk {
+public:
+  SearchRetStk() : cnt(0) {}
+
+  void push(const SearchRet& item) { assert(cnt < (int)define::keyLen); items[cnt ++] = item; }
+  const SearchRet& top() const { return items[cnt - 1]; }
+  void pop() { cnt --; }
+  bool empty() const { return cnt == 0; }
+
+private:
+  SearchRet items[define::keyLen];
+  int cnt;
+};
+
+
+/*
+  Objects unlinked from the cache are retired with the global epoch read after unlinking,
+  and freed once every operation in progress has announced a later epoch.
+*/
+struct RetiredObj {
+  enum Type : uint8_t {ENTRY, NODE, VALUE};
+  uint64_t epoch;
+  void* ptr;
+  Type type;
+
+  RetiredObj() {}
+  RetiredObj(uint64_t epoch, void* ptr, Type type) : epoch(epoch), ptr(ptr), type(type) {}
+};
+
+
 class RadixCache {
 
 public:
@@ -172,34 +302,67 @@ public:
   void search_range_from_cache(const Key &from, const Key &to, std::vector<RangeCache> &result);
   void invalidate(volatile CacheEntry** entry_ptr_ptr, CacheEntry* entry_ptr);
   void statistics();
+  // snapshot of the cached entries for a warm restart, the loaded ones are validated lazily like any stale entry
+  bool dump(const std::string& path);
+  bool load(const std::string& path);
+
+  // announce the epoch of an operation, nullptr if it is nested in an announced one
+  std::atomic<uint64_t>* enter_epoch(int thread_id, int coro_id);
+  static const uint64_t kIdleEpoch = std::numeric_limits<uint64_t>::max();
+  // objects retired at an epoch below min_active_epoch() are no longer seen by any operation
+  uint64_t current_epoch() const { return global_epoch.load(); }
+  uint64_t min_active_epoch();
 
 private:
-  void _insert(const CacheKey& byte_array, CacheEntry* new_entry);
+  void _add(const CacheKeyView& byte_array, CacheEntry* new_entry);
+  void _insert(const CacheKeyView& byte_array, CacheEntry* new_entry);
+  bool _replace_node(CacheNode* volatile* node_ref, CacheNode* node, CacheNode* new_node);
+  bool _search(const CacheKeyView& byte_array, SearchRetStk& ret);
+  CacheNodeValue* _search_cover(const Key& from, const Key& to, int min_len);
+  bool _cover(CacheNodeValue* value, const Key& from, const Key& to, std::vector<RangeCache> &result);
 
-  using SearchRetStk = std::stack<SearchRet>;
-  bool _search(const CacheKey& byte_array, SearchRetStk& ret);
-  // bool _random_search(SearchRetStk& ret);
+  void _link(CacheNode* node, CacheNode* volatile* node_ref, bool fresh);
+  void _retire(CacheNode* node, CacheNode* new_node);
 
   void _evict();
-  // void _evict_one();
+  bool _evict_one(CacheNodeValue* value);
+  static uint8_t clock_weight(int depth) { return std::max((int)define::kIndexCacheClockWeight + 2 - depth, 1); }
   void _safely_delete(CacheEntry* cache_entry);
-  void _safely_delete(CacheHeader* cache_hdr);
+  void _safely_delete(CacheNode* cache_node);
+  void _safely_delete(CacheNodeValue* cache_value);
+  void _retire(const RetiredObj& obj);
+  void _reclaim();
 
 private:
   // Cache
   uint64_t cache_size; // MB
   FreeMemManager* free_manager;
-  CacheNode* cache_root;
-  tbb::concurrent_queue<CacheNode*>* node_queue;
+  CacheNode* volatile cache_root;
+
+  // GC: epoch-based reclamation
+  struct alignas(define::kCacheLineSize) EpochSlot {
+    std::atomic<uint64_t> epoch{kIdleEpoch};
+  };
+  std::atomic<uint64_t> global_epoch{0};
+  EpochSlot epoch_slots[MAX_APP_THREAD][MAX_CORO_NUM];
+  tbb::concurrent_queue<RetiredObj> retired;
+  std::atomic<uint64_t> retired_cnt{0};
+  static const int reclaim_batch = 1024;  // retired objects between two reclamations
+
+  // CLOCK Eviction
+  DSM *dsm;
+  tbb::concurrent_queue<CacheNodeValue*> clock;  // each linked value once, swept in FIFO order
+};
 
-  // GC
-  tbb::concurrent_queue<CacheEntry*> cache_entry_gc;
-  tbb::concurrent_queue<CacheHeader*> cache_hdr_gc;
-  static const int safely_free_epoch = 2 * MAX_APP_THREAD * MAX_CORO_NUM;
 
-  // FIFIO Eviction
-  DSM *dsm;
-  tbb::concurrent_queue<std::pair<volatile CacheEntry**, CacheEntry*> > eviction_list;
+// keeps the cache entries read by an operation from being freed until it finishes
+class EpochGuard {
+public:
+  EpochGuard(RadixCache* cache, int thread_id, int coro_id) : slot(cache->enter_epoch(thread_id, coro_id)) {}
+  ~EpochGuard() { if (slot) slot->store(RadixCache::kIdleEpoch, std::memory_order_release); }
+
+private:
+  std::atomic<uint64_t>* slot;
 };
 
 #endif // _RADIX_CACHE_H_
@@ -3,6 +3,8 @@
 
 #include "Common.h"
 
+#include <algorithm>
+
 // abstract rdma registered buffer
 class RdmaBuffer {
 
@@ -22,7 +24,11 @@ private:
   uint64_t * header_buffer;
   uint64_t * entry_buffer;
   char   *range_buffer;
+  int64_t range_buffer_size;
   char   *zero_byte;
+#ifdef TREE_ENABLE_VAR_LEN_VALUE
+  char   *value_buffer;
+#endif
 
   int cas_buffer_cur;
   int page_buffer_cur;
@@ -31,8 +37,8 @@ private:
   int entry_buffer_cur;
 
 public:
-  RdmaBuffer(char *buffer) {
-    set_buffer(buffer);
+  RdmaBuffer(char *buffer, int64_t size) {
+    set_buffer(buffer, size);
 
     cas_buffer_cur    = 0;
     page_buffer_cur   = 0;
@@ -43,7 +49,7 @@ public:
 
   RdmaBuffer() = default;
 
-  void set_buffer(char *buffer) {
+  void set_buffer(char *buffer, int64_t size) {
     // printf("set buffer %p\n", buffer);
     this->buffer  = buffer;
     cas_buffer    = (uint64_t *)buffer;
@@ -52,10 +58,16 @@ public:
     header_buffer = (uint64_t *)((char *)leaf_buffer   + define::allocAlignLeafSize * kLeafBufferCnt);
     entry_buffer  = (uint64_t *)((char *)header_buffer + sizeof(uint64_t)   * kHeaderBufferCnt);
     zero_byte     = (char     *)((char *)entry_buffer  + sizeof(uint64_t)   * kEntryBufferCnt);
+#ifdef TREE_ENABLE_VAR_LEN_VALUE
+    value_buffer  = (char     *)((char *)zero_byte     + sizeof(char));
+    range_buffer  = (char     *)((char *)value_buffer  + define::valLenMax);
+#else
     range_buffer  = (char     *)((char *)zero_byte     + sizeof(char));
+#endif
     *zero_byte    = '\0';
 
-    assert(range_buffer - buffer < define::kPerCoroRdmaBuf);
+    range_buffer_size = size - (range_buffer - buffer);
+    assert(range_buffer_size >= define::allocationPageSize);
   }
 
   uint64_t *get_cas_buffer() {
@@ -87,9 +99,25 @@ public:
     return range_buffer;
   }
 
+  int64_t get_range_buffer_size() {
+    return range_buffer_size;
+  }
+
+  // nodes / leaves the range buffer holds in one batch read
+  int get_range_page_cnt() {
+    return std::min<int64_t>(kReadOroMax, range_buffer_size / define::allocationPageSize);
+  }
+
   char *get_zero_byte() {
     return zero_byte;
   }
+
+#ifdef TREE_ENABLE_VAR_LEN_VALUE
+  // the value being written / read by the coroutine
+  char *get_value_buffer() {
+    return value_buffer;
+  }
+#endif
 };
 
 #endif // _RDMA_BUFFER_H_
@@ -5,6 +5,7 @@
 #include "DSM.h"
 #include "Common.h"
 #include "LocalLockTable.h"
+#include "Histogram.h"
 
 #include <atomic>
 #include <city.h>
@@ -12,20 +13,40 @@
 #include <map>
 #include <algorithm>
 #include <queue>
+#include <deque>
 #include <set>
 #include <iostream>
+#include <future>
+#include <mutex>
+#include <tbb/concurrent_queue.h>
 
 
 /*
   Workloads
 */
+enum RequestType {
+  READ_REQ,
+  UPDATE_REQ,
+  INSERT_REQ,
+  DELETE_REQ,
+  SCAN_REQ,
+  REQ_TYPE_NUM,
+};
+constexpr const char *kRequestTypeName[REQ_TYPE_NUM] = {"read", "update", "insert", "delete", "scan"};
+
 struct Request {
   bool is_search;
   bool is_insert;
   bool is_update;
+  bool is_delete;
   Key k;
   Value v;
   int range_size;
+  uint64_t start_ns = 0;  // scheduled start of open-loop requests, which their latency counts from
+
+  RequestType type() const {
+    return is_search ? READ_REQ : is_update ? UPDATE_REQ : is_insert ? INSERT_REQ : is_delete ? DELETE_REQ : SCAN_REQ;
+  }
 };
 
 
@@ -36,11 +57,33 @@ public:
 };
 
 
+/*
+  Asynchronous requests, submitted from any thread and served by the coroutines of the threads in Tree::run_async()
+*/
+enum AsyncOp {
+  ASYNC_SEARCH,
+  ASYNC_INSERT,
+  ASYNC_REMOVE,
+  ASYNC_SCAN,
+};
+
+struct AsyncRequest {
+  AsyncOp op;
+  Key k;
+  Value v;
+  bool is_update;
+  int limit;  // of scan
+  bool ret;   // found / removed
+  std::vector<std::pair<Key, Value> > kvs;  // scanned
+  std::function<void (AsyncRequest *)> done;  // called on the serving thread
+};
+
+
 /*
   Tree
 */
 using GenFunc = std::function<RequstGen *(DSM*, Request*, int, int, int)>;
-#define MAX_FLAG_NUM 12
+#define MAX_FLAG_NUM 13
 enum {
   FIRST_TRY,
   CAS_NULL,
@@ -54,50 +97,131 @@ enum {
   INSERT_BEHIND_TRY_NEXT,
   SWITCH_RETRY,
   SWITCH_FIND_TARGET,
+  REMOVED_NODE,
 };
 
+
+// remote block unlinked by remove(), freed once the local operations that may have seen it have finished (they hold
+// the epochs of the index cache, if enabled), and no earlier than define::kReclaimGracePeriod for the operations of other CNs
+struct RetiredBlock {
+  enum Type : uint8_t {BLOCK, LOG_VALUE, LOG_SEGMENT};
+  GlobalAddress addr;
+  int size;
+  Type type;
+  uint64_t epoch;
+  uint64_t retire_time;
+
+  RetiredBlock() {}
+  RetiredBlock(const GlobalAddress &addr, int size, Type type, uint64_t epoch, uint64_t retire_time) :
+               addr(addr), size(size), type(type), epoch(epoch), retire_time(retire_time) {}
+};
+
+
+#ifdef TREE_ENABLE_VAR_LEN_VALUE
+// a value log segment, reused once its thread has moved on to another segment and all of its values are dead
+struct LogSegment {
+  uint64_t appended = 0;  // bytes, known once sealed
+  uint64_t dead = 0;
+  bool sealed = false;
+  bool retired = false;
+  std::vector<bool> dead_values = std::vector<bool>(define::kValueLogSegSize / 8);  // a value retired twice by racing updates counts once
+};
+#endif
+
 class Tree {
 public:
   Tree(DSM *dsm, uint16_t tree_id = 0);
 
   using WorkFunc = std::function<void (Tree *, const Request&, CoroContext *, int)>;
+  using ScanFunc = std::function<void (const Key&, Value)>;
+  using LoadFunc = std::function<bool (Key&, Value&)>;  // gets the next kv, false at the end
   void run_coroutine(GenFunc gen_func, WorkFunc work_func, int coro_cnt, Request* req = nullptr, int req_num = 0);
 
+  // serves the requests submitted by *_async() with coro_cnt coroutines until need_stop, the callbacks run on this thread;
+  // requests wait for a thread to serve them, and the ones left unserved when the last thread stops fail (not found /
+  // not removed / nothing scanned, and inserts are dropped)
+  void run_async(int coro_cnt);
+  using SearchCallback = std::function<void (bool, Value)>;  // (found, value)
+  using InsertCallback = std::function<void ()>;
+  using RemoveCallback = std::function<void (bool)>;  // removed
+  using ScanCallback   = std::function<void (std::vector<std::pair<Key, Value> >&)>;
+  void search_async(const Key &k, SearchCallback cb);
+  void insert_async(const Key &k, Value v, bool is_update, InsertCallback cb);
+  void remove_async(const Key &k, RemoveCallback cb);
+  void scan_async(const Key &from, int limit, ScanCallback cb);
+  std::future<std::pair<bool, Value> > search_async(const Key &k);
+  std::future<void> insert_async(const Key &k, Value v, bool is_update = false);
+  std::future<bool> remove_async(const Key &k);
+  std::future<std::vector<std::pair<Key, Value> > > scan_async(const Key &from, int limit);
+
   void insert(const Key &k, Value v, CoroContext *cxt = nullptr, int coro_id = 0, bool is_update = false, bool is_load = false);
   bool search(const Key &k, Value &v, CoroContext *cxt = nullptr, int coro_id = 0);
-  void range_query(const Key &from, const Key &to, std::map<Key, Value> &ret);
+#ifdef TREE_ENABLE_VAR_LEN_VALUE
+  // values of up to define::valLenMax bytes (the Value interface stores 8B values); scans and multi_search report ValueDesc
+  void insert(const Key &k, const char *val, uint32_t val_len, CoroContext *cxt = nullptr, int coro_id = 0, bool is_update = false, bool is_load = false);
+  bool search(const Key &k, std::string &val, CoroContext *cxt = nullptr, int coro_id = 0);
+#endif
+  void multi_search(const Key *keys, int n, Value *out, bool *found, CoroContext *cxt = nullptr, int coro_id = 0);
+  bool remove(const Key &k, CoroContext *cxt = nullptr, int coro_id = 0);
+  void range_query(const Key &from, const Key &to, std::map<Key, Value> &ret, CoroContext *cxt = nullptr, int coro_id = 0);
+  int scan(const Key &from, int limit, const ScanFunc &func, CoroContext *cxt = nullptr, int coro_id = 0);
+  bool bulk_load(const LoadFunc &next, CoroContext *cxt = nullptr, int coro_id = 0);
   void statistics();
-  void clear_debug_info();
+  // snapshot / warm-start the index cache of this CN across restarts
+  bool dump_cache(const std::string& path);
+  bool load_cache(const std::string& path);
 
   GlobalAddress get_root_ptr_ptr();
   InternalEntry get_root_ptr(CoroContext *cxt, int coro_id);
+  InternalEntry get_root_ptr(CoroContext *cxt, int coro_id, bool &from_cache);  // the cached root entry if any
 
 private:
+  void _insert(const Key &k, Value v, CoroContext *cxt, int coro_id, bool is_update, bool is_load);
+  bool _search(const Key &k, Value &v, CoroContext *cxt, int coro_id);
+#ifdef TREE_ENABLE_VAR_LEN_VALUE
+  GlobalAddress append_value_log(const char *val, uint32_t val_len, CoroContext *cxt, int coro_id);
+  void retire_value(const Value &v);
+  void free_log_value(const GlobalAddress &addr, int size);
+  void seal_log_segment(const GlobalAddress &seg_addr, uint64_t appended);
+  static uint64_t log_segment_key(const GlobalAddress &addr) { return ((uint64_t)addr.nodeID << 48) | addr.offset; }
+#endif
+  void run_master(int coro_cnt);
   void coro_worker(CoroYield &yield, RequstGen *gen, WorkFunc work_func, int coro_id);
+  void async_worker(CoroYield &yield, int coro_id);
   void coro_master(CoroYield &yield, int coro_cnt);
+  void submit(AsyncRequest *req);
 
   bool read_leaf(const GlobalAddress &leaf_addr, char *leaf_buffer, int leaf_size, const GlobalAddress &p_ptr, bool from_cache, CoroContext *cxt, int coro_id);
   void in_place_update_leaf(const Key &k, Value &v, const GlobalAddress &leaf_addr, Leaf *leaf,
                            CoroContext *cxt, int coro_id);
   bool out_of_place_update_leaf(const Key &k, Value &v, int depth, GlobalAddress& leaf_addr, const GlobalAddress &e_ptr, InternalEntry &old_e, const GlobalAddress& node_addr,
-                                CoroContext *cxt, int coro_id, bool disable_handover = false);
+                                bool &node_removed, CoroContext *cxt, int coro_id, bool disable_handover = false);
   bool out_of_place_write_leaf(const Key &k, Value &v, int depth, GlobalAddress& leaf_addr, uint8_t partial_key,
                                const GlobalAddress &e_ptr, const InternalEntry &old_e, const GlobalAddress& node_addr, uint64_t *ret_buffer,
-                               CoroContext *cxt, int coro_id);
+                               bool &node_removed, CoroContext *cxt, int coro_id, bool in_bound = true);
 
   bool read_node(InternalEntry &p, bool& type_correct, char *node_buffer, const GlobalAddress& p_ptr, int depth, bool from_cache,
                  CoroContext *cxt, int coro_id);
   bool out_of_place_write_node(const Key &k, Value &v, int depth, GlobalAddress& leaf_addr, int partial_len, uint8_t diff_partial,
                                const GlobalAddress &e_ptr, const InternalEntry &old_e, const GlobalAddress& node_addr, uint64_t *ret_buffer,
-                               CoroContext *cxt, int coro_id);
+                               bool &node_removed, CoroContext *cxt, int coro_id);
+  bool cas_node_entry(const GlobalAddress &e_ptr, const InternalEntry &old_e, const InternalEntry &new_e, const GlobalAddress& node_addr,
+                      bool in_bound, uint64_t *ret_buffer, bool &node_removed, CoroContext *cxt, int coro_id);
 
   bool insert_behind(const Key &k, Value &v, int depth, GlobalAddress& leaf_addr, uint8_t partial_key, NodeType node_type,
-                     const GlobalAddress &node_addr, uint64_t *ret_buffer, int& inserted_idx,
+                     const GlobalAddress &node_addr, uint64_t *ret_buffer, int& inserted_idx, bool &node_removed,
                      CoroContext *cxt, int coro_id);
   void search_entries(const Key &from, const Key &to, int target_depth, std::vector<ScanContext> &res,
                       CoroContext *cxt, int coro_id);
   void cas_node_type(NodeType next_type, GlobalAddress p_ptr, InternalEntry p, Header hdr,
                      CoroContext *cxt, int coro_id);
+  void shrink_node(const Key &k, const GlobalAddress& node_addr, CoroContext *cxt, int coro_id);
+  void collapse_node(const Key &k, const GlobalAddress& page_addr, InternalPage* p_node, const GlobalAddress &p_ptr, const InternalEntry &p,
+                     CoroContext *cxt, int coro_id);
+  void reclaim_later(const GlobalAddress &addr, int size, RetiredBlock::Type type = RetiredBlock::BLOCK);
+  void reclaim();
+  void update_root_cache(const InternalEntry &e);
+  void read_scan_entry(ScanContext &s, CoroContext *cxt, int coro_id);
   void range_query_on_page(InternalPage* page, bool from_cache, int depth,
                            GlobalAddress p_ptr, InternalEntry p,
                            const Key &from, const Key &to, State l_state, State r_state,
@@ -111,7 +235,7 @@ private:
 private:
   DSM *dsm;
 // #ifdef CACHE_ENABLE_ART
-  RadixCache *index_cache;
+  RadixCache *index_cache = nullptr;
 // #else
 //   NormalCache *index_cache;
 // #endif
@@ -119,10 +243,41 @@ private:
 
   static thread_local CoroCall worker[MAX_CORO_NUM];
   static thread_local CoroCall master;
-  static thread_local CoroQueue busy_waiting_queue;
+  static thread_local std::atomic<uint64_t> coro_ready;
+  static thread_local CoroWaker coro_waker[MAX_CORO_NUM];
+  static thread_local uint64_t coro_idle;  // coroutines of run_async() waiting for requests
+  static thread_local AsyncRequest *coro_async_req[MAX_CORO_NUM];
+#ifdef TREE_ENABLE_VAR_LEN_VALUE
+  static thread_local GlobalAddress value_log_seg;
+  static thread_local GlobalAddress value_log_cur;
+  static thread_local uint64_t value_log_remain;
+
+  // value log segments in use by their start addresses (see log_segment_key()), and the ones free for reuse
+  std::mutex log_segment_lock;
+  std::map<uint64_t, LogSegment> log_segments;
+  tbb::concurrent_queue<GlobalAddress> free_log_segments;
+#endif
+
+  // blocks retired by any thread, freed to the allocator of the thread reclaiming them
+  tbb::concurrent_queue<RetiredBlock> retired_blocks;
+  std::atomic<uint64_t> retired_cnt{0};
+  static const int kReclaimBatch = 64;  // retired blocks between two reclamations
+
+  // submission queues of the threads in run_async(), and the requests submitted while no thread serves;
+  // submitters pick a server from the list without the lock and announce themselves on it, so a thread leaving
+  // run_async() waits for the submissions in flight and gets no more of them. The lock guards joining, leaving
+  // and async_pending
+  tbb::concurrent_queue<AsyncRequest *> async_queues[MAX_APP_THREAD];
+  std::atomic<bool> async_serving[MAX_APP_THREAD] = {};
+  std::atomic<int> async_submitting[MAX_APP_THREAD] = {};
+  std::mutex async_server_lock;
+  std::atomic<int> async_servers[MAX_APP_THREAD] = {};
+  std::atomic<int> async_server_cnt{0};
+  std::vector<AsyncRequest *> async_pending;
 
   uint64_t tree_id;
   GlobalAddress root_ptr_ptr; // the address which stores root pointer;
+  std::atomic<uint64_t> cached_root{0};  // root entry cached on the CN, validated by the rev_ptr of the root node like cached entries
 };
 
 
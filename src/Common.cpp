@@ -18,6 +18,30 @@ void bindCore(uint16_t core) {
     }
 }
 
+// free stacks of the thread, linked through their lowest bytes
+static thread_local void *free_coro_stacks = nullptr;
+
+void CoroStackPool::allocate(boost::coroutines::stack_context &ctx, std::size_t size) {
+    assert(size <= define::kCoroStackSize);
+    UNUSED(size);
+    void *limit = free_coro_stacks;
+    if (limit) {
+        free_coro_stacks = *(void **)limit;
+    }
+    else {
+        limit = malloc(define::kCoroStackSize);
+        if (!limit) throw std::bad_alloc();
+    }
+    ctx.size = define::kCoroStackSize;
+    ctx.sp = (char *)limit + ctx.size;
+}
+
+void CoroStackPool::deallocate(boost::coroutines::stack_context &ctx) {
+    void *limit = (char *)ctx.sp - ctx.size;
+    *(void **)limit = free_coro_stacks;
+    free_coro_stacks = limit;
+}
+
 char *getIP() {
     struct ifreq ifr;
     int fd = socket(AF_INET, SOCK_DGRAM, 0);
@@ -1,13 +1,15 @@
 
 #include "DSM.h"
-#include "Directory.h"
 #include "HugePageAlloc.h"
-
+#ifdef DSM_LOOPBACK
+#include "Loopback.h"
+#else
+#include "Directory.h"
 #include "DSMKeeper.h"
+#endif
 #include "Key.h"
 
 #include <algorithm>
-#include <fstream>
 
 thread_local int DSM::thread_id = -1;
 thread_local ThreadConnection *DSM::iCon = nullptr;
@@ -34,16 +36,32 @@ DSM *DSM::getInstance(const DSMConfig &conf) {
 DSM::DSM(const DSMConfig &conf)
     : conf(conf), appID(0), cache(conf.cacheConfig) {
 
+#ifdef DSM_LOOPBACK
+  // this process is the only CN and hosts all MNs
+  this->conf.machineNR = 1;
+  baseAddr = 0;
+
+  Debug::notifyInfo("loopback shared memory size: %dGB x %d MNs", conf.dsmSize, MEMORY_NODE_NUM);
+#else
   baseAddr = (uint64_t)hugePageAlloc(conf.dsmSize * define::GB);
 
   Debug::notifyInfo("shared memory size: %dGB, 0x%lx", conf.dsmSize, baseAddr);
+#endif
   Debug::notifyInfo("rdma cache size: %dGB", conf.cacheConfig.cacheSize);
 
   // warmup
+#ifndef DSM_LOOPBACK
   memset((char *)baseAddr, 0, conf.dsmSize * define::GB);
+#endif
   memset((char *)cache.data, 0, cache.size * define::GB);
 
   initRDMAConnection();
+#ifdef DSM_LOOPBACK
+  for (int i = 0; i < MEMORY_NODE_NUM; ++i) {
+    loopbackDir[i] = new LoopbackDirectory(remoteInfo, conf.dsmSize * define::GB, i);
+  }
+  Debug::notifyInfo("Loopback memory servers start up");
+#else
   if (myNodeID < MEMORY_NODE_NUM) {  // start memory server
     for (int i = 0; i < NR_DIRECTORY; ++i) {
       dirAgent[i] =
@@ -52,9 +70,18 @@ DSM::DSM(const DSMConfig &conf)
     Debug::notifyInfo("Memory server %d start up", myNodeID);
   }
   keeper->barrier("DSM-init");
+#endif
 }
 
+#ifdef DSM_LOOPBACK
+DSM::~DSM() {
+  for (int i = 0; i < MEMORY_NODE_NUM; ++i) {
+    delete loopbackDir[i];
+  }
+}
+#else
 DSM::~DSM() { hugePageFree((void *)baseAddr, conf.dsmSize * define::GB); }
+#endif
 
 void DSM::registerThread() {
 
@@ -66,48 +93,45 @@ void DSM::registerThread() {
 
   iCon = thCon[thread_id];
 
+#ifndef DSM_LOOPBACK
   iCon->message->initRecv();
   iCon->message->initSend();
+#endif
   rdma_buffer = (char *)cache.data + thread_id * define::kPerThreadRdmaBuf;
 
-  for (int i = 0; i < MAX_CORO_NUM; ++i) {
-    rbuf[i].set_buffer(rdma_buffer + i * define::kPerCoroRdmaBuf);
-  }
-}
-
-void DSM::loadKeySpace(const std::string& load_workloads_path, bool is_str) {
-  keySpaceSize = 0;
-  std::string op, line, str_k;
-  int int_k;
-  std::ifstream load_in(load_workloads_path);
-  Debug::notifyInfo("Loading key space...");
-  while (std::getline(load_in, line)) {
-    if (!line.size()) continue;
-    std::istringstream tmp(line);
-    tmp >> op;
-    assert(op == "INSERT");
-    if(is_str) {
-      tmp >> str_k;
-      keyBuffer[keySpaceSize ++] = str2key(str_k);
-    }
-    else {
-      tmp >> int_k;
-      keyBuffer[keySpaceSize ++] = int2key(int_k);
-    }
-  }
-  Debug::notifyInfo("Key space load done: keySpaceSize=%d", keySpaceSize);
+  carveRdmaBuffer(1);
 }
 
-Key DSM::getRandomKey() {
-  uint32_t seed = asm_rdtsc();
-  return keyBuffer[rand_r(&seed) % keySpaceSize];
+void DSM::carveRdmaBuffer(int coro_cnt) {
+  assert(coro_cnt > 0 && coro_cnt <= MAX_CORO_NUM);
+  auto size = define::kPerThreadRdmaBuf / coro_cnt;
+  for (int i = 0; i < coro_cnt; ++i) {
+    rbuf[i].set_buffer(rdma_buffer + i * size, size);
+  }
 }
 
-Key DSM::getNoComflictKey(uint64_t key_hash, uint64_t global_thread_id, uint64_t global_thread_num) {
-  auto start = keySpaceSize / global_thread_num * global_thread_id;
-  return keyBuffer[start + key_hash % (keySpaceSize / global_thread_num)];
+#ifdef DSM_LOOPBACK
+void DSM::initRDMAConnection() {
+
+  Debug::notifyInfo("Machine NR: %d (loopback)", conf.machineNR);
+
+  // indexed by the MN id of a GlobalAddress
+  remoteInfo = new RemoteConnection[MEMORY_NODE_NUM];
+
+  for (int i = 0; i < MAX_APP_THREAD; ++i) {
+    thCon[i] =
+        new ThreadConnection(i, (void *)cache.data, cache.size * define::GB,
+                             MEMORY_NODE_NUM, remoteInfo);
+  }
+
+  keeper = nullptr;
+  myNodeID = 0;
 }
 
+GlobalAddress DSM::loopback_alloc_chunck(uint16_t node_id) {
+  return loopbackDir[node_id]->alloc_chunck();
+}
+#else
 void DSM::initRDMAConnection() {
 
   Debug::notifyInfo("Machine NR: %d", conf.machineNR);
@@ -129,6 +153,7 @@ void DSM::initRDMAConnection() {
   keeper = new DSMKeeper(thCon, dirCon, remoteInfo, conf.machineNR);
   myNodeID = keeper->getMyNodeID();
 }
+#endif
 
 void DSM::read(char *buffer, GlobalAddress gaddr, size_t size, bool signal,
                CoroContext *ctx) {
@@ -220,7 +245,8 @@ void DSM::read_batch_sync(RdmaOpRegion *rs, int k, CoroContext *ctx) {
 }
 
 void DSM::read_batches_sync(const std::vector<RdmaOpRegion>& rs, CoroContext *ctx, int coro_id) {
-  RdmaOpRegion each_rs[MAX_MACHINE][kReadOroMax];
+  // too big for a coroutine stack; safe to share since all batches are posted before yielding
+  thread_local RdmaOpRegion each_rs[MAX_MACHINE][kReadOroMax];
   int cnt[MAX_MACHINE];
 
   int i = 0;
@@ -235,7 +261,10 @@ void DSM::read_batches_sync(const std::vector<RdmaOpRegion>& rs, CoroContext *ct
       if (cnt[node_id] >= kReadOroMax) break;
     }
     for (int j = 0; j < MAX_MACHINE; ++ j) if (cnt[j] > 0) {
-      read_batch(each_rs[j], cnt[j], true, ctx);
+      for (int t = 0; t < cnt[j]; ++ t) {
+        fill_keys_dest(each_rs[j][t], GlobalAddress{each_rs[j][t].dest}, each_rs[j][t].is_on_chip);
+      }
+      rdmaReadBatch(iCon->data[0][j], each_rs[j], cnt[j], true, ctx == nullptr ? 0 : ctx->coro_id);
       poll_num ++;
     }
   }
@@ -244,6 +273,11 @@ void DSM::read_batches_sync(const std::vector<RdmaOpRegion>& rs, CoroContext *ct
     ibv_wc wc;
     pollWithCQ(iCon->cq, poll_num, &wc);
   }
+  else {  // all batches are in flight together, coro_master resumes us once per completion
+    while (poll_num --) {
+      (*ctx->yield)(*ctx->master);
+    }
+  }
 }
 
 void DSM::write_batch(RdmaOpRegion *rs, int k, bool signal, CoroContext *ctx) {
@@ -0,0 +1,141 @@
+#include "Metrics.h"
+
+#include <cstdio>
+#include <fstream>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+
+Metrics metrics;
+
+
+MetricsSnapshot Metrics::snapshot() const {
+  MetricsSnapshot s{};
+  for (int i = 0; i < MAX_APP_THREAD; ++ i) {
+    const auto& t = threads[i];
+    for (int j = 0; j < METRIC_NUM; ++ j) s.cnt[j] += t.cnt[j].load(std::memory_order_relaxed);
+    for (int j = 0; j < MAX_NODE_TYPE_NUM; ++ j) s.read_node_type[j] += t.read_node_type[j].load(std::memory_order_relaxed);
+    for (int j = 0; j < MAX_FLAG_NUM; ++ j) s.retry_cnt[j] += t.retry_cnt[j].load(std::memory_order_relaxed);
+    s.cache_hit += t.cache_hit.load(std::memory_order_relaxed);
+    s.cache_miss += t.cache_miss.load(std::memory_order_relaxed);
+  }
+  return s;
+}
+
+
+MetricsSnapshot MetricsSnapshot::operator-(const MetricsSnapshot &pre) const {
+  MetricsSnapshot s;
+  for (int j = 0; j < METRIC_NUM; ++ j) s.cnt[j] = cnt[j] - pre.cnt[j];
+  for (int j = 0; j < MAX_NODE_TYPE_NUM; ++ j) s.read_node_type[j] = read_node_type[j] - pre.read_node_type[j];
+  for (int j = 0; j < MAX_FLAG_NUM; ++ j) s.retry_cnt[j] = retry_cnt[j] - pre.retry_cnt[j];
+  s.cache_hit = cache_hit - pre.cache_hit;
+  s.cache_miss = cache_miss - pre.cache_miss;
+  return s;
+}
+
+
+std::string MetricsSnapshot::to_prometheus(int node_id) const {
+  std::string out;
+  char line[256];
+  auto append = [&](const char *fmt, auto... args) {
+    int len = snprintf(line, sizeof(line), fmt, args...);
+    out.append(line, len);
+  };
+  for (int j = 0; j < METRIC_NUM; ++ j) {
+    append("# TYPE smart_%s_total counter\n", kMetricName[j]);
+    append("smart_%s_total{node=\"%d\"} %lu\n", kMetricName[j], node_id, cnt[j]);
+  }
+  append("# TYPE smart_read_node_total counter\n");
+  for (int j = 1; j < MAX_NODE_TYPE_NUM; ++ j) {
+    append("smart_read_node_total{node=\"%d\",type=\"%d\"} %lu\n", node_id, j, read_node_type[j]);
+  }
+  append("# TYPE smart_retry_total counter\n");
+  for (int j = 0; j < MAX_FLAG_NUM; ++ j) {
+    append("smart_retry_total{node=\"%d\",flag=\"%d\"} %lu\n", node_id, j, retry_cnt[j]);
+  }
+  // rate(_sum) / rate(_count) is the cache hit rate
+  append("# TYPE smart_cache_hit_depth summary\n");
+  append("smart_cache_hit_depth_sum{node=\"%d\"} %.3f\n", node_id, cache_hit);
+  append("smart_cache_hit_depth_count{node=\"%d\"} %.0f\n", node_id, cache_hit + cache_miss);
+  return out;
+}
+
+
+void Metrics::start_exporter(const std::string &target, int node_id, int interval_ms) {
+  stop_exporter();
+  exporter_stop = false;
+  bool is_port = !target.empty() && target.find_first_not_of("0123456789") == std::string::npos;
+  if (is_port) {
+    exporter = std::thread(&Metrics::export_to_socket, this, std::stoi(target), node_id, interval_ms);
+  }
+  else {
+    exporter = std::thread(&Metrics::export_to_file, this, target, node_id, interval_ms);
+  }
+}
+
+
+void Metrics::stop_exporter() {
+  exporter_stop = true;
+  if (exporter.joinable()) exporter.join();
+}
+
+
+void Metrics::export_to_file(const std::string &path, int node_id, int interval_ms) {
+  auto tmp_path = path + ".tmp";
+  while (!exporter_stop) {
+    {
+      std::ofstream out(tmp_path, std::ios::trunc);
+      out << snapshot().to_prometheus(node_id);
+    }
+    if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+      Debug::notifyError("can't export metrics to %s", path.c_str());
+      return;
+    }
+    for (int t = 0; t < interval_ms && !exporter_stop; t += 100) {
+      usleep(std::min(100, interval_ms - t) * 1000);
+    }
+  }
+}
+
+
+void Metrics::export_to_socket(int port, int node_id, int interval_ms) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  int on = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (bind(fd, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 16) != 0) {
+    Debug::notifyError("can't export metrics to port %d", port);
+    close(fd);
+    return;
+  }
+  // a scrape gets the snapshot at its arrival, the interval only bounds how long stop_exporter() waits
+  pollfd pfd{fd, POLLIN, 0};
+  while (!exporter_stop) {
+    if (poll(&pfd, 1, std::min(interval_ms, 100)) <= 0) continue;
+    int conn = accept(fd, nullptr, nullptr);
+    if (conn < 0) continue;
+    // a client that sends or reads nothing must not block the exporter, so stop_exporter() always returns
+    timeval timeout{0, 100 * 1000};
+    setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(conn, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    char req[1024];
+    UNUSED(recv(conn, req, sizeof(req), 0));  // any request gets the metrics
+    auto body = snapshot().to_prometheus(node_id);
+    auto resp = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+                std::to_string(body.size()) + "\r\n\r\n" + body;
+    for (size_t sent = 0; sent < resp.size() && !exporter_stop; ) {
+      auto n = send(conn, resp.data() + sent, resp.size() - sent, MSG_NOSIGNAL);
+      if (n <= 0) break;
+      sent += n;
+    }
+    close(conn);
+  }
+  close(fd);
+}
@@ -5,13 +5,113 @@
 #include <vector>
 #include <set>
 #include <queue>
+#include <fstream>
+
+
+CacheNode* CacheNode::create(CacheNodeType type, const CacheHeader& hdr) {
+  switch (type) {
+    case CACHE_NODE_4:  return new CacheNode4(hdr);
+    case CACHE_NODE_16: return new CacheNode16(hdr);
+    case CACHE_NODE_48: return new CacheNode48(hdr);
+    default:            return new CacheNode256(hdr);
+  }
+}
+
+
+CacheNode* CacheNode::create(const CacheKeyView& byte_array, int start, CacheEntry* new_entry, CacheNodeValue* &entry_value) {
+  auto node = new CacheNode4(CacheHeader(byte_array, start, byte_array.size() - start - 1));
+  entry_value = new CacheNodeValue(new_entry, nullptr);
+  node->add(byte_array.back(), entry_value);
+  return node;
+}
+
+
+CacheNode* CacheNode::create(const CacheKeyView& byte_array, int start, int partial_len,
+                             uint8_t partial_1, CacheNode* next_node, uint8_t partial_2, CacheEntry* new_entry, CacheNode* &nested_node, CacheNodeValue* &entry_value) {
+  auto node = new CacheNode4(CacheHeader(byte_array, start, partial_len));
+  if (partial_1 == partial_2) {  // split for insert new_entry at old header
+    entry_value = new CacheNodeValue(new_entry, next_node);
+    node->add(partial_1, entry_value);
+  }
+  else {
+    node->add(partial_1, new CacheNodeValue(nullptr, next_node));
+    if (start + partial_len >= (int)byte_array.size() - 1) {  // insert entry directly
+      nested_node = nullptr;
+      entry_value = new CacheNodeValue(new_entry, nullptr);
+      node->add(partial_2, entry_value);
+    }
+    else {  // insert leaf node
+      nested_node = create(byte_array, start + partial_len + 1, new_entry, entry_value);
+      node->add(partial_2, new CacheNodeValue(nullptr, nested_node));
+    }
+  }
+  return node;
+}
+
+
+void CacheNode::destroy(CacheNode* node, bool with_values) {
+  if (with_values) {
+    node->for_each([](uint8_t, CacheNodeValue* value) { delete value; });
+  }
+  switch (node->type) {
+    case CACHE_NODE_4:  delete (CacheNode4 *)node;   break;
+    case CACHE_NODE_16: delete (CacheNode16 *)node;  break;
+    case CACHE_NODE_48: delete (CacheNode48 *)node;  break;
+    default:            delete (CacheNode256 *)node; break;
+  }
+}
+
+
+CacheNode* CacheNode::copy(const CacheHeader& new_hdr, int partial, CacheNodeValue* value) const {
+  static const int capacity[] = {4, 16, 48, 256};
+  bool is_full = (partial >= 0 && num == capacity[type]);
+  auto node = create(is_full ? static_cast<CacheNodeType>(type + 1) : type, new_hdr);
+  for_each([=](uint8_t p, CacheNodeValue* v) { if (!v->is_dead()) node->append(p, v); });
+  if (partial >= 0) {
+    value->partial = partial;
+    node->append(partial, value);
+  }
+  return node;
+}
+
+
+bool CacheNode::is_empty() const {
+  bool empty = true;
+  for_each([&](uint8_t, CacheNodeValue* v) { if (!v->is_dead()) empty = false; });
+  return empty;
+}
+
+
+void CacheNode::append(uint8_t partial, CacheNodeValue* value) {
+  switch (type) {
+    case CACHE_NODE_4:
+      ((CacheNode4 *)this)->keys[num] = partial;
+      ((CacheNode4 *)this)->children[num] = value;
+      break;
+    case CACHE_NODE_16:
+      ((CacheNode16 *)this)->keys[num] = partial;
+      ((CacheNode16 *)this)->children[num] = value;
+      break;
+    case CACHE_NODE_48:
+      ((CacheNode48 *)this)->children[num] = value;
+      ((CacheNode48 *)this)->child_index[partial] = num + 1;
+      break;
+    default:
+      ((CacheNode256 *)this)->children[partial] = value;
+  }
+  num ++;
+}
+
+
+uint64_t CacheNode::content_size() const {
+  static const uint64_t node_size[] = {sizeof(CacheNode4), sizeof(CacheNode16), sizeof(CacheNode48), sizeof(CacheNode256)};
+  return node_size[type] + sizeof(CacheNodeValue) * num;
+}
 
 
 RadixCache::RadixCache(int cache_size, DSM *dsm) : cache_size(cache_size), dsm(dsm) {
   free_manager = new FreeMemManager(define::MB * cache_size);
-  cache_root = new CacheNode();
-  node_queue = new tbb::concurrent_queue<CacheNode*>();
-  node_queue->push(cache_root);
+  cache_root = CacheNode::create(CACHE_NODE_4, CacheHeader());
 }
 
 
@@ -19,10 +119,17 @@ void RadixCache::add_to_cache(const Key& k, const InternalPage* p_node, const Gl
   auto depth = p_node->hdr.depth - 1;
   if (depth == 0) return;
 
-  std::vector<uint8_t> byte_array(k.begin(), k.begin() + depth);
-  for (int i = 0; i < (int)p_node->hdr.partial_len; ++ i) byte_array.push_back(p_node->hdr.partial[i]);
+  uint8_t bytes[define::keyLen];
+  int len = depth + p_node->hdr.partial_len;
+  assert(len < (int)define::keyLen);
+  memcpy(bytes, k.data(), depth);
+  memcpy(bytes + depth, p_node->hdr.partial, p_node->hdr.partial_len);
+
+  _add(CacheKeyView(bytes, len), new CacheEntry(p_node, node_addr));
+}
+
 
-  auto new_entry = new CacheEntry(p_node, node_addr);
+void RadixCache::_add(const CacheKeyView& byte_array, CacheEntry* new_entry) {
   _insert(byte_array, new_entry);
 #ifndef CACHE_ENABLE_ART
   free_manager->consume(sizeof(Key));  // emulate hash-based cache
@@ -34,79 +141,78 @@ void RadixCache::add_to_cache(const Key& k, const InternalPage* p_node, const Gl
 }
 
 
-void RadixCache::_insert(const std::vector<uint8_t>& byte_array, CacheEntry* new_entry) {
-  CacheNode* parent_node = nullptr;
-  CacheNode* node = cache_root;
-  int idx = 0;
+void RadixCache::_insert(const CacheKeyView& byte_array, CacheEntry* new_entry) {
+  CacheNode* volatile* node_ref;  // where node is linked
+  CacheNode* node;
+  int idx;
+
+restart:
+  node_ref = &cache_root;
+  node = cache_root;
+  idx = 0;
 
 next:
   // 1. parse header
-  auto hdr = (CacheHeader *)node->header;
-  for (int i = 0; i < (int)hdr->partial.size(); ++ i) {
-    auto cur_partial = byte_array[hdr->depth + i];
-    if (hdr->depth + i == (int)byte_array.size() - 1 || cur_partial != hdr->partial[i]) {
-      // split
-      auto partial_len = hdr->depth + i - idx;
+  auto& hdr = node->hdr;
+  for (int i = 0; i < (int)hdr.partial_len; ++ i) {
+    auto cur_partial = byte_array[hdr.depth + i];
+    if (hdr.depth + i == (int)byte_array.size() - 1 || cur_partial != hdr.partial[i]) {
+      // split: link a new node in front of a copy of node with the split header
+      auto partial_len = hdr.depth + i - idx;
+      auto split_partial = hdr.partial[i];
+      auto split_node = node->copy(CacheHeader::split_header(hdr, i));
       CacheNode* nested_node = nullptr;
-      auto new_node = new CacheNode(byte_array, idx, partial_len, hdr->partial[i], node, cur_partial, new_entry, nested_node);
-      auto& parent_node_entry = parent_node->records[byte_array[idx - 1]];
-      auto ret_node = __sync_val_compare_and_swap(&(parent_node_entry.next), node, new_node);
-      if (ret_node == node) {  // cas success
-        auto new_hdr = CacheHeader::split_header(hdr, i);
-        // update header
-        auto ret_hdr = (CacheHeader *)__sync_val_compare_and_swap(&(node->header), hdr, new_hdr);
-        if (ret_hdr == hdr) _safely_delete(ret_hdr);  // cas success
-        else delete new_hdr;
-        free_manager->consume_by_node(new_node);
-        if (nested_node) free_manager->consume_by_node(nested_node);
-        free_manager->consume_by_node(node);
-        free_manager->consume(new_entry->content_size());
-      }
-      else {  // cas fail
-        if (ret_node) {
-          node = (CacheNode *)ret_node;
-          delete new_node;
-          if (nested_node) delete nested_node;
-          goto next;
-        }
-        else  {  // node is deleted
-          node = (CacheNode *)__sync_val_compare_and_swap(&(parent_node_entry.next), 0UL, new_node);
-          if (node) {
-            delete new_node;
-            if (nested_node) delete nested_node;
-            goto next;
-          }
-          free_manager->consume_by_node(new_node);
-          if (nested_node) free_manager->consume_by_node(nested_node);
-          free_manager->consume(new_entry->content_size());
-        }
+      CacheNodeValue* entry_value = nullptr;
+      auto new_node = CacheNode::create(byte_array, idx, partial_len, split_partial, split_node, cur_partial, new_entry, nested_node, entry_value);
+      if (!__sync_bool_compare_and_swap(node_ref, node, new_node)) {  // cas fail
+        CacheNode::destroy(split_node);
+        CacheNode::destroy(new_node, true);
+        if (nested_node) CacheNode::destroy(nested_node, true);
+        goto restart;
       }
+      free_manager->consume_by_node(new_node);
+      if (nested_node) free_manager->consume_by_node(nested_node);
+      free_manager->consume_by_node(split_node);
+      free_manager->free_by_node(node);
+      free_manager->consume(new_entry->content_size());
+      _retire(node, split_node);
       // record
-      node_queue->push(new_node);
-      if (nested_node) node_queue->push(nested_node);
-      CacheMap::const_iterator tmp = (nested_node ? nested_node->records.find(byte_array.back()) : new_node->records.find(cur_partial));
-      eviction_list.push(std::make_pair(&(tmp->second.cache_entry), new_entry));
+      _link(new_node, node_ref, true);
+      _link(split_node, &(new_node->find(split_partial)->next), false);
+      if (nested_node) _link(nested_node, &(new_node->find(cur_partial)->next), true);
       return;
     }
   }
-  idx = hdr->depth + hdr->partial.size();
+  idx = hdr.depth + hdr.partial_len;
 
   // 2. parse_node
-  auto& cache_map = node->records;
   auto partial = byte_array[idx];
+  auto node_value = node->find(partial);
 
   // 2.1 last level
   if (idx == (int)byte_array.size() - 1) {
-    auto& node_entry = cache_map[partial];
-    auto old_entry = (CacheEntry *)node_entry.cache_entry;
-    if (__sync_bool_compare_and_swap(&(node_entry.cache_entry), old_entry, new_entry)) {
-      free_manager->consume_by_node(node);
+    if (node_value == nullptr) {
+      auto new_value = new CacheNodeValue(new_entry, nullptr);
+      if (!_replace_node(node_ref, node, node->copy(hdr, partial, new_value))) {
+        delete new_value;
+        goto restart;
+      }
+      free_manager->consume(new_entry->content_size());
+      new_value->owner = node_ref;
+      clock.push(new_value);
+      return;
+    }
+    auto old_entry = (CacheEntry *)node_value->cache_entry;
+    if (old_entry == CACHE_DEAD_ENTRY) {  // help to unlink the dead value
+      _replace_node(node_ref, node, node->copy(hdr));
+      goto restart;
+    }
+    if (__sync_bool_compare_and_swap(&(node_value->cache_entry), old_entry, new_entry)) {
       free_manager->consume(new_entry->content_size());
       if (old_entry) {
         free_manager->free(old_entry->content_size());
         _safely_delete(old_entry);
       }
-      eviction_list.push(std::make_pair(&(node_entry.cache_entry), new_entry));
     }
     else {
       delete new_entry;
@@ -115,53 +221,104 @@ next:
   }
   // 2.2 internal level
   else {
-    auto& node_entry = cache_map[partial];
-    if (node_entry.next == nullptr) {
-      auto next_node = new CacheNode(byte_array, idx + 1, new_entry);
-      auto ret_node = __sync_val_compare_and_swap(&(node_entry.next), 0UL, next_node);
-      if (ret_node == 0UL) {  // cas success
-        // record
-        node_queue->push(next_node);
-        CacheMap::const_iterator tmp = next_node->records.find(byte_array.back());
-        eviction_list.push(std::make_pair(&(tmp->second.cache_entry), new_entry));
-        free_manager->consume_by_node(node);
+    if (node_value == nullptr) {
+      CacheNodeValue* entry_value = nullptr;
+      auto next_node = CacheNode::create(byte_array, idx + 1, new_entry, entry_value);
+      auto new_value = new CacheNodeValue(nullptr, next_node);
+      if (!_replace_node(node_ref, node, node->copy(hdr, partial, new_value))) {
+        delete new_value;
+        CacheNode::destroy(next_node, true);
+        goto restart;
+      }
+      free_manager->consume_by_node(next_node);
+      free_manager->consume(new_entry->content_size());
+      // record
+      new_value->owner = node_ref;
+      clock.push(new_value);
+      _link(next_node, &(new_value->next), true);
+      return;
+    }
+    if (node_value->is_dead()) {  // help to unlink the dead value
+      _replace_node(node_ref, node, node->copy(hdr));
+      goto restart;
+    }
+    CacheNode* next_node = node_value->next;
+    if (next_node == nullptr) {
+      CacheNodeValue* entry_value = nullptr;
+      next_node = CacheNode::create(byte_array, idx + 1, new_entry, entry_value);
+      auto ret_node = __sync_val_compare_and_swap(&(node_value->next), (CacheNode *)nullptr, next_node);
+      if (ret_node == nullptr) {  // cas success
         free_manager->consume_by_node(next_node);
         free_manager->consume(new_entry->content_size());
+        // record
+        _link(next_node, &(node_value->next), true);
         return;
       }
       else {  // cas fail
-        delete next_node;
-        parent_node = node;
-        node = (CacheNode *)ret_node;
-        idx ++;
-        goto next;
+        CacheNode::destroy(next_node, true);
+        next_node = ret_node;
       }
     }
-    else {
-      parent_node = node;
-      node = (CacheNode *)(node_entry.next);
-      idx ++;
-      goto next;
+    if (next_node == CACHE_DEAD_NODE) {  // the value is being unlinked
+      goto restart;
     }
+    node_ref = &(node_value->next);
+    node = next_node;
+    idx ++;
+    goto next;
   }
 }
 
 
+// link new_node in place of node, which is retired then
+bool RadixCache::_replace_node(CacheNode* volatile* node_ref, CacheNode* node, CacheNode* new_node) {
+  if (!__sync_bool_compare_and_swap(node_ref, node, new_node)) {
+    CacheNode::destroy(new_node);
+    return false;
+  }
+  free_manager->consume_by_node(new_node);
+  free_manager->free_by_node(node);
+  _retire(node, new_node);
+  return true;
+}
+
+
+// point the values of a newly linked node to where it is linked, and track the new ones on the clock
+void RadixCache::_link(CacheNode* node, CacheNode* volatile* node_ref, bool fresh) {
+  node->for_each([&](uint8_t, CacheNodeValue* value) {
+    value->owner = node_ref;
+    if (fresh) clock.push(value);
+  });
+}
+
+
+// retire a node replaced by new_node (nullptr if unlinked), along with the dead values left out of the copy
+void RadixCache::_retire(CacheNode* node, CacheNode* new_node) {
+  node->for_each([&](uint8_t partial, CacheNodeValue* value) {
+    if (value->is_dead() && (new_node == nullptr || new_node->find(partial) != value)) {
+      _safely_delete(value);
+    }
+  });
+  _safely_delete(node);
+}
+
+
 bool RadixCache::search_from_cache(const Key& k, volatile CacheEntry**& entry_ptr_ptr, CacheEntry*& entry_ptr, int& entry_idx) {
-  CacheKey byte_array(k.begin(), k.begin() + define::keyLen - 1);
+  CacheKeyView byte_array(k.data(), define::keyLen - 1);
 
   SearchRetStk ret;
   if(_search(byte_array, ret)) {
     while(!ret.empty()) {
       const auto& item = ret.top();
       auto cache_entry = item.entry_ptr;
-      auto next_partial = k.at(item.next_idx);
+      auto next_partial = k[item.next_idx];
       if (cache_entry) {
         for (int i = 0; i < (int)cache_entry->records.size(); ++ i) {
           const auto& e = cache_entry->records[i];
           if (e != InternalEntry::Null() && e.partial == next_partial) {
             entry_ptr = cache_entry;
-            // __sync_fetch_and_add(&(entry_ptr->counter), 1UL);
+            auto weight = clock_weight(cache_entry->depth);
+            if (cache_entry->ref != weight) cache_entry->ref = weight;
             entry_ptr_ptr = item.entry_ptr_ptr;
             entry_idx = i;
             return true;
@@ -174,7 +331,7 @@ bool RadixCache::search_from_cache(const Key& k, volatile CacheEntry**& entry_pt
   return false;
 }
 
-bool RadixCache::_search(const CacheKey& byte_array, SearchRetStk& ret) {
+bool RadixCache::_search(const CacheKeyView& byte_array, SearchRetStk& ret) {
   CacheNode* node = cache_root;
   int idx = 0;
 
@@ -184,24 +341,21 @@ next:
   }
 
   // 1. parse header
-  auto hdr = (CacheHeader *)node->header;
-  for (int i = 0; i < (int)hdr->partial.size(); ++ i) {
-    if (hdr->depth + i == (int)byte_array.size() - 1 || byte_array[hdr->depth + i] != hdr->partial[i]) {
+  auto& hdr = node->hdr;
+  for (int i = 0; i < (int)hdr.partial_len; ++ i) {
+    if (hdr.depth + i == (int)byte_array.size() - 1 || byte_array[hdr.depth + i] != hdr.partial[i]) {
       return !ret.empty();
     }
   }
-  idx = hdr->depth + hdr->partial.size();
+  idx = hdr.depth + hdr.partial_len;
 
   // 2. parse_node
-  auto& cache_map = node->records;
   auto partial = byte_array[idx];
 
-  CacheMap::const_iterator r_entry = cache_map.find(partial);
-  if (r_entry != cache_map.end()) {
-    auto cache_entry = (CacheEntry *)r_entry->second.cache_entry;
-    // ret.push(std::make_pair(std::make_pair(&(r_entry->second.cache_entry), cache_entry), idx + 1));
-    ret.push(SearchRet(&(r_entry->second.cache_entry), cache_entry, idx + 1));
-    node = (CacheNode *)(r_entry->second.next);
+  auto node_value = node->find(partial);
+  if (node_value) {
+    ret.push(SearchRet(&(node_value->cache_entry), node_value->entry(), idx + 1));
+    node = node_value->child();
     if (node) {
       idx ++;
       goto next;
@@ -211,28 +365,82 @@ next:
 }
 
 
+/*
+  The cached records covering [from, to), found in one pass: each byte at the root level must lead to a cached node
+  covering the part of the range under it, and inside a cached node, the record of each byte in the range is refined
+  by the cached node below it if that one covers its part of the range without gaps, so that the keys missing from
+  the cache are still reached from the record above. No result means the range can not be covered from the cache.
+*/
 void RadixCache::search_range_from_cache(const Key &from, const Key &to, std::vector<RangeCache> &result) {
-  GlobalAddress p_ptr;
-  InternalEntry p;
-  int depth;
-  volatile CacheEntry** entry_ptr_ptr = nullptr;
-  CacheEntry* entry_ptr = nullptr;
-  int entry_idx = -1;
-
-  for (auto k = from; k < to; k = k + 1) {
-    auto e = search_from_cache(k, entry_ptr_ptr, entry_ptr, entry_idx);
-    if (e) {
-      assert(entry_idx >= 0);
-      p_ptr = GADD(entry_ptr->addr, sizeof(InternalEntry) * entry_idx);
-      p = entry_ptr->records[entry_idx];
-      depth = entry_ptr->depth;
-
-      auto leftmost = p.is_leaf ? k : get_leftmost(k, depth);
-      auto rightmost = p.is_leaf ? k : get_rightmost(k, depth);
-      result.push_back(RangeCache(leftmost, rightmost, p_ptr, p, depth, entry_ptr_ptr, entry_ptr));
+  auto last = to - 1;
+  for (int b = from[0]; b <= last[0]; ++ b) {
+    auto prefix = from;
+    prefix[0] = b;
+    const auto& sub_from = (b == from[0] ? from : get_leftmost(prefix, 1));
+    const auto& sub_to   = (b == last[0] ? last : get_rightmost(prefix, 1));
+    auto value = _search_cover(sub_from, sub_to, 1);
+    if (value == nullptr || !_cover(value, sub_from, sub_to, result)) {
+      result.clear();
+      return;
     }
   }
-  return;
+}
+
+// the shallowest cached node holding all keys in [from, to], whose cache key is no shorter than min_len
+CacheNodeValue* RadixCache::_search_cover(const Key& from, const Key& to, int min_len) {
+  int lcp = 0;
+  while (lcp < (int)define::keyLen && from[lcp] == to[lcp]) lcp ++;
+
+  CacheNode* node = cache_root;
+  while (node) {
+    auto& hdr = node->hdr;
+    for (int i = 0; i < (int)hdr.partial_len; ++ i) {
+      if (hdr.depth + i >= lcp || from[hdr.depth + i] != hdr.partial[i]) return nullptr;
+    }
+    int idx = hdr.depth + hdr.partial_len;
+    if (idx >= lcp) return nullptr;
+    auto value = node->find(from[idx]);
+    if (value == nullptr) return nullptr;
+    if (idx + 1 >= min_len && value->entry()) return value;
+    node = value->child();
+  }
+  return nullptr;
+}
+
+// append the records of the cached node covering [from, to], false if a record in the range is missing
+bool RadixCache::_cover(CacheNodeValue* value, const Key& from, const Key& to, std::vector<RangeCache> &result) {
+  auto cache_entry = value->entry();
+  if (cache_entry == nullptr) return false;
+  int depth = cache_entry->depth;  // records are indexed by the partial at depth - 1
+
+  int16_t idx_of[256];
+  std::fill(idx_of, idx_of + 256, -1);
+  for (int i = 0; i < (int)cache_entry->records.size(); ++ i) {
+    const auto& e = cache_entry->records[i];
+    if (e != InternalEntry::Null()) idx_of[e.partial] = i;
+  }
+  for (int b = from[depth - 1]; b <= to[depth - 1]; ++ b) {
+    if (idx_of[b] < 0) return false;
+  }
+  auto weight = clock_weight(depth);
+  if (cache_entry->ref != weight) cache_entry->ref = weight;
+
+  for (int b = from[depth - 1]; b <= to[depth - 1]; ++ b) {
+    const auto& e = cache_entry->records[idx_of[b]];
+    auto prefix = from;
+    prefix[depth - 1] = b;
+    auto leftmost = get_leftmost(prefix, depth);
+    auto rightmost = get_rightmost(prefix, depth);
+    if (!e.is_leaf) {
+      const auto& sub_from = (b == from[depth - 1] ? from : leftmost);
+      const auto& sub_to   = (b == to[depth - 1] ? to : rightmost);
+      auto next = _search_cover(sub_from, sub_to, depth);
+      if (next && _cover(next, sub_from, sub_to, result)) continue;
+    }
+    result.push_back(RangeCache(leftmost, rightmost, GADD(cache_entry->addr, sizeof(InternalEntry) * idx_of[b]), e, depth,
+                                &(value->cache_entry), cache_entry));
+  }
+  return true;
 }
 
 void RadixCache::invalidate(volatile CacheEntry** entry_ptr_ptr, CacheEntry* entry_ptr) {
@@ -243,154 +451,212 @@ void RadixCache::invalidate(volatile CacheEntry** entry_ptr_ptr, CacheEntry* ent
 }
 
 void RadixCache::_evict() {
-  bool flag;
-  do {
-    // _evict_one();
-    std::pair<volatile CacheEntry**, CacheEntry*> next;
-    if(eviction_list.try_pop(next) && *next.first == next.second) {
-      invalidate(next.first, next.second);
-    }
-    flag = eviction_list.empty();
-  } while (free_manager->remain_size() < 0 && !flag);
-  if (flag) {
-    // rebuild cache  TODO: memory leak
-    if (__sync_bool_compare_and_swap(&cache_root, cache_root, new CacheNode())) {
-      free_manager = new FreeMemManager(define::MB * cache_size);
-      node_queue = new tbb::concurrent_queue<CacheNode*>();
-      node_queue->push(cache_root);
+  CacheNodeValue* value = nullptr;
+  while (free_manager->remain_size() < 0 && clock.try_pop(value)) {
+    if (_evict_one(value)) clock.push(value);
+  }
+}
+
+/*
+  One CLOCK step on a value, which returns false if the value is unlinked (and no longer tracked).
+  An entry gets clock_weight() sweeps after its last hit, and the value holding no entry and
+  no child node is unlinked, by first marking it dead so that no entry or child can be linked
+  to it then, and next copying its node without it.
+*/
+bool RadixCache::_evict_one(CacheNodeValue* value) {
+  auto cache_entry = value->entry();
+  if (cache_entry) {
+    if (cache_entry->ref > 0) {
+      cache_entry->ref = cache_entry->ref - 1;
+      return true;
     }
+    invalidate(&(value->cache_entry), cache_entry);
+  }
+  // reclaim the child node whose values are all unlinked
+  auto next = value->child();
+  if (next && next->is_empty() && __sync_bool_compare_and_swap(&(value->next), next, (CacheNode *)nullptr)) {
+    free_manager->free_by_node(next);
+    _retire(next, nullptr);
+  }
+  if (value->cache_entry != nullptr || value->next != nullptr) {
+    return true;
   }
+  if (!__sync_bool_compare_and_swap(&(value->next), (CacheNode *)nullptr, CACHE_DEAD_NODE)) {
+    return true;
+  }
+  if (!__sync_bool_compare_and_swap(&(value->cache_entry), (CacheEntry *)nullptr, CACHE_DEAD_ENTRY)) {
+    value->next = nullptr;
+    return true;
+  }
+  // the owner may be stale if the node has just been split, then the value is dropped by the next copy of its node
+  while (true) {
+    CacheNode* node = *(value->owner);
+    if (node == nullptr || node == CACHE_DEAD_NODE || node->find(value->partial) != value) break;
+    if (_replace_node(value->owner, node, node->copy(node->hdr))) break;
+  }
+  return false;
 }
 
-// void RadixCache::_evict_one() {
-//   SearchRetStk stk1, stk2;
-//   Key k1, k2;
-//   do {
-//     k1 = dsm->getRandomKey();
-//   } while(!_search(CacheKey(k1.begin(), k1.begin() + define::keyLen - 1), stk1));
-//   do {
-//     k2 = dsm->getRandomKey();
-//   } while(!_search(CacheKey(k2.begin(), k2.begin() + define::keyLen - 1), stk2));
-
-//   // while(!_random_search(stk1));
-//   // while(!_random_search(stk2));
-//   // evict
-//   uint64_t min_cnt = UINT_MAX;
-//   CacheEntry * min_entry = nullptr;
-//   volatile CacheEntry** min_entry_ptr = nullptr;
-
-//   auto select_smallest = [&](SearchRetStk& stk){
-//     while(!stk.empty()) {
-//       const auto& item = stk.top();
-//       auto cache_entry = item.entry_ptr;
-//       if (!cache_entry) {
-//         stk.pop();
-//         continue;
-//       }
-//       if (item.counter <= min_cnt) {
-//         min_cnt = item.counter;
-//         min_entry = cache_entry;
-//         min_entry_ptr = item.entry_ptr_ptr;
-//       }
-//       stk.pop();
-//     }
-//   };
-//   select_smallest(stk1);
-//   select_smallest(stk2);
-//   invalidate(min_entry_ptr, min_entry);
-// }
-
-// bool RadixCache::_random_search(SearchRetStk& ret) {
-//   static std::default_random_engine e;
-//   static std::uniform_int_distribution<uint8_t> u(0, 255);
-
-//   CacheNode* node = cache_root;
-//   int idx = 0;
-
-// next:
-//   if (idx >= (int)define::keyLen - 1) {  // exit
-//     return !ret.empty();
-//   }
-
-//   // 1. ignore header
-//   auto hdr = (CacheHeader *)node->header;
-//   idx = hdr->depth + hdr->partial.size();
-
-//   // 2. parse_node
-//   auto& cache_map = node->records;
-
-//   CacheMap::const_iterator r_entry;
-//   int s = cache_map.size();
-//   if (s == 0) {
-//     return !ret.empty();
-//   }
-//   else if (s < 16) {
-//     int i = u(e) % s;
-//     r_entry = cache_map.begin();
-//     while(i --) ++ r_entry;
-//   }
-//   else {
-// retry:
-//     r_entry = cache_map.find(u(e));
-//     if (r_entry == cache_map.end()) goto retry;
-//   }
-
-//   if (r_entry != cache_map.end()) {
-//     auto cache_entry = (CacheEntry *)r_entry->second.cache_entry;
-//     if (cache_entry) {
-//       ret.push(SearchRet(&(r_entry->second.cache_entry), cache_entry, idx + 1, cache_entry->counter));
-//     }
-//     node = (CacheNode *)(r_entry->second.next);
-//     if (node) {
-//       idx ++;
-//       goto next;
-//     }
-//   }
-//   return !ret.empty();
-// }
+std::atomic<uint64_t>* RadixCache::enter_epoch(int thread_id, int coro_id) {
+  auto& slot = epoch_slots[thread_id][coro_id].epoch;
+  if (slot.load(std::memory_order_relaxed) != kIdleEpoch) {
+    return nullptr;
+  }
+  slot.store(global_epoch.load());  // seq_cst, ordered before the reads of the cache
+  return &slot;
+}
 
 void RadixCache::_safely_delete(CacheEntry* cache_entry) {
-  cache_entry_gc.push(cache_entry);
-  while (cache_entry_gc.unsafe_size() > safely_free_epoch) {
-    CacheEntry* next = nullptr;
-    if (cache_entry_gc.try_pop(next) && next) {
-      delete next;
+  _retire(RetiredObj(global_epoch.load(), cache_entry, RetiredObj::ENTRY));
+}
+
+void RadixCache::_safely_delete(CacheNode* cache_node) {
+  _retire(RetiredObj(global_epoch.load(), cache_node, RetiredObj::NODE));
+}
+
+void RadixCache::_safely_delete(CacheNodeValue* cache_value) {
+  _retire(RetiredObj(global_epoch.load(), cache_value, RetiredObj::VALUE));
+}
+
+void RadixCache::_retire(const RetiredObj& obj) {
+  retired.push(obj);
+  if (retired_cnt.fetch_add(1) % reclaim_batch == reclaim_batch - 1) {
+    _reclaim();
+  }
+}
+
+// the oldest announced epoch, operations entering afterwards announce a later one
+uint64_t RadixCache::min_active_epoch() {
+  uint64_t min_epoch = global_epoch.fetch_add(1) + 1;
+  for (int i = 0; i < MAX_APP_THREAD; ++ i) {
+    for (int j = 0; j < MAX_CORO_NUM; ++ j) {
+      min_epoch = std::min(min_epoch, epoch_slots[i][j].epoch.load());
     }
   }
+  return min_epoch;
 }
 
-void RadixCache::_safely_delete(CacheHeader* cache_hdr) {
-  cache_hdr_gc.push(cache_hdr);
-  while (cache_hdr_gc.unsafe_size() > safely_free_epoch) {
-    CacheHeader* next = nullptr;
-    if (cache_hdr_gc.try_pop(next) && next) {
-      delete next;
+// free the retired objects older than all announced epochs
+void RadixCache::_reclaim() {
+  uint64_t min_epoch = min_active_epoch();
+  RetiredObj obj;
+  for (auto cnt = retired.unsafe_size(); cnt > 0 && retired.try_pop(obj); -- cnt) {
+    if (obj.epoch >= min_epoch) {  // still in use
+      retired.push(obj);
+      continue;
+    }
+    switch (obj.type) {
+      case RetiredObj::ENTRY: delete (CacheEntry *)obj.ptr;              break;
+      case RetiredObj::NODE:  CacheNode::destroy((CacheNode *)obj.ptr);  break;
+      default:                delete (CacheNodeValue *)obj.ptr;          break;
     }
   }
 }
 
 void RadixCache::statistics() {
-  std::cout << " ----- [IndexCache]: " << " cache size=" << cache_size << " MB"
-                                       << " free_size=" << free_manager->remain_size() / define::MB << " MB" 
-                                       << " node_cnt=" << node_queue->unsafe_size() << " ----- " << std::endl;
   std::map<int, int64_t> cnt;
   uint64_t kp_cnt = 0;
-  for (auto node_iter = node_queue->unsafe_begin(); node_iter != node_queue->unsafe_end(); ++ node_iter) {
-    auto& node = *node_iter;
-    auto& cache_map = node->records;
-    // auto header = (CacheHeader *)node->header;
-    for (auto entry_iter = cache_map.begin(); entry_iter != cache_map.end(); ++ entry_iter) {
-      auto cache_entry = (CacheEntry *)entry_iter->second.cache_entry;
+  uint64_t node_cnt[CACHE_NODE_256 + 1] = {0};
+  std::vector<CacheNode*> nodes{cache_root};
+  while (!nodes.empty()) {
+    auto node = nodes.back();
+    nodes.pop_back();
+    node_cnt[node->type] ++;
+    node->for_each([&](uint8_t, CacheNodeValue* value) {
+      auto cache_entry = value->entry();
       if (cache_entry) {
         int depth = cache_entry->depth;
         if (cnt.find(depth) == cnt.end()) cnt[depth] = 0;
         cnt[depth] ++;
         kp_cnt += cache_entry->records.size();
       }
-    }
+      auto next = value->child();
+      if (next) nodes.push_back(next);
+    });
   }
+  std::cout << " ----- [IndexCache]: " << " cache size=" << cache_size << " MB"
+                                       << " free_size=" << free_manager->remain_size() / define::MB << " MB"
+                                       << " node_cnt=" << node_cnt[CACHE_NODE_4] + node_cnt[CACHE_NODE_16] + node_cnt[CACHE_NODE_48] + node_cnt[CACHE_NODE_256]
+                                       << " (node4=" << node_cnt[CACHE_NODE_4] << " node16=" << node_cnt[CACHE_NODE_16]
+                                       << " node48=" << node_cnt[CACHE_NODE_48] << " node256=" << node_cnt[CACHE_NODE_256] << ")"
+                                       << " ----- " << std::endl;
   for (const auto& e : cnt) {
     std::cout << "depth=" << e.first << " cnt=" << e.second << std::endl;
   }
   printf("consumed cache size = %.3lf MB\n", (double)cache_size - (double)free_manager->remain_size() / define::MB);
 }
+
+/*
+  snapshot: [kCacheMagic, keyLen], then one record per cached entry, parents first:
+  [depth, cache key (depth - 1 bytes), addr, record num, records]
+  The remote nodes may have changed since the dump, so the entries are loaded as cold ones
+  and invalidated on the first mismatch a lookup through them finds, as any stale entry.
+*/
+static const uint32_t kCacheMagic = 0x534d5243;  // "SMRC"
+
+bool RadixCache::dump(const std::string& path) {
+  std::ofstream out(path, std::ios::binary);
+  if (!out) return false;
+  uint32_t magic[2] = {kCacheMagic, define::keyLen};
+  out.write((const char *)magic, sizeof(magic));
+
+  uint64_t entry_cnt = 0;
+  std::vector<std::pair<CacheNode*, Key> > nodes{std::make_pair(cache_root, Key{})};  // with the bytes before hdr.depth
+  while (!nodes.empty()) {
+    auto node = nodes.back().first;
+    auto bytes = nodes.back().second;
+    nodes.pop_back();
+    auto& hdr = node->hdr;
+    memcpy(bytes.data() + hdr.depth, hdr.partial, hdr.partial_len);
+    auto idx = hdr.depth + hdr.partial_len;
+    node->for_each([&](uint8_t partial, CacheNodeValue* value) {
+      bytes[idx] = partial;
+      auto cache_entry = value->entry();
+      if (cache_entry) {
+        uint16_t num = cache_entry->records.size();
+        out.write((const char *)&(cache_entry->depth), sizeof(uint8_t));
+        out.write((const char *)bytes.data(), cache_entry->depth - 1);
+        out.write((const char *)&(cache_entry->addr), sizeof(GlobalAddress));
+        out.write((const char *)&num, sizeof(uint16_t));
+        out.write((const char *)cache_entry->records.data(), sizeof(InternalEntry) * num);
+        entry_cnt ++;
+      }
+      auto next = value->child();
+      if (next) nodes.push_back(std::make_pair(next, bytes));
+    });
+  }
+  printf("[IndexCache] dump %lu entries to %s\n", entry_cnt, path.c_str());
+  return (bool)out;
+}
+
+
+bool RadixCache::load(const std::string& path) {
+  std::ifstream in(path, std::ios::binary);
+  uint32_t magic[2];
+  if (!in.read((char *)magic, sizeof(magic)) || magic[0] != kCacheMagic || magic[1] != define::keyLen) return false;
+
+  uint64_t entry_cnt = 0;
+  uint8_t depth;
+  uint8_t bytes[define::keyLen];
+  uint16_t num;
+  while (in.read((char *)&depth, sizeof(uint8_t))) {
+    if (depth < 2 || depth > define::keyLen) return false;
+    GlobalAddress addr;
+    if (!in.read((char *)bytes, depth - 1) || !in.read((char *)&addr, sizeof(GlobalAddress)) ||
+        !in.read((char *)&num, sizeof(uint16_t)) || num > 256) {  // truncated or corrupt
+      return false;
+    }
+    auto new_entry = new CacheEntry();
+    new_entry->depth = depth;
+    new_entry->addr = addr;
+    new_entry->records.resize(num);
+    if (!in.read((char *)new_entry->records.data(), sizeof(InternalEntry) * num)) {
+      delete new_entry;
+      return false;
+    }
+    _add(CacheKeyView(bytes, depth - 1), new_entry);
+    entry_cnt ++;
+  }
+  printf("[IndexCache] load %lu entries from %s\n", entry_cnt, path.c_str());
+  return true;
+}
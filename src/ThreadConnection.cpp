@@ -1,7 +1,31 @@
 #include "ThreadConnection.h"
 
 #include "Connection.h"
+#ifdef DSM_LOOPBACK
+#include "Loopback.h"
+#endif
 
+#ifdef DSM_LOOPBACK
+ThreadConnection::ThreadConnection(uint16_t threadID, void *cachePool,
+                                   uint64_t cacheSize, uint32_t machineNR,
+                                   RemoteConnection *remoteInfo)
+    : threadID(threadID), remoteInfo(remoteInfo) {
+  cq = createLoopbackCQ();
+  rpc_cq = nullptr;  // chunk allocation is served in-process
+  message = nullptr;
+
+  this->cachePool = cachePool;
+  cacheMR = nullptr;
+  cacheLKey = 0;
+
+  for (int i = 0; i < NR_DIRECTORY; ++i) {
+    data[i] = new ibv_qp *[machineNR];
+    for (size_t k = 0; k < machineNR; ++k) {
+      data[i][k] = createLoopbackQP(cq);
+    }
+  }
+}
+#else
 ThreadConnection::ThreadConnection(uint16_t threadID, void *cachePool,
                                    uint64_t cacheSize, uint32_t machineNR,
                                    RemoteConnection *remoteInfo)
@@ -26,10 +50,12 @@ ThreadConnection::ThreadConnection(uint16_t threadID, void *cachePool,
     }
   }
 }
+#endif
 
 void ThreadConnection::sendMessage2Dir(RawMessage *m, uint16_t node_id,
                                        uint16_t dir_id) {
-  
+#ifndef DSM_LOOPBACK
   message->sendRawMessage(m, remoteInfo[node_id].dirMessageQPN[dir_id],
                           remoteInfo[node_id].appToDirAh[threadID][dir_id]);
+#endif
 }
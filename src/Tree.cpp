@@ -1,4 +1,5 @@
 #include "Tree.h"
+#include "Metrics.h"
 #include "RdmaBuffer.h"
 #include "Timer.h"
 #include "Node.h"
@@ -13,27 +14,20 @@
 #include <mutex>
 
 
-double cache_miss[MAX_APP_THREAD];
-double cache_hit[MAX_APP_THREAD];
-uint64_t lock_fail[MAX_APP_THREAD];
-// uint64_t try_lock[MAX_APP_THREAD];
-uint64_t write_handover_num[MAX_APP_THREAD];
-uint64_t try_write_op[MAX_APP_THREAD];
-uint64_t read_handover_num[MAX_APP_THREAD];
-uint64_t try_read_op[MAX_APP_THREAD];
-uint64_t read_leaf_retry[MAX_APP_THREAD];
-uint64_t leaf_cache_invalid[MAX_APP_THREAD];
-uint64_t try_read_leaf[MAX_APP_THREAD];
-uint64_t read_node_repair[MAX_APP_THREAD];
-uint64_t try_read_node[MAX_APP_THREAD];
-uint64_t read_node_type[MAX_APP_THREAD][MAX_NODE_TYPE_NUM];
-uint64_t latency[MAX_APP_THREAD][MAX_CORO_NUM][LATENCY_WINDOWS];
+Histogram latency[MAX_APP_THREAD][REQ_TYPE_NUM];
 volatile bool need_stop = false;
-uint64_t retry_cnt[MAX_APP_THREAD][MAX_FLAG_NUM];
 
 thread_local CoroCall Tree::worker[MAX_CORO_NUM];
 thread_local CoroCall Tree::master;
-thread_local CoroQueue Tree::busy_waiting_queue;
+thread_local std::atomic<uint64_t> Tree::coro_ready{0};
+thread_local CoroWaker Tree::coro_waker[MAX_CORO_NUM];
+thread_local uint64_t Tree::coro_idle = 0;
+thread_local AsyncRequest *Tree::coro_async_req[MAX_CORO_NUM];
+#ifdef TREE_ENABLE_VAR_LEN_VALUE
+thread_local GlobalAddress Tree::value_log_seg;
+thread_local GlobalAddress Tree::value_log_cur;
+thread_local uint64_t Tree::value_log_remain = 0;
+#endif
 
 
 Tree::Tree(DSM *dsm, uint16_t tree_id) : dsm(dsm), tree_id(tree_id) {
@@ -82,8 +76,155 @@ InternalEntry Tree::get_root_ptr(CoroContext *cxt, int coro_id) {
 }
 
 
+InternalEntry Tree::get_root_ptr(CoroContext *cxt, int coro_id, bool &from_cache) {
+  uint64_t root = cached_root.load();
+  if (root != 0) {
+    metrics[dsm->getMyThreadID()].inc(ROOT_READ_SAVED);
+    from_cache = true;
+    return *(InternalEntry *)&root;
+  }
+  from_cache = false;
+  return get_root_ptr(cxt, coro_id);
+}
+
+
+void Tree::update_root_cache(const InternalEntry &e) {
+  if (cached_root.load() != (uint64_t)e) {
+    cached_root.store((uint64_t)e);
+  }
+}
+
+
+#ifndef TREE_ENABLE_VAR_LEN_VALUE
+void Tree::insert(const Key &k, Value v, CoroContext *cxt, int coro_id, bool is_update, bool is_load) {
+  _insert(k, v, cxt, coro_id, is_update, is_load);
+}
+
+
+bool Tree::search(const Key &k, Value &v, CoroContext *cxt, int coro_id) {
+  return _search(k, v, cxt, coro_id);
+}
+#else
 void Tree::insert(const Key &k, Value v, CoroContext *cxt, int coro_id, bool is_update, bool is_load) {
+  insert(k, (const char *)&v, sizeof(Value), cxt, coro_id, is_update, is_load);
+}
+
+
+bool Tree::search(const Key &k, Value &v, CoroContext *cxt, int coro_id) {
+  thread_local std::string coro_val[MAX_CORO_NUM];
+  auto& val = coro_val[coro_id];
+  if (!search(k, val, cxt, coro_id)) return false;
+  v = 0;
+  memcpy(&v, val.data(), std::min(val.size(), sizeof(Value)));
+  return true;
+}
+
+
+void Tree::insert(const Key &k, const char *val, uint32_t val_len, CoroContext *cxt, int coro_id, bool is_update, bool is_load) {
+  assert(val_len <= define::valLenMax);
+  GlobalAddress addr = GlobalAddress::Null();
+  if (val_len > define::inlineValLenMax) {
+    addr = append_value_log(val, val_len, cxt, coro_id);
+  }
+  else {  // copied into the leaf from the value buffer
+    memcpy((dsm->get_rbuf(coro_id)).get_value_buffer(), val, val_len);
+  }
+  _insert(k, ValueDesc(val_len, addr), cxt, coro_id, is_update, is_load);
+}
+
+
+bool Tree::search(const Key &k, std::string &val, CoroContext *cxt, int coro_id) {
+  Value v;
+  if (!_search(k, v, cxt, coro_id)) return false;
+  ValueDesc desc(v);
+  auto value_buffer = (dsm->get_rbuf(coro_id)).get_value_buffer();
+  if (!desc.is_inline()) {  // inline values are already copied into the value buffer
+    dsm->read_sync(value_buffer, desc.addr(), desc.val_len, cxt);
+  }
+  val.assign(value_buffer, desc.val_len);
+  return true;
+}
+
+
+/*
+  long values are appended to a per-thread log segment on MNs; the values replaced by updates or removed are
+  retired like removed leaves, and a segment is reused once all of its values are dead
+*/
+GlobalAddress Tree::append_value_log(const char *val, uint32_t val_len, CoroContext *cxt, int coro_id) {
+  uint64_t log_len = ROUND_UP(val_len, 3);
+  if (value_log_remain < log_len) {  // the tail of the old segment is left unused
+    if (value_log_seg != GlobalAddress::Null()) {
+      seal_log_segment(value_log_seg, value_log_cur.offset - value_log_seg.offset);
+    }
+    if (!free_log_segments.try_pop(value_log_seg)) {
+      value_log_seg = dsm->alloc(define::kValueLogSegSize);
+    }
+    {
+      std::lock_guard<std::mutex> guard(log_segment_lock);
+      log_segments.emplace(log_segment_key(value_log_seg), LogSegment());
+    }
+    value_log_cur = value_log_seg;
+    value_log_remain = define::kValueLogSegSize;
+  }
+  auto addr = value_log_cur;
+  value_log_cur = GADD(value_log_cur, log_len);
+  value_log_remain -= log_len;
+
+  auto value_buffer = (dsm->get_rbuf(coro_id)).get_value_buffer();
+  memcpy(value_buffer, val, val_len);
+  dsm->write_sync(value_buffer, addr, val_len, cxt);
+  return addr;
+}
+
+
+void Tree::retire_value(const Value &v) {
+  ValueDesc desc(v);
+  if (!desc.is_inline()) {
+    reclaim_later(desc.addr(), ROUND_UP(desc.val_len, 3), RetiredBlock::LOG_VALUE);
+  }
+}
+
+
+void Tree::seal_log_segment(const GlobalAddress &seg_addr, uint64_t appended) {
+  bool dead;
+  {
+    std::lock_guard<std::mutex> guard(log_segment_lock);
+    auto& seg = log_segments.at(log_segment_key(seg_addr));
+    seg.appended = appended;
+    seg.sealed = true;
+    dead = seg.retired = (seg.dead == seg.appended);
+  }
+  if (dead) reclaim_later(seg_addr, define::kValueLogSegSize, RetiredBlock::LOG_SEGMENT);
+}
+
+
+// called by reclaim() for a retired value
+void Tree::free_log_value(const GlobalAddress &addr, int size) {
+  GlobalAddress seg_addr;
+  bool dead;
+  {
+    std::lock_guard<std::mutex> guard(log_segment_lock);
+    auto it = log_segments.upper_bound(log_segment_key(addr));
+    if (it == log_segments.begin()) return;
+    -- it;
+    auto& seg = it->second;
+    auto idx = (log_segment_key(addr) - it->first) / 8;
+    if (seg.retired || idx >= seg.dead_values.size() || seg.dead_values[idx]) return;  // of a reused segment, or retired twice
+    seg.dead_values[idx] = true;
+    seg.dead += size;
+    seg_addr = GlobalAddress(addr.nodeID, it->first & ((1ULL << 48) - 1));
+    dead = seg.retired = (seg.sealed && seg.dead == seg.appended);
+  }
+  if (dead) reclaim_later(seg_addr, define::kValueLogSegSize, RetiredBlock::LOG_SEGMENT);
+}
+#endif
+
+
+void Tree::_insert(const Key &k, Value v, CoroContext *cxt, int coro_id, bool is_update, bool is_load) {
   assert(dsm->is_register());
+#ifdef TREE_ENABLE_CACHE
+  EpochGuard epoch_guard(index_cache, dsm->getMyThreadID(), coro_id);
+#endif
 
   // handover
   bool write_handover = false;
@@ -111,15 +252,16 @@ void Tree::insert(const Key &k, Value v, CoroContext *cxt, int coro_id, bool is_
   Header hdr;
   int max_num;
   uint64_t* cas_buffer;
+  bool node_removed = false;
   int debug_cnt = 0;
 
 #ifdef TREE_ENABLE_WRITE_COMBINING
-  lock_res = local_lock_table->acquire_local_write_lock(k, v, &busy_waiting_queue, cxt, coro_id);
+  lock_res = local_lock_table->acquire_local_write_lock(k, v, cxt);
   write_handover = (lock_res.first && !lock_res.second);
 #endif
-  try_write_op[dsm->getMyThreadID()]++;
+  metrics[dsm->getMyThreadID()].inc(TRY_WRITE_OP);
   if (write_handover) {
-    write_handover_num[dsm->getMyThreadID()]++;
+    metrics[dsm->getMyThreadID()].inc(WRITE_HANDOVER_NUM);
     goto insert_finish;
   }
 
@@ -135,12 +277,13 @@ void Tree::insert(const Key &k, Value v, CoroContext *cxt, int coro_id, bool is_
   }
   else {
     p_ptr = root_ptr_ptr;
-    p = get_root_ptr(cxt, coro_id);
+    p = get_root_ptr(cxt, coro_id, from_cache);
+    node_ptr = root_ptr_ptr;
     depth = 0;
   }
 #else
   p_ptr = root_ptr_ptr;
-  p = get_root_ptr(cxt, coro_id);
+  p = get_root_ptr(cxt, coro_id, from_cache);
   node_ptr = root_ptr_ptr;
   depth = 0;
 #endif
@@ -152,17 +295,33 @@ void Tree::insert(const Key &k, Value v, CoroContext *cxt, int coro_id, bool is_
 #else
   UNUSED(is_update);  // is_update is only used in ROWEX_ART baseline
 #endif
+  goto next;
+
+restart:  // the node we wrote into is removed / shrunk by remove(), start over from the root
+#ifdef TREE_TEST_ROWEX_ART
+  if (!is_update) unlock_node(node_ptr, cxt, coro_id);
+#endif
+  p_ptr = root_ptr_ptr;
+  p = get_root_ptr(cxt, coro_id);
+  node_ptr = root_ptr_ptr;
+  from_cache = false;
+  cache_depth = depth = 1;
+  retry_flag = REMOVED_NODE;
+#ifdef TREE_TEST_ROWEX_ART
+  if (!is_update) lock_node(node_ptr, cxt, coro_id);
+#endif
 
 next:
-  retry_cnt[dsm->getMyThreadID()][retry_flag] ++;
+  metrics[dsm->getMyThreadID()].inc_retry(retry_flag);
 
   // 1. If we are at a NULL node, inject a leaf
   if (p == InternalEntry::Null()) {
     assert(from_cache == false);
     auto cas_buffer = (dsm->get_rbuf(coro_id)).get_cas_buffer();
-    bool res = out_of_place_write_leaf(k, v, depth, leaf_addr, get_partial(k, depth-1), p_ptr, p, node_ptr, cas_buffer, cxt, coro_id);
+    bool res = out_of_place_write_leaf(k, v, depth, leaf_addr, get_partial(k, depth-1), p_ptr, p, node_ptr, cas_buffer, node_removed, cxt, coro_id);
     // cas fail, retry
     if (!res) {
+      if (node_removed) goto restart;
       p = *(InternalEntry*) cas_buffer;
       retry_flag = CAS_NULL;
       goto next;
@@ -174,7 +333,7 @@ next:
   if (p.is_leaf) {
     // 2.1 read the leaf
     auto leaf_buffer = (dsm->get_rbuf(coro_id)).get_leaf_buffer();
-    is_valid = read_leaf(p.addr(), leaf_buffer, std::max((unsigned long)p.kv_len, sizeof(Leaf)), p_ptr, from_cache, cxt, coro_id);
+    is_valid = read_leaf(p.addr(), leaf_buffer, p.leaf_size(), p_ptr, from_cache, cxt, coro_id);
 
     if (!is_valid) {
 #ifdef TREE_ENABLE_CACHE
@@ -198,21 +357,39 @@ next:
     // 2.2 Check if we are updating an existing key
     if (_k == k) {
       if (is_load) {
+#ifdef TREE_ENABLE_VAR_LEN_VALUE
+        retire_value(v);  // not stored
+#endif
         goto insert_finish;
       }
       // Check if the key no need to update
 #ifdef TREE_ENABLE_WRITE_COMBINING
       local_lock_table->get_combining_value(k, v);
 #endif
+#ifndef TREE_ENABLE_VAR_LEN_VALUE
       if (leaf->get_value() == v) {
+#else
+      if (leaf->get_value() == v && !memcmp(leaf->get_inline_value(), (dsm->get_rbuf(coro_id)).get_value_buffer(), ValueDesc(v).inline_len())) {
+#endif
         goto insert_finish;
       }
 #ifdef TREE_ENABLE_IN_PLACE_UPDATE
-      // in place update leaf
-      in_place_update_leaf(k, v, p.addr(), leaf, cxt, coro_id);
-#else
+      bool in_place = true;
+#ifdef TREE_ENABLE_VAR_LEN_VALUE
+      in_place = (InternalEntry::leaf_kv_len(Leaf::size_of(k, v)) == p.kv_len);  // a resized leaf is updated out of place
+#endif
+      if (in_place) {
+        // in place update leaf
+        in_place_update_leaf(k, v, p.addr(), leaf, cxt, coro_id);
+        goto insert_finish;
+      }
+#endif
+#if !defined(TREE_ENABLE_IN_PLACE_UPDATE) || defined(TREE_ENABLE_VAR_LEN_VALUE)
       // out of place update leaf
-      bool res = out_of_place_update_leaf(k, v, depth, leaf_addr, p_ptr, p, node_ptr, cxt, coro_id, !is_update);
+#ifdef TREE_ENABLE_VAR_LEN_VALUE
+      Value old_v = leaf->get_value();
+#endif
+      bool res = out_of_place_update_leaf(k, v, depth, leaf_addr, p_ptr, p, node_ptr, node_removed, cxt, coro_id, !is_update);
 #ifdef TREE_ENABLE_CACHE
       // invalidate the old leaf entry cache
       if (from_cache) {
@@ -220,7 +397,8 @@ next:
       }
 #endif
       if (!res) {
-        lock_fail[dsm->getMyThreadID()] ++;
+        if (node_removed) goto restart;
+        metrics[dsm->getMyThreadID()].inc(LOCK_FAIL);
         if (++ debug_cnt > 50) {
           // TODO retry too many times, restart...
           p_ptr = root_ptr_ptr;
@@ -233,6 +411,9 @@ next:
         retry_flag = CAS_LEAF;
         goto next;
       }
+#ifdef TREE_ENABLE_VAR_LEN_VALUE
+      retire_value(old_v);
+#endif
 #endif
       goto insert_finish;
     }
@@ -241,9 +422,10 @@ next:
     int partial_len = longest_common_prefix(_k, k, depth);
     uint8_t diff_partial = get_partial(_k, depth + partial_len);
     auto cas_buffer = (dsm->get_rbuf(coro_id)).get_cas_buffer();
-    bool res = out_of_place_write_node(k, v, depth, leaf_addr, partial_len, diff_partial, p_ptr, p, node_ptr, cas_buffer, cxt, coro_id);
+    bool res = out_of_place_write_node(k, v, depth, leaf_addr, partial_len, diff_partial, p_ptr, p, node_ptr, cas_buffer, node_removed, cxt, coro_id);
     // cas fail, retry
     if (!res) {
+      if (node_removed) goto restart;
       p = *(InternalEntry*) cas_buffer;
       retry_flag = CAS_LEAF;
       goto next;
@@ -291,9 +473,10 @@ next:
       // need split
       auto cas_buffer = (dsm->get_rbuf(coro_id)).get_cas_buffer();
       int partial_len = hdr.depth + i - depth;  // hdr.depth may be outdated, so use partial_len wrt. depth
-      bool res = out_of_place_write_node(k, v, depth, leaf_addr, partial_len, hdr.partial[i], p_ptr, p, node_ptr, cas_buffer, cxt, coro_id);
+      bool res = out_of_place_write_node(k, v, depth, leaf_addr, partial_len, hdr.partial[i], p_ptr, p, node_ptr, cas_buffer, node_removed, cxt, coro_id);
       // cas fail, retry
       if (!res) {
+        if (node_removed) goto restart;
         p = *(InternalEntry*) cas_buffer;
         retry_flag = SPLIT_HEADER;
         goto next;
@@ -340,13 +523,14 @@ next:
     if (old_e == InternalEntry::Null()) {
       auto e_ptr = GADD(p.addr(), sizeof(GlobalAddress) + sizeof(Header) + i * sizeof(InternalEntry));
       auto cas_buffer = (dsm->get_rbuf(coro_id)).get_cas_buffer();
-      bool res = out_of_place_write_leaf(k, v, depth + 1, leaf_addr, get_partial(k, depth), e_ptr, old_e, node_ptr, cas_buffer, cxt, coro_id);
+      bool res = out_of_place_write_leaf(k, v, depth + 1, leaf_addr, get_partial(k, depth), e_ptr, old_e, node_ptr, cas_buffer, node_removed, cxt, coro_id);
       // cas success, return
       if (res) {
         goto insert_finish;
       }
       // cas fail, check
       else {
+        if (node_removed) goto restart;
         auto e = *(InternalEntry*) cas_buffer;
         if (e.partial == get_partial(k, depth)) {  // same partial keys insert to the same empty slot
           p_ptr = e_ptr;
@@ -364,7 +548,7 @@ next:
   // 3.4 node is full, switch node type
   int slot_id;
   cas_buffer = (dsm->get_rbuf(coro_id)).get_cas_buffer();
-  if (insert_behind(k, v, depth + 1, leaf_addr, get_partial(k, depth), p.type(), node_ptr, cas_buffer, slot_id, cxt, coro_id)){  // insert success
+  if (insert_behind(k, v, depth + 1, leaf_addr, get_partial(k, depth), p.type(), node_ptr, cas_buffer, slot_id, node_removed, cxt, coro_id)){  // insert success
     auto next_type = num_to_node_type(slot_id);
     cas_node_type(next_type, p_ptr, p, hdr, cxt, coro_id);
 #ifdef TREE_ENABLE_CACHE
@@ -374,6 +558,9 @@ next:
 #endif
     goto insert_finish;
   }
+  else if (node_removed) {
+    goto restart;
+  }
   else {  // same partial keys insert to the same empty slot
     p_ptr = GADD(node_ptr, slot_id * sizeof(InternalEntry));
     p = *(InternalEntry*) cas_buffer;
@@ -393,8 +580,7 @@ insert_finish:
 #ifdef TREE_ENABLE_CACHE
   if (!write_handover) {
     auto hit = (cache_depth == 1 ? 0 : (double)cache_depth / depth);
-    cache_hit[dsm->getMyThreadID()] += hit;
-    cache_miss[dsm->getMyThreadID()] += (1 - hit);
+    metrics[dsm->getMyThreadID()].add_cache_hit(hit);
   }
 #endif
 #ifdef TREE_ENABLE_WRITE_COMBINING
@@ -405,7 +591,7 @@ insert_finish:
 
 
 bool Tree::read_leaf(const GlobalAddress &leaf_addr, char *leaf_buffer, int leaf_size, const GlobalAddress &p_ptr, bool from_cache, CoroContext *cxt, int coro_id) {
-  try_read_leaf[dsm->getMyThreadID()] ++;
+  metrics[dsm->getMyThreadID()].inc(TRY_READ_LEAF);
 re_read:
   dsm->read_sync(leaf_buffer, leaf_addr, leaf_size, cxt);
   auto leaf = (Leaf *)leaf_buffer;
@@ -417,11 +603,11 @@ re_read:
   }
   // invalidation
   if (!leaf->is_valid(p_ptr, from_cache)) {
-    leaf_cache_invalid[dsm->getMyThreadID()] ++;
+    metrics[dsm->getMyThreadID()].inc(LEAF_CACHE_INVALID);
     return false;
   }
   if (!leaf->is_consistent()) {
-    read_leaf_retry[dsm->getMyThreadID()] ++;
+    metrics[dsm->getMyThreadID()].inc(READ_LEAF_RETRY);
     goto re_read;
   }
   return true;
@@ -436,6 +622,9 @@ void Tree::in_place_update_leaf(const Key &k, Value &v, const GlobalAddress &lea
 #endif
 
   auto cas_buffer = (dsm->get_rbuf(coro_id)).get_cas_buffer();
+#ifdef TREE_ENABLE_VAR_LEN_VALUE
+  Value old_v;
+#endif
 
   // lock function
   auto acquire_lock = [=](const GlobalAddress &unique_leaf_addr) {
@@ -467,16 +656,16 @@ void Tree::in_place_update_leaf(const Key &k, Value &v, const GlobalAddress &lea
 #ifdef TREE_ENABLE_EMBEDDING_LOCK
   // write w/o unlock
   auto write_without_unlock = [=](const GlobalAddress &unique_leaf_addr){
-    dsm->write_sync((const char*)leaf, unique_leaf_addr, sizeof(Leaf), cxt);
+    dsm->write_sync((const char*)leaf, unique_leaf_addr, leaf->size(), cxt);
   };
   // write and unlock
   auto write_and_unlock = [=](const GlobalAddress &unique_leaf_addr){
     leaf->unlock();
-    dsm->write_sync((const char*)leaf, unique_leaf_addr, sizeof(Leaf), cxt);
+    dsm->write_sync((const char*)leaf, unique_leaf_addr, leaf->size(), cxt);
   };
 #endif
 
-  lock_handover = local_lock_table->acquire_local_lock(leaf_addr, &busy_waiting_queue, cxt, coro_id);
+  lock_handover = local_lock_table->acquire_local_lock(leaf_addr, cxt);
 #endif
   if (lock_handover) {
     goto write_leaf;
@@ -486,24 +675,33 @@ void Tree::in_place_update_leaf(const Key &k, Value &v, const GlobalAddress &lea
 re_acquire:
   if (!acquire_lock(leaf_addr)){
     if (cxt != nullptr) {
-      busy_waiting_queue.push(std::make_pair(coro_id, [](){ return true; }));
+      cxt->waker->wake();  // retry after the others
       (*cxt->yield)(*cxt->master);
     }
-    lock_fail[dsm->getMyThreadID()] ++;
+    metrics[dsm->getMyThreadID()].inc(LOCK_FAIL);
     goto re_acquire;
   }
 
 write_leaf:
+#ifdef TREE_ENABLE_VAR_LEN_VALUE
+  // the value replaced, which others may have updated since the leaf was read
+  dsm->read_sync((char *)cas_buffer, GADD(leaf_addr, STRUCT_OFFSET(Leaf, value)), sizeof(Value), cxt);
+  old_v = *cas_buffer;
+#endif
 #ifdef TREE_TEST_HOCL_HANDOVER
   // in-place write leaf & unlock
   assert(leaf->get_key() == k);
+#ifndef TREE_ENABLE_VAR_LEN_VALUE
   leaf->set_value(v);
+#else
+  leaf->set_value(v, (dsm->get_rbuf(coro_id)).get_value_buffer());
+#endif
   leaf->set_consistent();
 #ifdef TREE_ENABLE_EMBEDDING_LOCK
   // write back the lock at the same time
   local_lock_table->release_local_lock(leaf_addr, unlock, write_without_unlock, write_and_unlock);
 #else
-  dsm->write_sync((const char*)leaf, leaf_addr, sizeof(Leaf), cxt);
+  dsm->write_sync((const char*)leaf, leaf_addr, leaf->size(), cxt);
   local_lock_table->release_local_lock(leaf_addr, unlock);
 #endif
 
@@ -514,18 +712,22 @@ write_leaf:
 #ifdef TREE_ENABLE_WRITE_COMBINING
   local_lock_table->get_combining_value(k, v);
 #endif
+#ifndef TREE_ENABLE_VAR_LEN_VALUE
   leaf->set_value(v);
+#else
+  leaf->set_value(v, (dsm->get_rbuf(coro_id)).get_value_buffer());
+#endif
   leaf->set_consistent();
 #ifdef TREE_ENABLE_EMBEDDING_LOCK
   // write back the lock at the same time
   leaf->unlock();
-  dsm->write_sync((const char*)leaf, leaf_addr, sizeof(Leaf), cxt);
+  dsm->write_sync((const char*)leaf, leaf_addr, leaf->size(), cxt);
 #else
   // batch write updated leaf and on-chip lock
   RdmaOpRegion rs[2];
   rs[0].source = (uint64_t)leaf;
   rs[0].dest = leaf_addr;
-  rs[0].size = sizeof(Leaf);
+  rs[0].size = leaf->size();
   rs[0].is_on_chip = false;
   GlobalAddress lock_addr;
   uint64_t mask;
@@ -535,27 +737,30 @@ write_leaf:
   rs[1].is_on_chip = true;
   dsm->write_cas_mask_sync(rs[0], rs[1], ~0UL, 0UL, mask, cxt);
 #endif
+#endif
+#ifdef TREE_ENABLE_VAR_LEN_VALUE
+  if (old_v != v) retire_value(old_v);
 #endif
   return;
 }
 
 
 bool Tree::out_of_place_update_leaf(const Key &k, Value &v, int depth, GlobalAddress& leaf_addr, const GlobalAddress &e_ptr, InternalEntry &old_e, const GlobalAddress& node_addr,
-                                    CoroContext *cxt, int coro_id, bool disable_handover) {
+                                    bool &node_removed, CoroContext *cxt, int coro_id, bool disable_handover) {
   auto cas_buffer = (dsm->get_rbuf(coro_id)).get_cas_buffer();
   bool res = false;
 
   bool lock_handover = false;
 #ifdef TREE_TEST_HOCL_HANDOVER
   if (!disable_handover) {
-    lock_handover = local_lock_table->acquire_local_lock(k, &busy_waiting_queue, cxt, coro_id);
+    lock_handover = local_lock_table->acquire_local_lock(k, cxt);
   }
 #endif
   if (lock_handover) {
     goto update_finish;
   }
   // try_lock[dsm->getMyThreadID()] ++;
-  res = out_of_place_write_leaf(k, v, depth, leaf_addr, old_e.partial, e_ptr, old_e, node_addr, cas_buffer, cxt, coro_id);
+  res = out_of_place_write_leaf(k, v, depth, leaf_addr, old_e.partial, e_ptr, old_e, node_addr, cas_buffer, node_removed, cxt, coro_id);
   if (res) {
     // invalid the old leaf
     auto zero_byte = (dsm->get_rbuf(coro_id)).get_zero_byte();
@@ -597,7 +802,7 @@ void Tree::lock_node(const GlobalAddress &node_addr, CoroContext *cxt, int coro_
 
   bool lock_handover = false;
 #ifdef TREE_TEST_HOCL_HANDOVER
-  lock_handover = local_lock_table->acquire_local_lock(node_addr, &busy_waiting_queue, cxt, coro_id);
+  lock_handover = local_lock_table->acquire_local_lock(node_addr, cxt);
 #endif
   if (lock_handover) {
     return;
@@ -606,10 +811,10 @@ void Tree::lock_node(const GlobalAddress &node_addr, CoroContext *cxt, int coro_
 re_acquire:
   if (!acquire_lock(node_addr)){
     if (cxt != nullptr) {
-      busy_waiting_queue.push(std::make_pair(coro_id, [](){ return true; }));
+      cxt->waker->wake();  // retry after the others
       (*cxt->yield)(*cxt->master);
     }
-    lock_fail[dsm->getMyThreadID()] ++;
+    metrics[dsm->getMyThreadID()].inc(LOCK_FAIL);
     goto re_acquire;
   }
   return;
@@ -638,7 +843,7 @@ void Tree::unlock_node(const GlobalAddress &node_addr, CoroContext *cxt, int cor
 
 bool Tree::out_of_place_write_leaf(const Key &k, Value &v, int depth, GlobalAddress& leaf_addr, uint8_t partial_key,
                                    const GlobalAddress &e_ptr, const InternalEntry &old_e, const GlobalAddress& node_addr, uint64_t *ret_buffer,
-                                   CoroContext *cxt, int coro_id) {
+                                   bool &node_removed, CoroContext *cxt, int coro_id, bool in_bound) {
   bool unwrite = leaf_addr == GlobalAddress::Null();
 #ifdef TREE_ENABLE_WRITE_COMBINING
   if (local_lock_table->get_combining_value(k, v)) unwrite = true;
@@ -646,9 +851,13 @@ bool Tree::out_of_place_write_leaf(const Key &k, Value &v, int depth, GlobalAddr
   // allocate & write
   if (unwrite) {  // !ONLY allocate once
     auto leaf_buffer = (dsm->get_rbuf(coro_id)).get_leaf_buffer();
-    new (leaf_buffer) Leaf(k, v, e_ptr);
-    leaf_addr = dsm->alloc(sizeof(Leaf));
-    dsm->write_sync(leaf_buffer, leaf_addr, sizeof(Leaf), cxt);
+#ifndef TREE_ENABLE_VAR_LEN_VALUE
+    auto leaf = new (leaf_buffer) Leaf(k, v, e_ptr);
+#else
+    auto leaf = new (leaf_buffer) Leaf(k, v, e_ptr, (dsm->get_rbuf(coro_id)).get_value_buffer());
+#endif
+    leaf_addr = dsm->alloc(leaf->size());
+    dsm->write_sync(leaf_buffer, leaf_addr, leaf->size(), cxt);
   }
   else {  // write the changed e_ptr inside leaf
     auto ptr_buffer = (dsm->get_rbuf(coro_id)).get_entry_buffer();
@@ -657,9 +866,9 @@ bool Tree::out_of_place_write_leaf(const Key &k, Value &v, int depth, GlobalAddr
   }
 
   // cas entry
-  auto new_e = InternalEntry(partial_key, sizeof(Leaf) < 128 ? sizeof(Leaf) : 0, leaf_addr);
-  auto remote_cas = [=](){
-    return dsm->cas_sync(e_ptr, (uint64_t)old_e, (uint64_t)new_e, ret_buffer, cxt);
+  auto new_e = InternalEntry(partial_key, InternalEntry::leaf_kv_len(Leaf::size_of(k, v)), leaf_addr);
+  auto remote_cas = [=, &node_removed](){
+    return cas_node_entry(e_ptr, old_e, new_e, node_addr, in_bound, ret_buffer, node_removed, cxt, coro_id);
   };
 
 // #ifndef TREE_TEST_ROWEX_ART
@@ -677,12 +886,12 @@ bool Tree::read_node(InternalEntry &p, bool& type_correct, char *node_buffer, co
   auto p_node = (InternalPage *)node_buffer;
   auto& hdr = p_node->hdr;
 
-  read_node_type[dsm->getMyThreadID()][hdr.type()] ++;
-  try_read_node[dsm->getMyThreadID()] ++;
+  metrics[dsm->getMyThreadID()].inc_node_type(hdr.type());
+  metrics[dsm->getMyThreadID()].inc(TRY_READ_NODE);
 
   if (hdr.node_type != p.node_type) {
     if (hdr.node_type > p.node_type) {  // need to read the rest part
-      read_node_repair[dsm->getMyThreadID()] ++;
+      metrics[dsm->getMyThreadID()].inc(READ_NODE_REPAIR);
       auto remain_size = (node_type_to_num(hdr.type()) - node_type_to_num(p.type())) * sizeof(InternalEntry);
       dsm->read_sync(node_buffer + read_size, GADD(p.addr(), read_size), remain_size, cxt);
     }
@@ -696,13 +905,17 @@ bool Tree::read_node(InternalEntry &p, bool& type_correct, char *node_buffer, co
     dsm->cas(p.addr(), p_node->rev_ptr, p_ptr, cas_buffer, false, cxt);
     // dsm->cas_sync(p.addr(), p_node->rev_ptr, p_ptr, cas_buffer, cxt);
   }
-  return p_node->is_valid(p_ptr, depth, from_cache);
+  bool is_valid = p_node->is_valid(p_ptr, depth, from_cache);
+  if (p_ptr == root_ptr_ptr) {  // refresh the cached root entry
+    update_root_cache(is_valid ? p : InternalEntry::Null());
+  }
+  return is_valid;
 }
 
 
 bool Tree::out_of_place_write_node(const Key &k, Value &v, int depth, GlobalAddress& leaf_addr, int partial_len, uint8_t diff_partial,
                                    const GlobalAddress &e_ptr, const InternalEntry &old_e, const GlobalAddress& node_addr,
-                                   uint64_t *ret_buffer, CoroContext *cxt, int coro_id) {
+                                   uint64_t *ret_buffer, bool &node_removed, CoroContext *cxt, int coro_id) {
   int new_node_num = partial_len / (define::hPartialLenMax + 1) + 1;
   auto leaf_unwrite = (leaf_addr == GlobalAddress::Null());
 
@@ -717,8 +930,12 @@ bool Tree::out_of_place_write_node(const Key &k, Value &v, int depth, GlobalAddr
   if (local_lock_table->get_combining_value(k, v)) leaf_unwrite = true;
 #endif
   if (leaf_unwrite) {  // !ONLY allocate once
+#ifndef TREE_ENABLE_VAR_LEN_VALUE
     new (leaf_buffer) Leaf(k, v, leaf_e_ptr);
-    leaf_addr = dsm->alloc(sizeof(Leaf));
+#else
+    new (leaf_buffer) Leaf(k, v, leaf_e_ptr, (dsm->get_rbuf(coro_id)).get_value_buffer());
+#endif
+    leaf_addr = dsm->alloc(Leaf::size_of(k, v));
   }
   else {  // write the changed e_ptr inside new leaf  TODO: batch
     auto ptr_buffer = (dsm->get_rbuf(coro_id)).get_entry_buffer();
@@ -745,7 +962,7 @@ bool Tree::out_of_place_write_node(const Key &k, Value &v, int depth, GlobalAddr
   node_pages[new_node_num - 1] = new (node_buffer) InternalPage(k, partial_len, depth, nodes_type, rev_ptr);
   node_pages[new_node_num - 1]->records[0] = InternalEntry(diff_partial, old_e);
   node_pages[new_node_num - 1]->records[1] = InternalEntry(get_partial(k, depth + partial_len),
-                                                           sizeof(Leaf) < 128 ? sizeof(Leaf) : 0, leaf_addr);
+                                                           InternalEntry::leaf_kv_len(Leaf::size_of(k, v)), leaf_addr);
 
   // init the parent entry
   auto new_e = InternalEntry(old_e.partial, nodes_type, node_addrs[0]);
@@ -763,18 +980,19 @@ bool Tree::out_of_place_write_node(const Key &k, Value &v, int depth, GlobalAddr
   if (leaf_unwrite) {
     rs[new_node_num].source     = (uint64_t)leaf_buffer;
     rs[new_node_num].dest       = leaf_addr;
-    rs[new_node_num].size       = sizeof(Leaf);
+    rs[new_node_num].size       = Leaf::size_of(k, v);
     rs[new_node_num].is_on_chip = false;
   }
   dsm->write_batches_sync(rs, (leaf_unwrite ? new_node_num + 1 : new_node_num), cxt, coro_id);
 
   // cas
-  auto remote_cas = [=](){
-    return dsm->cas_sync(e_ptr, (uint64_t)old_e, (uint64_t)new_e, ret_buffer, cxt);
+  auto remote_cas = [=, &node_removed](){
+    return cas_node_entry(e_ptr, old_e, new_e, node_addr, true, ret_buffer, node_removed, cxt, coro_id);
   };
-  auto reclaim_memory = [=](){
+  auto reclaim_memory = [=, &node_removed](){
     for (int i = 0; i < new_node_num; ++ i) {
-      dsm->free(node_addrs[i], define::allocAlignPageSize);
+      if (node_removed) reclaim_later(node_addrs[i], define::allocAlignPageSize);  // may have been seen by others
+      else dsm->free(node_addrs[i], define::allocAlignPageSize);
     }
   };
 // #ifndef TREE_TEST_ROWEX_ART
@@ -804,6 +1022,47 @@ bool Tree::out_of_place_write_node(const Key &k, Value &v, int depth, GlobalAddr
 }
 
 
+bool Tree::cas_node_entry(const GlobalAddress &e_ptr, const InternalEntry &old_e, const InternalEntry &new_e, const GlobalAddress& node_addr,
+                          bool in_bound, uint64_t *ret_buffer, bool &node_removed, CoroContext *cxt, int coro_id) {
+  node_removed = false;
+  if (node_addr == root_ptr_ptr) {
+    bool res = dsm->cas_sync(e_ptr, (uint64_t)old_e, (uint64_t)new_e, ret_buffer, cxt);
+    if (res) {
+      update_root_cache(new_e.is_leaf ? InternalEntry::Null() : new_e);
+    }
+    return res;
+  }
+
+  // batch cas entry & read node header, to check whether the node is removed / shrunk by remove() meanwhile
+  auto header_buffer = (dsm->get_rbuf(coro_id)).get_header_buffer();
+  RdmaOpRegion cas_ror, read_ror;
+  cas_ror.source     = (uint64_t)ret_buffer;
+  cas_ror.dest       = e_ptr;
+  cas_ror.is_on_chip = false;
+  read_ror.source     = (uint64_t)header_buffer;
+  read_ror.dest       = GADD(node_addr, -(int)sizeof(Header));
+  read_ror.size       = sizeof(Header);
+  read_ror.is_on_chip = false;
+  if (!dsm->cas_read_sync(cas_ror, read_ror, (uint64_t)old_e, (uint64_t)new_e, cxt)) {
+    return false;
+  }
+  int slot_id = (e_ptr.offset - node_addr.offset) / sizeof(InternalEntry);
+  auto is_visible = [=](){
+    auto hdr = *(Header *)header_buffer;
+    return hdr.type() != NODE_DELETED && (!in_bound || slot_id < node_type_to_num(hdr.type()));
+  };
+  if (is_visible()) {
+    return true;
+  }
+
+  // take the entry back, the caller will retry from root; once another value replaced it (unlinked by remove(),
+  // split or updated), the entry is no longer ours to take back
+  node_removed = true;
+  dsm->cas_sync(e_ptr, (uint64_t)new_e, (uint64_t)old_e, ret_buffer, cxt);
+  return false;
+}
+
+
 void Tree::cas_node_type(NodeType next_type, GlobalAddress p_ptr, InternalEntry p, Header hdr,
                          CoroContext *cxt, int coro_id) {
   auto node_addr = p.addr();
@@ -859,23 +1118,23 @@ re_switch:
     // handle the conflict when switch & split/delete happen at the same time
     while (p != InternalEntry::Null() && !p.is_leaf && p.addr() != node_addr) {
       read_first_entry();
-      retry_cnt[dsm->getMyThreadID()][SWITCH_FIND_TARGET] ++;
+      metrics[dsm->getMyThreadID()].inc_retry(SWITCH_FIND_TARGET);
     }
     if (p.addr() != node_addr || p.type() >= next_type) res.first = true;  // no need to retry
   }
   if (!res.second) {
     hdr = *(Header *)cas_buffer_2;
-    if (hdr.type() >= next_type) res.second = true;  // no need to retry
+    if (hdr.type() >= next_type || hdr.type() == NODE_DELETED) res.second = true;  // no need to retry
   }
   if (!res.first || !res.second) {
-    retry_cnt[dsm->getMyThreadID()][SWITCH_RETRY] ++;
+    metrics[dsm->getMyThreadID()].inc_retry(SWITCH_RETRY);
     goto re_switch;
   }
 }
 
 
 bool Tree::insert_behind(const Key &k, Value &v, int depth, GlobalAddress& leaf_addr, uint8_t partial_key, NodeType node_type,
-                         const GlobalAddress &node_addr, uint64_t *ret_buffer, int& inserted_idx,
+                         const GlobalAddress &node_addr, uint64_t *ret_buffer, int& inserted_idx, bool &node_removed,
                          CoroContext *cxt, int coro_id) {
   int max_num, i;
   assert(node_type != NODE_256);
@@ -884,7 +1143,7 @@ bool Tree::insert_behind(const Key &k, Value &v, int depth, GlobalAddress& leaf_
   for (i = 0; i < 256 - max_num; ++ i) {
     auto slot_id = max_num + i;
     GlobalAddress e_ptr = GADD(node_addr, slot_id * sizeof(InternalEntry));
-    bool res = out_of_place_write_leaf(k, v, depth, leaf_addr, partial_key, e_ptr, InternalEntry::Null(), node_addr, ret_buffer, cxt, coro_id);
+    bool res = out_of_place_write_leaf(k, v, depth, leaf_addr, partial_key, e_ptr, InternalEntry::Null(), node_addr, ret_buffer, node_removed, cxt, coro_id, false);
     // cas success, return to switch node type
     if (res) {
       inserted_idx = slot_id;
@@ -892,20 +1151,26 @@ bool Tree::insert_behind(const Key &k, Value &v, int depth, GlobalAddress& leaf_
     }
     // cas fail, check
     else {
+      if (node_removed) {
+        return false;  // restart
+      }
       auto e = *(InternalEntry*) ret_buffer;
       if (e.partial == partial_key) {  // same partial keys insert to the same empty slot
         inserted_idx = slot_id;
         return false;  // search next level
       }
     }
-    retry_cnt[dsm->getMyThreadID()][INSERT_BEHIND_TRY_NEXT] ++;
+    metrics[dsm->getMyThreadID()].inc_retry(INSERT_BEHIND_TRY_NEXT);
   }
   assert(false);
 }
 
 
-bool Tree::search(const Key &k, Value &v, CoroContext *cxt, int coro_id) {
+bool Tree::_search(const Key &k, Value &v, CoroContext *cxt, int coro_id) {
   assert(dsm->is_register());
+#ifdef TREE_ENABLE_CACHE
+  EpochGuard epoch_guard(index_cache, dsm->getMyThreadID(), coro_id);
+#endif
 
   // handover
   bool search_res = false;
@@ -933,12 +1198,12 @@ bool Tree::search(const Key &k, Value &v, CoroContext *cxt, int coro_id) {
   int max_num;
 
 #ifdef TREE_ENABLE_READ_DELEGATION
-  lock_res = local_lock_table->acquire_local_read_lock(k, &busy_waiting_queue, cxt, coro_id);
+  lock_res = local_lock_table->acquire_local_read_lock(k, cxt);
   read_handover = (lock_res.first && !lock_res.second);
 #endif
-  try_read_op[dsm->getMyThreadID()]++;
+  metrics[dsm->getMyThreadID()].inc(TRY_READ_OP);
   if (read_handover) {
-    read_handover_num[dsm->getMyThreadID()]++;
+    metrics[dsm->getMyThreadID()].inc(READ_HANDOVER_NUM);
     goto search_finish;
   }
 
@@ -953,20 +1218,19 @@ bool Tree::search(const Key &k, Value &v, CoroContext *cxt, int coro_id) {
   }
   else {
     p_ptr = root_ptr_ptr;
-    p = get_root_ptr(cxt, coro_id);
+    p = get_root_ptr(cxt, coro_id, from_cache);
     depth = 0;
   }
 #else
   p_ptr = root_ptr_ptr;
-  p = get_root_ptr(cxt, coro_id);
+  p = get_root_ptr(cxt, coro_id, from_cache);
   depth = 0;
 #endif
   depth ++;
   cache_depth = depth;
-  assert(p != InternalEntry::Null());
 
 next:
-  retry_cnt[dsm->getMyThreadID()][retry_flag] ++;
+  metrics[dsm->getMyThreadID()].inc_retry(retry_flag);
 
   // 1. If we are at a NULL node, inject a leaf
   if (p == InternalEntry::Null()) {
@@ -979,7 +1243,7 @@ next:
   if (p.is_leaf) {
     // 2.1 read the leaf
     auto leaf_buffer = (dsm->get_rbuf(coro_id)).get_leaf_buffer();
-    is_valid = read_leaf(p.addr(), leaf_buffer, std::max((unsigned long)p.kv_len, sizeof(Leaf)), p_ptr, from_cache, cxt, coro_id);
+    is_valid = read_leaf(p.addr(), leaf_buffer, p.leaf_size(), p_ptr, from_cache, cxt, coro_id);
 
     if (!is_valid) {
 #ifdef TREE_ENABLE_CACHE
@@ -1002,6 +1266,9 @@ next:
     // 2.2 Check if it is the key we search
     if (_k == k) {
       v = leaf->get_value();
+#ifdef TREE_ENABLE_VAR_LEN_VALUE
+      memcpy((dsm->get_rbuf(coro_id)).get_value_buffer(), leaf->get_inline_value(), ValueDesc(v).inline_len());
+#endif
       search_res = true;
     }
     else {
@@ -1072,8 +1339,7 @@ search_finish:
 #ifdef TREE_ENABLE_CACHE
   if (!read_handover) {
     auto hit = (cache_depth == 1 ? 0 : (double)cache_depth / depth);
-    cache_hit[dsm->getMyThreadID()] += hit;
-    cache_miss[dsm->getMyThreadID()] += (1 - hit);
+    metrics[dsm->getMyThreadID()].add_cache_hit(hit);
   }
 #endif
 #ifdef TREE_ENABLE_READ_DELEGATION
@@ -1084,60 +1350,364 @@ search_finish:
 }
 
 
-void Tree::search_entries(const Key &from, const Key &to, int target_depth, std::vector<ScanContext> &res, CoroContext *cxt, int coro_id) {
+/*
+  batched point lookups: keys start from their cached entries, then each round reads the next level of all
+  unresolved keys in one doorbell-batched read per MN, keys on the same node / leaf sharing a read;
+  n keys thus take about depth round trips instead of n * depth
+*/
+void Tree::multi_search(const Key *keys, int n, Value *out, bool *found, CoroContext *cxt, int coro_id) {
+  thread_local std::vector<SearchContext> coro_sc[MAX_CORO_NUM];
+  thread_local std::vector<int> coro_pending[MAX_CORO_NUM];
+  thread_local std::vector<int> coro_next_pending[MAX_CORO_NUM];
+  thread_local std::vector<int> coro_slot[MAX_CORO_NUM];
+  thread_local std::vector<RdmaOpRegion> coro_rs[MAX_CORO_NUM];
+  thread_local std::map<uint64_t, int> coro_slot_of[MAX_CORO_NUM];
+#ifdef TREE_ENABLE_CACHE
+  EpochGuard epoch_guard(index_cache, dsm->getMyThreadID(), coro_id);
+#endif
+  auto& sc = coro_sc[coro_id];
+  auto& pending = coro_pending[coro_id];
+  auto& next_pending = coro_next_pending[coro_id];
+  auto& slot = coro_slot[coro_id];
+  auto& rs = coro_rs[coro_id];
+  auto& slot_of = coro_slot_of[coro_id];
+
+  assert(dsm->is_register());
+  if (n <= 0) return;
+
+  auto range_buffer = (dsm->get_rbuf(coro_id)).get_range_buffer();
+  auto range_page_cnt = (dsm->get_rbuf(coro_id)).get_range_page_cnt();
+  auto cas_buffer = (dsm->get_rbuf(coro_id)).get_cas_buffer();
+  auto reread_entry = [&](SearchContext& s) {
+#ifdef TREE_ENABLE_CACHE
+    // invalidate the old entry cache
+    if (s.from_cache) {
+      index_cache->invalidate(s.entry_ptr_ptr, s.entry_ptr);
+    }
+#endif
+    auto entry_buffer = (dsm->get_rbuf(coro_id)).get_entry_buffer();
+    dsm->read_sync((char *)entry_buffer, s.e_ptr, sizeof(InternalEntry), cxt);
+    s.e = *(InternalEntry *)entry_buffer;
+    s.from_cache = false;
+  };
+
+  // search local cache, the root is read once for all the missed keys
+  sc.resize(n);
+  slot.resize(n);
+  pending.clear();
+  bool root_read = false, root_from_cache = false;
+  InternalEntry root;
+  for (int i = 0; i < n; ++ i) {
+    auto& s = sc[i];
+    found[i] = false;
+    s.from_cache = false;
+#ifdef TREE_ENABLE_CACHE
+    int entry_idx = -1;
+    s.from_cache = index_cache->search_from_cache(keys[i], s.entry_ptr_ptr, s.entry_ptr, entry_idx);
+    if (s.from_cache) {  // cache hit
+      assert(entry_idx >= 0);
+      s.e_ptr = GADD(s.entry_ptr->addr, sizeof(InternalEntry) * entry_idx);
+      s.e = s.entry_ptr->records[entry_idx];
+      s.depth = s.entry_ptr->depth;
+    }
+#endif
+    if (!s.from_cache) {
+      if (!root_read) {
+        root = get_root_ptr(cxt, coro_id, root_from_cache);
+        root_read = true;
+      }
+      s.e_ptr = root_ptr_ptr;
+      s.e = root;
+      s.from_cache = root_from_cache;
+      s.entry_ptr_ptr = nullptr;
+      s.entry_ptr = nullptr;
+      s.depth = 0;
+    }
+    s.depth ++;
+    s.cache_depth = s.depth;
+    pending.push_back(i);
+  }
+
+  while (true) {
+    // keys at a NULL entry are not found
+    pending.erase(std::remove_if(pending.begin(), pending.end(), [&](int i){ return sc[i].e == InternalEntry::Null(); }), pending.end());
+    if (pending.empty()) {
+      break;
+    }
+
+    // 1. batch read the current level of nodes / leaves, one read for each distinct address
+    rs.clear();
+    slot_of.clear();
+    for (auto i : pending) {
+      auto& p = sc[i].e;
+      uint64_t size = p.is_leaf ? p.leaf_size() : (sizeof(GlobalAddress) + sizeof(Header) + node_type_to_num(p.type()) * sizeof(InternalEntry));
+      auto token = (uint64_t)p.addr();
+      auto it = slot_of.find(token);
+      if (it != slot_of.end()) {
+        slot[i] = it->second;
+        rs[slot[i]].size = std::max(rs[slot[i]].size, size);
+      }
+      else if ((int)rs.size() < range_page_cnt) {
+        slot[i] = rs.size();
+        slot_of[token] = slot[i];
+        RdmaOpRegion r;
+        r.source     = (uint64_t)range_buffer + rs.size() * define::allocationPageSize;
+        r.dest       = p.addr();
+        r.size       = size;
+        r.is_on_chip = false;
+        rs.push_back(r);
+      }
+      else {  // read in the next round
+        slot[i] = -1;
+      }
+    }
+    dsm->read_batches_sync(rs, cxt, coro_id);
+
+    // 2. check the read leaves and step the keys into the next level
+    next_pending.clear();
+    for (auto i : pending) {
+      auto& s = sc[i];
+      if (slot[i] < 0) {
+        next_pending.push_back(i);
+        continue;
+      }
+      auto buffer = range_buffer + slot[i] * define::allocationPageSize;
+
+      // 2.1 if it is leaf, check & save result
+      if (s.e.is_leaf) {
+        auto leaf = (Leaf *)buffer;
+        metrics[dsm->getMyThreadID()].inc(TRY_READ_LEAF);
+        // udpate reverse pointer if needed
+        if (!s.from_cache && leaf->rev_ptr != s.e_ptr) {
+          dsm->cas(s.e.addr(), leaf->rev_ptr, s.e_ptr, cas_buffer, false, cxt);
+        }
+        if (!leaf->is_valid(s.e_ptr, s.from_cache)) {
+          metrics[dsm->getMyThreadID()].inc(LEAF_CACHE_INVALID);
+          reread_entry(s);
+          next_pending.push_back(i);
+          continue;
+        }
+        if (!leaf->is_consistent()) {
+          metrics[dsm->getMyThreadID()].inc(READ_LEAF_RETRY);
+          next_pending.push_back(i);
+          continue;
+        }
+        if (leaf->get_key() == keys[i]) {
+          out[i] = leaf->get_value();
+          found[i] = true;
+        }
+        continue;
+      }
+
+      // 2.2 if it is node, check header & find the next entry
+      auto p_node = (InternalPage *)buffer;
+      auto& hdr = p_node->hdr;
+      metrics[dsm->getMyThreadID()].inc_node_type(hdr.type());
+      metrics[dsm->getMyThreadID()].inc(TRY_READ_NODE);
+      if (!s.from_cache && p_node->rev_ptr != s.e_ptr) {
+        dsm->cas(s.e.addr(), p_node->rev_ptr, s.e_ptr, cas_buffer, false, cxt);
+      }
+      bool is_valid = p_node->is_valid(s.e_ptr, s.depth, s.from_cache);
+      if (s.e_ptr == root_ptr_ptr) {  // refresh the cached root entry
+        auto e = s.e;
+        e.node_type = hdr.node_type;
+        update_root_cache(is_valid ? e : InternalEntry::Null());
+      }
+      if (!is_valid) {  // node deleted || outdated cache entry in cached node
+        reread_entry(s);
+        next_pending.push_back(i);
+        continue;
+      }
+      if (hdr.node_type != s.e.node_type) {
+#ifdef TREE_ENABLE_CACHE
+        if (s.from_cache) {  // invalidate the out dated node type
+          index_cache->invalidate(s.entry_ptr_ptr, s.entry_ptr);
+        }
+#endif
+        bool partly_read = hdr.node_type > s.e.node_type && rs[slot[i]].size < sizeof(GlobalAddress) + sizeof(Header) + node_type_to_num(hdr.type()) * sizeof(InternalEntry);
+        s.e.node_type = hdr.node_type;
+        if (partly_read) {  // read the whole node in the next round
+          metrics[dsm->getMyThreadID()].inc(READ_NODE_REPAIR);
+          next_pending.push_back(i);
+          continue;
+        }
+      }
+#ifdef TREE_ENABLE_CACHE
+      if (s.depth == hdr.depth) {
+        index_cache->add_to_cache(keys[i], p_node, GADD(s.e.addr(), sizeof(GlobalAddress) + sizeof(Header)));
+      }
+#endif
+      bool partial_match = true;
+      for (int j = 0; j < hdr.partial_len; ++ j) {
+        if (get_partial(keys[i], hdr.depth + j) != hdr.partial[j]) {
+          partial_match = false;
+          break;
+        }
+      }
+      if (!partial_match) {
+        continue;
+      }
+      s.depth = hdr.depth + hdr.partial_len;
+
+      auto partial = get_partial(keys[i], s.depth);
+      auto max_num = node_type_to_num(s.e.type());
+      for (int j = 0; j < max_num; ++ j) {
+        auto old_e = p_node->records[j];
+        if (old_e != InternalEntry::Null() && old_e.partial == partial) {
+          s.e_ptr = GADD(s.e.addr(), sizeof(GlobalAddress) + sizeof(Header) + j * sizeof(InternalEntry));
+          s.e = old_e;
+          s.from_cache = false;
+          s.depth ++;
+          next_pending.push_back(i);  // search next level
+          break;
+        }
+      }
+    }
+    pending.swap(next_pending);
+  }
+
+#ifdef TREE_ENABLE_CACHE
+  for (int i = 0; i < n; ++ i) {
+    auto hit = (sc[i].cache_depth == 1 ? 0 : (double)sc[i].cache_depth / sc[i].depth);
+    metrics[dsm->getMyThreadID()].add_cache_hit(hit);
+  }
+#endif
+  metrics[dsm->getMyThreadID()].inc(TRY_READ_OP, n);
+}
+
+
+bool Tree::remove(const Key &k, CoroContext *cxt, int coro_id) {
   assert(dsm->is_register());
+#ifdef TREE_ENABLE_CACHE
+  EpochGuard epoch_guard(index_cache, dsm->getMyThreadID(), coro_id);
+#endif
+
+  bool remove_res = false;
 
+  // traversal
   GlobalAddress p_ptr;
   InternalEntry p;
+  GlobalAddress node_ptr;  // node address(excluding header)
   int depth;
+  int retry_flag = FIRST_TRY;
+
+  // cache
   bool from_cache = false;
   volatile CacheEntry** entry_ptr_ptr = nullptr;
   CacheEntry* entry_ptr = nullptr;
   int entry_idx = -1;
   int cache_depth = 0;
 
-  bool type_correct;
+  // temp
   char* page_buffer;
-  bool is_valid;
-  InternalPage* p_node;
+  bool is_valid, type_correct;
+  InternalPage* p_node = nullptr;
   Header hdr;
   int max_num;
 
   // search local cache
 #ifdef TREE_ENABLE_CACHE
-  from_cache = index_cache->search_from_cache(from, entry_ptr_ptr, entry_ptr, entry_idx);
+  from_cache = index_cache->search_from_cache(k, entry_ptr_ptr, entry_ptr, entry_idx);
   if (from_cache) { // cache hit
     assert(entry_idx >= 0);
     p_ptr = GADD(entry_ptr->addr, sizeof(InternalEntry) * entry_idx);
     p = entry_ptr->records[entry_idx];
+    node_ptr = entry_ptr->addr;
     depth = entry_ptr->depth;
   }
   else {
     p_ptr = root_ptr_ptr;
-    p = get_root_ptr(cxt, coro_id);
+    p = get_root_ptr(cxt, coro_id, from_cache);
+    node_ptr = root_ptr_ptr;
     depth = 0;
   }
 #else
   p_ptr = root_ptr_ptr;
-  p = get_root_ptr(cxt, coro_id);
+  p = get_root_ptr(cxt, coro_id, from_cache);
+  node_ptr = root_ptr_ptr;
   depth = 0;
 #endif
   depth ++;
   cache_depth = depth;
+  goto next;
+
+restart:  // the leaf is claimed by a concurrent collapse_node(), start over from the root
+  p_ptr = root_ptr_ptr;
+  p = get_root_ptr(cxt, coro_id);
+  node_ptr = root_ptr_ptr;
+  from_cache = false;
+  cache_depth = depth = 1;
+  retry_flag = REMOVED_NODE;
 
 next:
-  // 1. If we are at a NULL node
+  metrics[dsm->getMyThreadID()].inc_retry(retry_flag);
+
+  // 1. If we are at a NULL node, the key does not exist
   if (p == InternalEntry::Null()) {
-    goto search_finish;
+    assert(from_cache == false);
+    remove_res = false;
+    goto remove_finish;
   }
 
-  // 2. Check if it is the target depth
-  if (depth == target_depth) {
-    res.push_back(ScanContext(p, p_ptr, depth-1, from_cache, entry_ptr_ptr, entry_ptr, from, to, BORDER, BORDER));
-    goto search_finish;
-  }
+  // 2. If we are at a leaf, unlink it
   if (p.is_leaf) {
-    goto search_finish;
+    // 2.1 read the leaf
+    auto leaf_buffer = (dsm->get_rbuf(coro_id)).get_leaf_buffer();
+    is_valid = read_leaf(p.addr(), leaf_buffer, p.leaf_size(), p_ptr, from_cache, cxt, coro_id);
+
+    if (!is_valid) {
+#ifdef TREE_ENABLE_CACHE
+      // invalidate the old leaf entry cache
+      if (from_cache) {
+        index_cache->invalidate(entry_ptr_ptr, entry_ptr);
+      }
+#endif
+      // re-read leaf entry
+      auto entry_buffer = (dsm->get_rbuf(coro_id)).get_entry_buffer();
+      dsm->read_sync((char *)entry_buffer, p_ptr, sizeof(InternalEntry), cxt);
+      p = *(InternalEntry *)entry_buffer;
+      from_cache = false;
+      retry_flag = INVALID_LEAF;
+      goto next;
+    }
+    auto leaf = (Leaf *)leaf_buffer;
+    if (leaf->get_key() != k) {
+      remove_res = false;
+      goto remove_finish;
+    }
+
+    // 2.2 cas the entry to Null
+#ifdef TREE_ENABLE_VAR_LEN_VALUE
+    Value old_v = leaf->get_value();
+#endif
+    auto cas_buffer = (dsm->get_rbuf(coro_id)).get_cas_buffer();
+    if (!dsm->cas_sync(p_ptr, (uint64_t)p, (uint64_t)InternalEntry::Null(), cas_buffer, cxt)) {
+      p = *(InternalEntry*) cas_buffer;
+      if (p == InternalEntry::Null()) goto restart;  // removed by others, or claimed by collapse_node()
+      from_cache = false;
+      retry_flag = CAS_LEAF;
+      goto next;
+    }
+
+    // 2.3 invalid the old leaf, and reuse its memory once no operation holds it
+    auto zero_byte = (dsm->get_rbuf(coro_id)).get_zero_byte();
+    dsm->write(zero_byte, GADD(p.addr(), STRUCT_OFFSET(Leaf, valid_byte)), sizeof(uint8_t), false, cxt);
+    reclaim_later(p.addr(), ROUND_UP(p.leaf_size(), ALLOC_ALLIGN_BIT));
+#ifdef TREE_ENABLE_VAR_LEN_VALUE
+    retire_value(old_v);
+#endif
+#ifdef TREE_ENABLE_CACHE
+    if (from_cache) {
+      index_cache->invalidate(entry_ptr_ptr, entry_ptr);
+    }
+#endif
+
+    // 2.4 downgrade / collapse the parent node
+    if (node_ptr != root_ptr_ptr) {
+      shrink_node(k, node_ptr, cxt, coro_id);
+    }
+    remove_res = true;
+    goto remove_finish;
   }
 
   // 3. Find out a node
@@ -1158,14 +1728,320 @@ next:
     dsm->read_sync((char *)entry_buffer, p_ptr, sizeof(InternalEntry), cxt);
     p = *(InternalEntry *)entry_buffer;
     from_cache = false;
+    retry_flag = INVALID_NODE;
     goto next;
   }
 
   // 3.2 Check header
   hdr = p_node->hdr;
 #ifdef TREE_ENABLE_CACHE
-  if (from_cache && !type_correct) {
-    index_cache->invalidate(entry_ptr_ptr, entry_ptr);  // invalidate the out dated node type
+  if (from_cache && !type_correct) {  // invalidate the out dated node type
+    index_cache->invalidate(entry_ptr_ptr, entry_ptr);
+  }
+  if (depth == hdr.depth) {
+    index_cache->add_to_cache(k, p_node, GADD(p.addr(), sizeof(GlobalAddress) + sizeof(Header)));
+  }
+#else
+  UNUSED(type_correct);
+#endif
+
+  for (int i = 0; i < hdr.partial_len; ++ i) {
+    if (get_partial(k, hdr.depth + i) != hdr.partial[i]) {
+      remove_res = false;
+      goto remove_finish;
+    }
+  }
+  depth = hdr.depth + hdr.partial_len;
+  node_ptr = GADD(p.addr(), sizeof(GlobalAddress) + sizeof(Header));
+
+  // 3.3 try get the next internalEntry
+  max_num = node_type_to_num(p.type());
+  for (int i = 0; i < max_num; ++ i) {
+    auto old_e = p_node->records[i];
+    if (old_e != InternalEntry::Null() && old_e.partial == get_partial(k, depth)) {
+      p_ptr = GADD(node_ptr, i * sizeof(InternalEntry));
+      p = old_e;
+      from_cache = false;
+      depth ++;
+      retry_flag = FIND_NEXT;
+      goto next;  // search next level
+    }
+  }
+
+remove_finish:
+#ifdef TREE_ENABLE_CACHE
+  auto hit = (cache_depth == 1 ? 0 : (double)cache_depth / depth);
+  metrics[dsm->getMyThreadID()].add_cache_hit(hit);
+#endif
+  return remove_res;
+}
+
+
+void Tree::shrink_node(const Key &k, const GlobalAddress& node_addr, CoroContext *cxt, int coro_id) {
+  auto page_addr = GADD(node_addr, -(int)(sizeof(GlobalAddress) + sizeof(Header)));
+  auto page_buffer = (dsm->get_rbuf(coro_id)).get_page_buffer();
+  auto p_node = (InternalPage *)page_buffer;
+
+  auto count_records = [=](int& last_idx){
+    int cnt = 0;
+    last_idx = -1;
+    for (int i = 0; i < 256; ++ i) {
+      if (p_node->records[i] != InternalEntry::Null()) {
+        cnt ++;
+        last_idx = i;
+      }
+    }
+    return cnt;
+  };
+
+  // read the whole node, including the entries inserted behind
+  dsm->read_sync(page_buffer, page_addr, define::allocationPageSize, cxt);
+  auto hdr = p_node->hdr;
+  if (hdr.type() == NODE_DELETED) {
+    return;
+  }
+  int last_idx;
+  int cnt = count_records(last_idx);
+
+  // find the parent entry by the reverse pointer
+  auto p_ptr = p_node->rev_ptr;
+  auto entry_buffer = (dsm->get_rbuf(coro_id)).get_entry_buffer();
+  dsm->read_sync((char *)entry_buffer, p_ptr, sizeof(InternalEntry), cxt);
+  auto p = *(InternalEntry *)entry_buffer;
+  if (p == InternalEntry::Null() || p.is_leaf || p.addr() != page_addr) {  // outdated reverse pointer
+    return;
+  }
+
+  // 1. at most one leaf left, merge it into the parent entry
+  if (cnt <= 1) {
+    collapse_node(k, page_addr, p_node, p_ptr, p, cxt, coro_id);
+    return;
+  }
+
+  // 2. downgrade the node type when all entries fit in (and only half fill) a smaller one
+  auto next_type = num_to_node_type(last_idx);
+  if (next_type >= hdr.type() || cnt > node_type_to_num(next_type) / 2) {
+    return;
+  }
+  cas_node_type(next_type, p_ptr, p, hdr, cxt, coro_id);
+
+  // entries inserted behind the new bound meanwhile need the node grow back
+  dsm->read_sync(page_buffer, page_addr, define::allocationPageSize, cxt);
+  hdr = p_node->hdr;
+  count_records(last_idx);
+  if (hdr.type() != NODE_DELETED && last_idx >= node_type_to_num(hdr.type())) {
+    cas_node_type(num_to_node_type(last_idx), p_ptr, InternalEntry(hdr.type(), p), hdr, cxt, coro_id);
+  }
+}
+
+
+void Tree::collapse_node(const Key &k, const GlobalAddress& page_addr, InternalPage* p_node, const GlobalAddress &p_ptr, const InternalEntry &p,
+                         CoroContext *cxt, int coro_id) {
+  auto header_addr = GADD(page_addr, sizeof(GlobalAddress));
+  auto cas_buffer = (dsm->get_rbuf(coro_id)).get_cas_buffer();
+  auto hdr = p_node->hdr;
+
+  // 1. mark the node deleted, so that concurrent writes into it retreat (see cas_node_entry)
+  if (!dsm->cas_mask_sync(header_addr, (uint64_t)hdr, (uint64_t)Header(NODE_DELETED), cas_buffer, Header::node_type_mask, cxt)) {
+    return;
+  }
+
+  // 2. re-read the records; entries written from now on are taken back by their writers
+  dsm->read_sync((char *)p_node, page_addr, define::allocationPageSize, cxt);
+  int cnt = 0, last_idx = -1;
+  for (int i = 0; i < 256; ++ i) {
+    if (p_node->records[i] != InternalEntry::Null()) {
+      cnt ++;
+      last_idx = i;
+    }
+  }
+  auto child = cnt == 1 ? p_node->records[last_idx] : InternalEntry::Null();
+  auto child_ptr = GADD(page_addr, sizeof(GlobalAddress) + sizeof(Header) + last_idx * sizeof(InternalEntry));
+  bool res = cnt == 0 || (cnt == 1 && child.is_leaf);  // only leaves are merged upwards
+
+  // 3. claim the leaf, so that a concurrent remove of it retries from the root
+  if (res && cnt == 1) {
+    res = dsm->cas_sync(child_ptr, (uint64_t)child, (uint64_t)InternalEntry::Null(), cas_buffer, cxt);
+  }
+
+  // 4. switch the parent entry to the leaf / Null
+  if (res) {
+    auto new_e = cnt == 1 ? InternalEntry(p.partial, child) : InternalEntry::Null();
+    res = dsm->cas_sync(p_ptr, (uint64_t)p, (uint64_t)new_e, cas_buffer, cxt);
+    if (!res && cnt == 1) {  // put the leaf back, once the writers into the deleted node have taken their entries back
+      int retry = 0;
+      while (!dsm->cas_sync(child_ptr, (uint64_t)InternalEntry::Null(), (uint64_t)child, cas_buffer, cxt)) {
+        if (++ retry >= define::kCollapseRetryMax) {
+          Debug::notifyError("collapse_node: the slot of a claimed leaf is taken, leaf %lx dropped", child.addr().val);
+          break;
+        }
+        if (cxt != nullptr) {
+          cxt->waker->wake();  // retry after the others
+          (*cxt->yield)(*cxt->master);
+        }
+      }
+    }
+  }
+
+  if (!res) {  // restore the node type, large enough for the entries inserted behind
+    auto node_type = std::max(hdr.type(), cnt ? num_to_node_type(last_idx) : hdr.type());
+    dsm->cas_mask_sync(header_addr, (uint64_t)Header(NODE_DELETED), (uint64_t)Header(node_type), cas_buffer, Header::node_type_mask, cxt);
+    return;
+  }
+
+  // 5. the node is unlinked
+  if (cnt == 1) {  // cas the updated rev_ptr inside the leaf
+    dsm->cas(child.addr(), child_ptr, p_ptr, cas_buffer, false, cxt);
+  }
+  reclaim_later(page_addr, define::allocAlignPageSize);
+#ifdef TREE_ENABLE_CACHE
+  // invalidate the cached copies of the node and of its parent
+  volatile CacheEntry** entry_ptr_ptr;
+  CacheEntry* entry_ptr;
+  int entry_idx;
+  auto node_addr = GADD(page_addr, sizeof(GlobalAddress) + sizeof(Header));
+  for (int i = 0; i < 2; ++ i) {
+    if (index_cache->search_from_cache(k, entry_ptr_ptr, entry_ptr, entry_idx) &&
+        (entry_ptr->addr == node_addr || entry_ptr->records[entry_idx].addr() == page_addr)) {
+      index_cache->invalidate(entry_ptr_ptr, entry_ptr);
+    }
+  }
+#endif
+}
+
+
+void Tree::reclaim_later(const GlobalAddress &addr, int size, RetiredBlock::Type type) {
+  // the epoch is read after unlinking, so the operations that may still hold the block announced it or an earlier one
+#ifdef TREE_ENABLE_CACHE
+  uint64_t epoch = index_cache->current_epoch();
+#else
+  uint64_t epoch = 0;
+#endif
+  retired_blocks.push(RetiredBlock(addr, size, type, epoch, Timer::get_time_ns()));
+  if (type != RetiredBlock::LOG_SEGMENT && retired_cnt.fetch_add(1) % kReclaimBatch == kReclaimBatch - 1) {  // segments are retired by reclaim()
+    reclaim();
+  }
+}
+
+
+void Tree::reclaim() {
+#ifdef TREE_ENABLE_CACHE
+  uint64_t min_epoch = index_cache->min_active_epoch();
+#else
+  uint64_t min_epoch = RadixCache::kIdleEpoch;  // no epochs without the cache, only the grace period holds blocks back
+#endif
+  auto now = Timer::get_time_ns();
+  RetiredBlock b;
+  for (auto cnt = retired_blocks.unsafe_size(); cnt > 0 && retired_blocks.try_pop(b); -- cnt) {
+    if (b.epoch >= min_epoch || b.retire_time + define::kReclaimGracePeriod > now) {  // may still be in use
+      retired_blocks.push(b);
+      continue;
+    }
+    switch (b.type) {
+#ifdef TREE_ENABLE_VAR_LEN_VALUE
+      case RetiredBlock::LOG_VALUE:
+        free_log_value(b.addr, b.size);
+        break;
+      case RetiredBlock::LOG_SEGMENT: {  // late retirements of its values are dropped until now
+        std::lock_guard<std::mutex> guard(log_segment_lock);
+        log_segments.erase(log_segment_key(b.addr));
+        free_log_segments.push(b.addr);
+        break;
+      }
+#endif
+      default:
+        dsm->free(b.addr, b.size);
+        break;
+    }
+  }
+}
+
+
+void Tree::search_entries(const Key &from, const Key &to, int target_depth, std::vector<ScanContext> &res, CoroContext *cxt, int coro_id) {
+  assert(dsm->is_register());
+
+  GlobalAddress p_ptr;
+  InternalEntry p;
+  int depth;
+  bool from_cache = false;
+  volatile CacheEntry** entry_ptr_ptr = nullptr;
+  CacheEntry* entry_ptr = nullptr;
+  int entry_idx = -1;
+  int cache_depth = 0;
+
+  bool type_correct;
+  char* page_buffer;
+  bool is_valid;
+  InternalPage* p_node;
+  Header hdr;
+  int max_num;
+
+  // search local cache
+#ifdef TREE_ENABLE_CACHE
+  from_cache = index_cache->search_from_cache(from, entry_ptr_ptr, entry_ptr, entry_idx);
+  if (from_cache && entry_ptr->depth >= target_depth) {  // cached entry is below the target depth
+    from_cache = false;
+  }
+  if (from_cache) { // cache hit
+    assert(entry_idx >= 0);
+    p_ptr = GADD(entry_ptr->addr, sizeof(InternalEntry) * entry_idx);
+    p = entry_ptr->records[entry_idx];
+    depth = entry_ptr->depth;
+  }
+  else {
+    p_ptr = root_ptr_ptr;
+    p = get_root_ptr(cxt, coro_id);
+    depth = 0;
+  }
+#else
+  p_ptr = root_ptr_ptr;
+  p = get_root_ptr(cxt, coro_id);
+  depth = 0;
+#endif
+  depth ++;
+  cache_depth = depth;
+
+next:
+  // 1. If we are at a NULL node
+  if (p == InternalEntry::Null()) {
+    goto search_finish;
+  }
+
+  // 2. Check if it is the target depth
+  if (depth == target_depth) {
+    res.push_back(ScanContext(p, p_ptr, depth-1, from_cache, entry_ptr_ptr, entry_ptr, from, to, BORDER, BORDER));
+    goto search_finish;
+  }
+  if (p.is_leaf) {
+    goto search_finish;
+  }
+
+  // 3. Find out a node
+  // 3.1 read the node
+  page_buffer = (dsm->get_rbuf(coro_id)).get_page_buffer();
+  is_valid = read_node(p, type_correct, page_buffer, p_ptr, depth, from_cache, cxt, coro_id);
+  p_node = (InternalPage *)page_buffer;
+
+  if (!is_valid) {  // node deleted || outdated cache entry in cached node
+#ifdef TREE_ENABLE_CACHE
+    // invalidate the old node cache
+    if (from_cache) {
+      index_cache->invalidate(entry_ptr_ptr, entry_ptr);
+    }
+#endif
+    // re-read node entry
+    auto entry_buffer = (dsm->get_rbuf(coro_id)).get_entry_buffer();
+    dsm->read_sync((char *)entry_buffer, p_ptr, sizeof(InternalEntry), cxt);
+    p = *(InternalEntry *)entry_buffer;
+    from_cache = false;
+    goto next;
+  }
+
+  // 3.2 Check header
+  hdr = p_node->hdr;
+#ifdef TREE_ENABLE_CACHE
+  if (from_cache && !type_correct) {
+    index_cache->invalidate(entry_ptr_ptr, entry_ptr);  // invalidate the out dated node type
   }
 #else
   UNUSED(type_correct);
@@ -1199,22 +2075,30 @@ next:
 search_finish:
 #ifdef TREE_ENABLE_CACHE
   auto hit = (cache_depth == 1 ? 0 : (double)cache_depth / depth);
-  cache_hit[dsm->getMyThreadID()] += hit;
-  cache_miss[dsm->getMyThreadID()] += (1 - hit);
+  metrics[dsm->getMyThreadID()].add_cache_hit(hit);
 #endif
   return;
 }
 
 /*
-  range query, DO NOT support corotine currently
+  range query, each level of nodes / leaves is read with one doorbell batch per MN,
+  and the coroutine yields while the batches are outstanding
 */
 // [from, to)
-void Tree::range_query(const Key &from, const Key &to, std::map<Key, Value> &ret) {
-  thread_local std::vector<ScanContext> survivors;
-  thread_local std::vector<RdmaOpRegion> rs;
-  thread_local std::vector<ScanContext> si;
-  thread_local std::vector<RangeCache> range_cache;
-  thread_local std::set<uint64_t> tokens;
+void Tree::range_query(const Key &from, const Key &to, std::map<Key, Value> &ret, CoroContext *cxt, int coro_id) {
+  thread_local std::vector<ScanContext> coro_survivors[MAX_CORO_NUM];
+  thread_local std::vector<RdmaOpRegion> coro_rs[MAX_CORO_NUM];
+  thread_local std::vector<ScanContext> coro_si[MAX_CORO_NUM];
+  thread_local std::vector<RangeCache> coro_range_cache[MAX_CORO_NUM];
+  thread_local std::set<uint64_t> coro_tokens[MAX_CORO_NUM];
+#ifdef TREE_ENABLE_CACHE
+  EpochGuard epoch_guard(index_cache, dsm->getMyThreadID(), coro_id);
+#endif
+  auto& survivors = coro_survivors[coro_id];
+  auto& rs = coro_rs[coro_id];
+  auto& si = coro_si[coro_id];
+  auto& range_cache = coro_range_cache[coro_id];
+  auto& tokens = coro_tokens[coro_id];
 
   assert(dsm->is_register());
   if (to <= from) return;
@@ -1222,7 +2106,8 @@ void Tree::range_query(const Key &from, const Key &to, std::map<Key, Value> &ret
   range_cache.clear();
   tokens.clear();
 
-  auto range_buffer = (dsm->get_rbuf(0)).get_range_buffer();
+  auto range_buffer = (dsm->get_rbuf(coro_id)).get_range_buffer();
+  auto range_page_cnt = (dsm->get_rbuf(coro_id)).get_range_page_cnt();
   int cnt;
 
   // search local cache
@@ -1238,11 +2123,11 @@ void Tree::range_query(const Key &from, const Key &to, std::map<Key, Value> &ret
   }
   if (range_cache.empty()) {
     int partial_len = longest_common_prefix(from, to - 1, 0);
-    search_entries(from, to - 1, partial_len, survivors, nullptr, 0);
+    search_entries(from, to - 1, partial_len, survivors, cxt, coro_id);
   }
 #else
   int partial_len = longest_common_prefix(from, to - 1, 0);
-  search_entries(from, to - 1, partial_len, survivors, nullptr, 0);
+  search_entries(from, to - 1, partial_len, survivors, cxt, coro_id);
 #endif
 
   int idx = 0;
@@ -1254,16 +2139,21 @@ next_level:
   rs.clear();
   si.clear();
 
-  // 1. batch read the current level of nodes / leaves
+  // 1. batch read the current level of nodes / leaves, as many as the range buffer holds
   cnt = 0;
-  for(auto & s : survivors) {
+  int next = 0;
+  for (; next < (int)survivors.size() && cnt < range_page_cnt; ++ next) {
+    auto& s = survivors[next];
     auto& p = s.e;
+    if (p == InternalEntry::Null()) {  // removed meanwhile
+      continue;
+    }
     auto token = (uint64_t)p.addr();
     if (tokens.find(token) == tokens.end()) {
       RdmaOpRegion r;
       r.source     = (uint64_t)range_buffer + cnt * define::allocationPageSize;
       r.dest       = p.addr();
-      r.size       = p.is_leaf ? std::max((unsigned long)p.kv_len, sizeof(Leaf)) : (
+      r.size       = p.is_leaf ? p.leaf_size() : (
                               s.from_cache ?  // TODO: art
                               (sizeof(GlobalAddress) + sizeof(Header) + node_type_to_num(NODE_256) * sizeof(InternalEntry)) :
                               (sizeof(GlobalAddress) + sizeof(Header) + node_type_to_num(p.type()) * sizeof(InternalEntry))
@@ -1275,11 +2165,11 @@ next_level:
       tokens.insert(token);
     }
   }
-  survivors.clear();
+  survivors.erase(survivors.begin(), survivors.begin() + next);  // the rest are read in the next round
   // printf("cnt=%d\n", cnt);
 
   // 2. separate requests with its target node, and read them using doorbell batching for each batch
-  dsm->read_batches_sync(rs);
+  dsm->read_batches_sync(rs, cxt, coro_id);
 
   // 3. process the read nodes and leaves
   for (int i = 0; i < cnt; ++ i) {
@@ -1296,8 +2186,8 @@ next_level:
         }
 #endif
         // re-read leaf entry
-        auto entry_buffer = (dsm->get_rbuf(0)).get_entry_buffer();
-        dsm->read_sync((char *)entry_buffer, si[i].e_ptr, sizeof(InternalEntry));
+        auto entry_buffer = (dsm->get_rbuf(coro_id)).get_entry_buffer();
+        dsm->read_sync((char *)entry_buffer, si[i].e_ptr, sizeof(InternalEntry), cxt);
         si[i].e = *(InternalEntry *)entry_buffer;
         si[i].from_cache = false;
         survivors.push_back(si[i]);
@@ -1323,8 +2213,8 @@ next_level:
         }
 #endif
         // re-read node entry
-        auto entry_buffer = (dsm->get_rbuf(0)).get_entry_buffer();
-        dsm->read_sync((char *)entry_buffer, si[i].e_ptr, sizeof(InternalEntry));
+        auto entry_buffer = (dsm->get_rbuf(coro_id)).get_entry_buffer();
+        dsm->read_sync((char *)entry_buffer, si[i].e_ptr, sizeof(InternalEntry), cxt);
         si[i].e = *(InternalEntry *)entry_buffer;
         si[i].from_cache = false;
         survivors.push_back(si[i]);
@@ -1339,6 +2229,405 @@ next_level:
 }
 
 
+/*
+  ordered scan, emits at most `limit` kvs with key >= from in key order and returns the number emitted;
+  a paginated scan resumes with from = (last emitted key + 1).
+  Each round only reads the leftmost unresolved entries expected to hold the next (limit - emitted) kvs,
+  so no more RDMA reads are issued once the limit is met.
+*/
+int Tree::scan(const Key &from, int limit, const ScanFunc &func, CoroContext *cxt, int coro_id) {
+  thread_local std::deque<ScanItem> coro_frontier[MAX_CORO_NUM];
+  thread_local std::deque<ScanItem> coro_next_frontier[MAX_CORO_NUM];
+  thread_local std::vector<RdmaOpRegion> coro_rs[MAX_CORO_NUM];
+  thread_local std::vector<ScanContext> coro_children[MAX_CORO_NUM];
+#ifdef TREE_ENABLE_CACHE
+  EpochGuard epoch_guard(index_cache, dsm->getMyThreadID(), coro_id);
+#endif
+  auto& frontier = coro_frontier[coro_id];
+  auto& next_frontier = coro_next_frontier[coro_id];
+  auto& rs = coro_rs[coro_id];
+  auto& children = coro_children[coro_id];
+
+  assert(dsm->is_register());
+  if (limit <= 0) return 0;
+
+  auto range_buffer = (dsm->get_rbuf(coro_id)).get_range_buffer();
+  auto range_page_cnt = (dsm->get_rbuf(coro_id)).get_range_page_cnt();
+  const Key max_key = get_rightmost(from, 0);
+  Key cur_from = from;
+  Key last_key;
+  Key upper;  // the rightmost key of the subtree being scanned
+  int emitted = 0;
+  bool use_cache = true;
+
+next_subtree:
+  frontier.clear();
+  // start from the cached entry covering cur_from, or from the root
+#ifdef TREE_ENABLE_CACHE
+  {
+    volatile CacheEntry** entry_ptr_ptr = nullptr;
+    CacheEntry* entry_ptr = nullptr;
+    int entry_idx = -1;
+    if (use_cache && index_cache->search_from_cache(cur_from, entry_ptr_ptr, entry_ptr, entry_idx)) {
+      assert(entry_idx >= 0);
+      int depth = entry_ptr->depth;
+      const auto& e = entry_ptr->records[entry_idx];
+      if (!e.is_leaf) {
+        upper = get_rightmost(cur_from, depth);
+        frontier.push_back(ScanItem(ScanContext(e, GADD(entry_ptr->addr, sizeof(InternalEntry) * entry_idx), depth, true,
+                                                entry_ptr_ptr, entry_ptr, cur_from, upper, BORDER, INSIDE)));
+      }
+      else {  // start from the cached node itself rather than from a single leaf, its parent entry is unknown
+        upper = get_rightmost(cur_from, depth - 1);
+        auto page_addr = GADD(entry_ptr->addr, -(int)(sizeof(GlobalAddress) + sizeof(Header)));
+        frontier.push_back(ScanItem(ScanContext(InternalEntry(get_partial(cur_from, depth - 1), NODE_256, page_addr), GlobalAddress::Null(), depth - 1, false,
+                                                nullptr, nullptr, cur_from, upper, BORDER, INSIDE)));
+      }
+    }
+  }
+#endif
+  if (frontier.empty()) {
+    upper = max_key;
+    frontier.push_back(ScanItem(ScanContext(get_root_ptr(cxt, coro_id), root_ptr_ptr, 0, false, nullptr, nullptr, cur_from, upper, BORDER, INSIDE)));
+  }
+  use_cache = true;
+
+  while (true) {
+    // 1. emit the resolved prefix of the frontier
+    while (!frontier.empty() && frontier.front().resolved) {
+      last_key = frontier.front().k;
+      func(last_key, frontier.front().v);
+      frontier.pop_front();
+      if (++ emitted >= limit) return emitted;
+    }
+    if (frontier.empty()) {  // subtree exhausted, go on right after it
+      if (upper == max_key) return emitted;
+      cur_from = upper + 1;
+      goto next_subtree;
+    }
+
+    // 2. batch read the unresolved entries that may hold the next (limit - emitted) kvs
+    rs.clear();
+    int remain = limit - emitted;
+    for (int i = 0; i < (int)frontier.size() && remain > 0 && (int)rs.size() < range_page_cnt; ++ i) {
+      const auto& s = frontier[i].sc;
+      if (frontier[i].resolved) {
+        remain --;
+        continue;
+      }
+      // a node only grows into type t once the next-smaller type is full, so it is expected to hold more kvs than
+      // that type's capacity; it is no bound, as removes may leave it nearly empty, and an overestimate only
+      // costs one more round
+      remain -= s.e.is_leaf ? 1 : std::max(1, node_type_to_num((NodeType)(s.e.type() - 1)));
+      RdmaOpRegion r;
+      r.source     = (uint64_t)range_buffer + rs.size() * define::allocationPageSize;
+      r.dest       = s.e.addr();
+      r.size       = s.e.is_leaf ? s.e.leaf_size() : (
+                              s.from_cache ?
+                              (sizeof(GlobalAddress) + sizeof(Header) + node_type_to_num(NODE_256) * sizeof(InternalEntry)) :
+                              (sizeof(GlobalAddress) + sizeof(Header) + node_type_to_num(s.e.type()) * sizeof(InternalEntry))
+                          );
+      r.is_on_chip = false;
+      rs.push_back(r);
+    }
+    dsm->read_batches_sync(rs, cxt, coro_id);
+
+    // 3. replace each read entry with its resolved leaf / its children in key order
+    next_frontier.clear();
+    int cnt = 0;
+    for (int i = 0; i < (int)frontier.size(); ++ i) {
+      if (frontier[i].resolved || cnt >= (int)rs.size()) {
+        next_frontier.push_back(frontier[i]);
+        continue;
+      }
+      auto& s = frontier[i].sc;
+      auto buffer = range_buffer + (cnt ++) * define::allocationPageSize;
+      bool is_valid;
+      if (s.e.is_leaf) {
+        Leaf *leaf = (Leaf *)buffer;
+        is_valid = leaf->is_valid(s.e_ptr, s.from_cache);
+        if (is_valid && leaf->is_consistent()) {
+          auto k = leaf->get_key();
+          if (k >= cur_from && k <= upper) {
+            next_frontier.push_back(ScanItem(k, leaf->get_value()));
+          }
+          continue;
+        }
+      }
+      else {
+        InternalPage* node = (InternalPage *)buffer;
+        is_valid = node->is_valid(s.e_ptr, s.depth + 1, s.from_cache);
+        if (is_valid) {
+          children.clear();
+          range_query_on_page(node, s.from_cache, s.depth, s.e_ptr, s.e, s.from, s.to, s.l_state, s.r_state, children);
+          std::sort(children.begin(), children.end(), [](const ScanContext& a, const ScanContext& b) { return a.e.partial < b.e.partial; });
+          for (const auto& c : children) next_frontier.push_back(ScanItem(c));
+          continue;
+        }
+      }
+      // leaf / node deleted || outdated cache entry || unconsistent leaf, re-read its entry
+      bool from_cache = s.from_cache || s.e_ptr == GlobalAddress::Null();
+      if (!is_valid) {
+        if (s.e_ptr != GlobalAddress::Null()) read_scan_entry(s, cxt, coro_id);
+        else s.e = InternalEntry::Null();
+      }
+      if (s.e == InternalEntry::Null()) {
+        if (from_cache) {  // the cached node may have been collapsed by remove(), rescan this subtree from the root
+          if (emitted > 0) cur_from = last_key + 1;
+          use_cache = false;
+          goto next_subtree;
+        }
+        continue;  // removed meanwhile
+      }
+      next_frontier.push_back(frontier[i]);
+    }
+    frontier.swap(next_frontier);
+  }
+}
+
+
+/*
+  bulk load, builds the tree bottom-up from kvs in ascending key order (a duplicate key takes the later value);
+  only an empty tree can be bulk loaded.
+  Nodes are fully packed with their types following the fanouts. Leaves and nodes are laid out in extents of
+  define::kBulkLoadExtentSize in the order they are created, and an extent is written by a single RDMA write
+  once it is filled; the root is published by one cas at the end.
+  Returns false without publishing anything if the keys are out of order, the range buffer cannot stage an
+  extent (too many coroutines) or the tree is not empty.
+*/
+bool Tree::bulk_load(const LoadFunc &next, CoroContext *cxt, int coro_id) {
+  assert(dsm->is_register());
+#ifdef TREE_ENABLE_CACHE
+  EpochGuard epoch_guard(index_cache, dsm->getMyThreadID(), coro_id);
+#endif
+  if ((dsm->get_rbuf(coro_id)).get_range_buffer_size() < (int64_t)define::kBulkLoadExtentSize * 3 / 2) {
+    return false;
+  }
+  if (get_root_ptr(cxt, coro_id) != InternalEntry::Null()) {
+    return false;
+  }
+
+  std::vector<LoadingNode> stack;  // open nodes on the path of the last key
+  std::vector<RdmaOpRegion> rs;
+  auto staging = (dsm->get_rbuf(coro_id)).get_range_buffer();
+  auto late_staging = staging + define::kBulkLoadExtentSize;  // pages closed after their extents are written
+  GlobalAddress extent = GlobalAddress::Null();
+  uint64_t extent_used = 0;
+  int extent_id = 0;
+  std::vector<GlobalAddress> extents;
+  std::vector<std::pair<Key, GlobalAddress>> cached;  // nodes put into the cache
+  InternalEntry root_e;
+
+  auto flush = [&](){
+    if (extent_used > 0) {
+      RdmaOpRegion r;
+      r.source     = (uint64_t)staging;
+      r.dest       = extent;
+      r.size       = extent_used;
+      r.is_on_chip = false;
+      rs.push_back(r);
+    }
+    if (!rs.empty()) {
+      dsm->write_batches_sync(rs.data(), rs.size(), cxt, coro_id);
+    }
+    rs.clear();
+    extent = GlobalAddress::Null();
+    extent_used = 0;
+    extent_id ++;
+  };
+
+  // lay out a block in the current extent
+  auto carve = [&](uint64_t size){
+    size = ROUND_UP(size, ALLOC_ALLIGN_BIT);
+    if (extent == GlobalAddress::Null() || extent_used + size > define::kBulkLoadExtentSize) {
+      if (extent != GlobalAddress::Null()) flush();
+      extent = dsm->alloc(define::kBulkLoadExtentSize);
+      extents.push_back(extent);
+    }
+    auto addr = GADD(extent, extent_used);
+    extent_used += size;
+    return addr;
+  };
+
+  auto stage_page = [&](const GlobalAddress &addr, int id, const InternalPage &page){
+    if (id == extent_id) {
+      memcpy(staging + (addr.offset - extent.offset), &page, define::allocationPageSize);
+      return;
+    }
+    // its extent is written, write it on its own
+    auto buffer = late_staging + rs.size() * define::allocationPageSize;
+    memcpy(buffer, &page, define::allocationPageSize);
+    RdmaOpRegion r;
+    r.source     = (uint64_t)buffer;
+    r.dest       = addr;
+    r.size       = define::allocationPageSize;
+    r.is_on_chip = false;
+    rs.push_back(r);
+    if ((int)rs.size() == kWriteOroMax - 1) flush();
+  };
+
+  auto write_leaf = [&](const Key &k, Value v, const GlobalAddress &rev_ptr, uint8_t partial){
+#ifndef TREE_ENABLE_VAR_LEN_VALUE
+    auto leaf_addr = carve(Leaf::size_of(k, v));
+    new (staging + (leaf_addr.offset - extent.offset)) Leaf(k, v, rev_ptr);
+    return InternalEntry(partial, InternalEntry::leaf_kv_len(Leaf::size_of(k, v)), leaf_addr);
+#else
+    Value desc = ValueDesc(sizeof(Value), GlobalAddress::Null());  // 8B values are kept inline
+    auto leaf_addr = carve(Leaf::size_of(k, desc));
+    new (staging + (leaf_addr.offset - extent.offset)) Leaf(k, desc, rev_ptr, (const char *)&v);
+    return InternalEntry(partial, InternalEntry::leaf_kv_len(Leaf::size_of(k, desc)), leaf_addr);
+#endif
+  };
+
+  // close a node under the parent at parent_pos, a partial longer than define::hPartialLenMax is split into
+  // a chain of single-child nodes as in out_of_place_write_node
+  auto close_node = [&](LoadingNode &n, int parent_pos, GlobalAddress rev_ptr){
+    InternalEntry head;
+    InternalPage chain_page;
+    GlobalAddress chain_addr = GlobalAddress::Null();
+    int chain_id = 0;
+    auto link = [&](const InternalEntry &e){
+      if (chain_addr == GlobalAddress::Null()) head = e;
+      else {
+        chain_page.records[0] = e;
+        stage_page(chain_addr, chain_id, chain_page);
+      }
+    };
+
+    int depth = parent_pos + 1;
+    int partial_len = n.pos - depth;
+    while (partial_len > (int)define::hPartialLenMax) {
+      auto addr = carve(define::allocationPageSize);
+      link(InternalEntry(get_partial(n.k, depth - 1), num_to_node_type(1), addr));
+      new (&chain_page) InternalPage(n.k, define::hPartialLenMax, depth, num_to_node_type(1), rev_ptr);
+      chain_addr = addr;
+      chain_id = extent_id;
+      rev_ptr = GADD(addr, sizeof(GlobalAddress) + sizeof(Header));
+      depth += define::hPartialLenMax + 1;
+      partial_len -= define::hPartialLenMax + 1;
+    }
+    auto type = num_to_node_type(std::max(n.cnt - 1, 1));
+    link(InternalEntry(get_partial(n.k, depth - 1), type, n.addr));
+    n.page.rev_ptr = rev_ptr;
+    n.page.hdr = Header(n.k, partial_len, depth, type);
+    stage_page(n.addr, n.extent_id, n.page);
+#ifdef TREE_ENABLE_CACHE
+    if (depth <= define::kBulkLoadCacheDepth) {
+      index_cache->add_to_cache(n.k, &n.page, GADD(n.addr, sizeof(GlobalAddress) + sizeof(Header)));
+      cached.emplace_back(n.k, GADD(n.addr, sizeof(GlobalAddress) + sizeof(Header)));
+    }
+#endif
+    return head;
+  };
+
+  // nothing is published, drop the cached nodes (deeper ones first, as they were closed) and retire the extents
+  auto abort = [&](){
+#ifdef TREE_ENABLE_CACHE
+    for (const auto& c : cached) {
+      volatile CacheEntry** entry_ptr_ptr = nullptr;
+      CacheEntry* entry_ptr = nullptr;
+      int entry_idx = -1;
+      if (index_cache->search_from_cache(c.first, entry_ptr_ptr, entry_ptr, entry_idx) && entry_ptr->addr == c.second) {
+        index_cache->invalidate(entry_ptr_ptr, entry_ptr);
+      }
+    }
+#endif
+    for (const auto& addr : extents) {
+      reclaim_later(addr, define::kBulkLoadExtentSize);
+    }
+    return false;
+  };
+
+  // add a closed child to a node, or to the root pointer (nullptr)
+  auto add_child = [&](LoadingNode *parent, const std::function<InternalEntry (int, const GlobalAddress&)>& make_entry){
+    if (parent == nullptr) {
+      root_e = make_entry(0, root_ptr_ptr);
+      return;
+    }
+    auto e_ptr = GADD(parent->addr, sizeof(GlobalAddress) + sizeof(Header) + parent->cnt * sizeof(InternalEntry));
+    parent->page.records[parent->cnt ++] = make_entry(parent->pos, e_ptr);
+  };
+
+  Key k, prev;
+  Value v, prev_v;
+  bool has_prev = false;
+  while (true) {
+    bool end = !next(k, v);
+    if (!end && has_prev && k == prev) {
+      prev_v = v;
+      continue;
+    }
+    if (!has_prev) {
+      if (end) return true;  // nothing to load
+      prev = k;
+      prev_v = v;
+      has_prev = true;
+      continue;
+    }
+    if (!end && k < prev) {
+      return abort();
+    }
+
+    // 1. the nodes deeper than where k parts from prev are closed, k joins the node at that depth or a new one
+    int pos = end ? 0 : longest_common_prefix(prev, k, 1) + 1;
+    int top = stack.size();
+    while (top > 0 && stack[top - 1].pos > pos) top --;
+    bool new_node = !end && (top == 0 || stack[top - 1].pos < pos);
+    LoadingNode *target = nullptr;  // the root pointer at the end
+    if (new_node) {
+      auto addr = carve(define::allocationPageSize);
+      target = new LoadingNode(addr, pos, extent_id, prev);
+    }
+    else if (!end) {
+      target = &stack[top - 1];
+    }
+
+    // 2. close the leaf of prev and the nodes bottom-up
+    auto leaf_parent = (int)stack.size() > top ? &stack.back() : target;
+    add_child(leaf_parent, [&](int parent_pos, const GlobalAddress &e_ptr){
+      return write_leaf(prev, prev_v, e_ptr, get_partial(prev, parent_pos));
+    });
+    while ((int)stack.size() > top) {
+      auto parent = (int)stack.size() - 1 > top ? &stack[stack.size() - 2] : target;
+      add_child(parent, [&](int parent_pos, const GlobalAddress &e_ptr){
+        return close_node(stack.back(), parent_pos, e_ptr);
+      });
+      stack.pop_back();
+    }
+    if (new_node) {
+      stack.push_back(*target);
+      delete target;
+    }
+
+    if (end) break;
+    prev = k;
+    prev_v = v;
+  }
+  flush();
+
+  // publish the root
+  auto cas_buffer = (dsm->get_rbuf(coro_id)).get_cas_buffer();
+  if (!dsm->cas_sync(root_ptr_ptr, (uint64_t)InternalEntry::Null(), (uint64_t)root_e, cas_buffer, cxt)) {
+    return abort();
+  }
+  return true;
+}
+
+
+void Tree::read_scan_entry(ScanContext &s, CoroContext *cxt, int coro_id) {
+#ifdef TREE_ENABLE_CACHE
+  // invalidate the old entry cache
+  if (s.from_cache) {
+    index_cache->invalidate(s.entry_ptr_ptr, s.entry_ptr);
+  }
+#endif
+  auto entry_buffer = (dsm->get_rbuf(coro_id)).get_entry_buffer();
+  dsm->read_sync((char *)entry_buffer, s.e_ptr, sizeof(InternalEntry), cxt);
+  s.e = *(InternalEntry *)entry_buffer;
+  s.from_cache = false;
+}
+
+
 void Tree::range_query_on_page(InternalPage* page, bool from_cache, int depth,
                                GlobalAddress p_ptr, InternalEntry p,
                                const Key &from, const Key &to, State l_state, State r_state,
@@ -1414,12 +2703,83 @@ void Tree::run_coroutine(GenFunc gen_func, WorkFunc work_func, int coro_cnt, Req
   assert(coro_cnt <= MAX_CORO_NUM);
   for (int i = 0; i < coro_cnt; ++i) {
     RequstGen *gen = gen_func(dsm, req, req_num, i, coro_cnt);
-    worker[i] = CoroCall(std::bind(&Tree::coro_worker, this, _1, gen, work_func, i));
+    worker[i] = CoroCall(std::bind(&Tree::coro_worker, this, _1, gen, work_func, i),
+                         boost::coroutines::attributes(define::kCoroStackSize), CoroStackPool());
   }
+  run_master(coro_cnt);
+}
+
 
-  master = CoroCall(std::bind(&Tree::coro_master, this, _1, coro_cnt));
+void Tree::run_async(int coro_cnt) {
+  using namespace std::placeholders;
+
+  assert(coro_cnt <= MAX_CORO_NUM);
+  for (int i = 0; i < coro_cnt; ++i) {
+    worker[i] = CoroCall(std::bind(&Tree::async_worker, this, _1, i),
+                         boost::coroutines::attributes(define::kCoroStackSize), CoroStackPool());
+  }
+  auto thread_id = dsm->getMyThreadID();
+  {
+    std::lock_guard<std::mutex> guard(async_server_lock);
+    async_serving[thread_id] = true;
+    async_servers[async_server_cnt] = thread_id;
+    async_server_cnt ++;
+    for (auto req : async_pending) async_queues[thread_id].push(req);
+    async_pending.clear();
+  }
+
+  run_master(coro_cnt);
+
+  // requests interrupted by need_stop fail, the queued ones go to the other threads in run_async(), or fail if there are none
+  std::vector<AsyncRequest *> failed;
+  for (int i = 0; i < coro_cnt; ++i) if (!(coro_idle & (1ULL << i))) {
+    failed.push_back(coro_async_req[i]);
+  }
+  {
+    std::lock_guard<std::mutex> guard(async_server_lock);
+    int cnt = async_server_cnt;
+    for (int i = 0; i < cnt; ++i) if (async_servers[i] == thread_id) {
+      async_servers[i] = async_servers[cnt - 1].load();
+      async_server_cnt --;
+      break;
+    }
+    async_serving[thread_id] = false;
+    while (async_submitting[thread_id]) ;  // the submitters that saw it serving push before leaving
+    AsyncRequest *req;
+    for (int i = 0; async_queues[thread_id].try_pop(req); ++i) {
+      if (async_server_cnt) async_queues[async_servers[i % async_server_cnt]].push(req);
+      else failed.push_back(req);
+    }
+    if (!async_server_cnt) {
+      failed.insert(failed.end(), async_pending.begin(), async_pending.end());
+      async_pending.clear();
+    }
+  }
+  for (auto req : failed) {
+    req->ret = false;
+    req->kvs.clear();
+    req->done(req);
+    delete req;
+  }
+}
+
+
+void Tree::run_master(int coro_cnt) {
+  using namespace std::placeholders;
+
+  for (int i = 0; i < coro_cnt; ++i) {
+    coro_waker[i].ready = &coro_ready;
+    coro_waker[i].coro_id = i;
+  }
+  coro_ready = 0;
+  coro_idle = 0;
+  dsm->carveRdmaBuffer(coro_cnt);
+
+  master = CoroCall(std::bind(&Tree::coro_master, this, _1, coro_cnt),
+                    boost::coroutines::attributes(define::kCoroStackSize), CoroStackPool());
 
   master();
+  dsm->carveRdmaBuffer(1);
 }
 
 
@@ -1428,6 +2788,7 @@ void Tree::coro_worker(CoroYield &yield, RequstGen *gen, WorkFunc work_func, int
   ctx.coro_id = coro_id;
   ctx.master = &master;
   ctx.yield = &yield;
+  ctx.waker = &coro_waker[coro_id];
 
   Timer coro_timer;
   auto thread_id = dsm->getMyThreadID();
@@ -1435,71 +2796,182 @@ void Tree::coro_worker(CoroYield &yield, RequstGen *gen, WorkFunc work_func, int
   while (!need_stop) {
     auto r = gen->next();
 
+    while (r.start_ns && Timer::get_time_ns() < r.start_ns && !need_stop) {  // not due yet, check again in the next round of the master
+      ctx.waker->wake();
+      yield(master);
+    }
     coro_timer.begin();
     work_func(this, r, &ctx, coro_id);
-    auto us_10 = coro_timer.end() / 100;
+    latency[thread_id][r.type()].record(r.start_ns ? Timer::get_time_ns() - r.start_ns : coro_timer.end());
+  }
+}
 
-    if (us_10 >= LATENCY_WINDOWS) {
-      us_10 = LATENCY_WINDOWS - 1;
+
+void Tree::async_worker(CoroYield &yield, int coro_id) {
+  CoroContext ctx;
+  ctx.coro_id = coro_id;
+  ctx.master = &master;
+  ctx.yield = &yield;
+  ctx.waker = &coro_waker[coro_id];
+
+  while (true) {
+    coro_idle |= 1ULL << coro_id;
+    yield(master);
+
+    auto req = coro_async_req[coro_id];
+    switch (req->op) {
+      case ASYNC_SEARCH:
+        req->ret = search(req->k, req->v, &ctx, coro_id);
+        break;
+      case ASYNC_INSERT:
+        insert(req->k, req->v, &ctx, coro_id, req->is_update);
+        break;
+      case ASYNC_REMOVE:
+        req->ret = remove(req->k, &ctx, coro_id);
+        break;
+      case ASYNC_SCAN:
+        scan(req->k, req->limit, [req](const Key& k, Value v) { req->kvs.emplace_back(k, v); }, &ctx, coro_id);
+        break;
     }
-    latency[thread_id][coro_id][us_10]++;
+    req->done(req);
+    delete req;
   }
 }
 
 
 void Tree::coro_master(CoroYield &yield, int coro_cnt) {
+  auto& async_queue = async_queues[dsm->getMyThreadID()];
   for (int i = 0; i < coro_cnt; ++i) {
     yield(worker[i]);
   }
   while (!need_stop) {
-    uint64_t next_coro_id;
-
-    if (dsm->poll_rdma_cq_once(next_coro_id)) {
-      yield(worker[next_coro_id]);
+    uint64_t wr_ids[POLL_CQ_MAX_CNT_ONCE];
+    int cnt = dsm->poll_rdma_cq_batch_once(wr_ids, POLL_CQ_MAX_CNT_ONCE);
+    for (int i = 0; i < cnt; ++ i) {
+      yield(worker[wr_ids[i]]);
     }
-    // uint64_t wr_ids[POLL_CQ_MAX_CNT_ONCE];
-    // int cnt = dsm->poll_rdma_cq_batch_once(wr_ids, POLL_CQ_MAX_CNT_ONCE);
-    // for (int i = 0; i < cnt; ++ i) {
-    //   yield(worker[wr_ids[i]]);
-    // }
-
-    if (!busy_waiting_queue.empty()) {
-    // int cnt = busy_waiting_queue.size();
-    // while (cnt --) {
-      auto next = busy_waiting_queue.front();
-      busy_waiting_queue.pop();
-      next_coro_id = next.first;
-      if (next.second()) {
+
+    // coroutines woken up by local lock releases
+    if (coro_ready.load(std::memory_order_relaxed)) {
+      auto ready = coro_ready.exchange(0);
+      while (ready) {
+        auto next_coro_id = __builtin_ctzll(ready);
+        ready &= ready - 1;
         yield(worker[next_coro_id]);
       }
-      else {
-        busy_waiting_queue.push(next);
-      }
+    }
+
+    // submitted requests, handed over to the idle coroutines of run_async()
+    AsyncRequest *req = nullptr;
+    while (coro_idle && async_queue.try_pop(req)) {
+      auto next_coro_id = __builtin_ctzll(coro_idle);
+      coro_idle &= coro_idle - 1;
+      coro_async_req[next_coro_id] = req;
+      yield(worker[next_coro_id]);
     }
   }
 }
 
 
+void Tree::submit(AsyncRequest *req) {
+  thread_local uint32_t next_server = 0;
+  int cnt = async_server_cnt;
+  if (cnt) {  // the server picked from a stale list may be leaving, it takes the request only if still serving
+    int thread_id = async_servers[(next_server ++) % cnt];
+    async_submitting[thread_id] ++;
+    bool serving = async_serving[thread_id];
+    if (serving) async_queues[thread_id].push(req);
+    async_submitting[thread_id] --;
+    if (serving) return;
+  }
+  std::lock_guard<std::mutex> guard(async_server_lock);
+  if (async_server_cnt) async_queues[async_servers[(next_server ++) % async_server_cnt]].push(req);
+  else async_pending.push_back(req);  // till a thread runs run_async()
+}
+
+
+void Tree::search_async(const Key &k, SearchCallback cb) {
+  auto req = new AsyncRequest{ASYNC_SEARCH, k, kValueNull, false, 0, false, {}, nullptr};
+  req->done = [cb](AsyncRequest *r) { cb(r->ret, r->v); };
+  submit(req);
+}
+
+
+void Tree::insert_async(const Key &k, Value v, bool is_update, InsertCallback cb) {
+  auto req = new AsyncRequest{ASYNC_INSERT, k, v, is_update, 0, false, {}, nullptr};
+  req->done = [cb](AsyncRequest *) { cb(); };
+  submit(req);
+}
+
+
+void Tree::remove_async(const Key &k, RemoveCallback cb) {
+  auto req = new AsyncRequest{ASYNC_REMOVE, k, kValueNull, false, 0, false, {}, nullptr};
+  req->done = [cb](AsyncRequest *r) { cb(r->ret); };
+  submit(req);
+}
+
+
+void Tree::scan_async(const Key &from, int limit, ScanCallback cb) {
+  auto req = new AsyncRequest{ASYNC_SCAN, from, kValueNull, false, limit, false, {}, nullptr};
+  req->done = [cb](AsyncRequest *r) { cb(r->kvs); };
+  submit(req);
+}
+
+
+std::future<std::pair<bool, Value> > Tree::search_async(const Key &k) {
+  auto p = std::make_shared<std::promise<std::pair<bool, Value> > >();
+  auto f = p->get_future();
+  search_async(k, [p](bool found, Value v) { p->set_value(std::make_pair(found, v)); });
+  return f;
+}
+
+
+std::future<void> Tree::insert_async(const Key &k, Value v, bool is_update) {
+  auto p = std::make_shared<std::promise<void> >();
+  auto f = p->get_future();
+  insert_async(k, v, is_update, [p]() { p->set_value(); });
+  return f;
+}
+
+
+std::future<bool> Tree::remove_async(const Key &k) {
+  auto p = std::make_shared<std::promise<bool> >();
+  auto f = p->get_future();
+  remove_async(k, [p](bool removed) { p->set_value(removed); });
+  return f;
+}
+
+
+std::future<std::vector<std::pair<Key, Value> > > Tree::scan_async(const Key &from, int limit) {
+  auto p = std::make_shared<std::promise<std::vector<std::pair<Key, Value> > > >();
+  auto f = p->get_future();
+  scan_async(from, limit, [p](std::vector<std::pair<Key, Value> >& kvs) { p->set_value(std::move(kvs)); });
+  return f;
+}
+
+
 void Tree::statistics() {
 #ifdef TREE_ENABLE_CACHE
   index_cache->statistics();
 #endif
 }
 
-void Tree::clear_debug_info() {
-  memset(cache_miss, 0, sizeof(uint64_t) * MAX_APP_THREAD);
-  memset(cache_hit, 0, sizeof(uint64_t) * MAX_APP_THREAD);
-  memset(lock_fail, 0, sizeof(uint64_t) * MAX_APP_THREAD);
-  // memset(try_lock, 0, sizeof(uint64_t) * MAX_APP_THREAD);
-  memset(write_handover_num, 0, sizeof(uint64_t) * MAX_APP_THREAD);
-  memset(try_write_op, 0, sizeof(uint64_t) * MAX_APP_THREAD);
-  memset(read_handover_num, 0, sizeof(uint64_t) * MAX_APP_THREAD);
-  memset(try_read_op, 0, sizeof(uint64_t) * MAX_APP_THREAD);
-  memset(read_leaf_retry, 0, sizeof(uint64_t) * MAX_APP_THREAD);
-  memset(leaf_cache_invalid, 0, sizeof(uint64_t) * MAX_APP_THREAD);
-  memset(try_read_leaf, 0, sizeof(uint64_t) * MAX_APP_THREAD);
-  memset(read_node_repair, 0, sizeof(uint64_t) * MAX_APP_THREAD);
-  memset(try_read_node, 0, sizeof(uint64_t) * MAX_APP_THREAD);
-  memset(read_node_type, 0, sizeof(uint64_t) * MAX_APP_THREAD * MAX_NODE_TYPE_NUM);
-  memset(retry_cnt, 0, sizeof(uint64_t) * MAX_APP_THREAD * MAX_FLAG_NUM);
+bool Tree::dump_cache(const std::string& path) {
+#ifdef TREE_ENABLE_CACHE
+  EpochGuard epoch_guard(index_cache, dsm->getMyThreadID(), 0);
+  return index_cache->dump(path);
+#else
+  UNUSED(path);
+  return false;
+#endif
+}
+
+bool Tree::load_cache(const std::string& path) {
+#ifdef TREE_ENABLE_CACHE
+  EpochGuard epoch_guard(index_cache, dsm->getMyThreadID(), 0);
+  return index_cache->load(path);
+#else
+  UNUSED(path);
+  return false;
+#endif
 }
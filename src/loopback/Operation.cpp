@@ -0,0 +1,216 @@
+#include "Loopback.h"
+
+// All "remote" addresses are plain pointers into the memfd regions of
+// LoopbackDirectory, so every verb completes before it returns.
+
+static inline LoopbackCQ *toLoopbackCQ(ibv_cq *cq) {
+  return (LoopbackCQ *)cq->cq_context;
+}
+
+static inline void complete(ibv_qp *qp, bool signal, uint64_t wrID) {
+  if (!signal) {
+    return;
+  }
+  auto lcq = toLoopbackCQ(qp->send_cq);
+  assert(lcq->tail - lcq->head < (uint32_t)kLoopbackCQDepth);
+  lcq->wr_ids[lcq->tail++ % kLoopbackCQDepth] = wrID;
+}
+
+static inline uint64_t atomicCas(uint64_t dest, uint64_t compare,
+                                 uint64_t swap) {
+  __atomic_compare_exchange_n((uint64_t *)dest, &compare, swap, false,
+                              __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+  return compare;  // holds the old value either way
+}
+
+// ext masked cmp_swap with compare_mask == swap_mask == mask
+static inline uint64_t atomicCasMask(uint64_t dest, uint64_t compare,
+                                     uint64_t swap, uint64_t mask) {
+  auto p = (uint64_t *)dest;
+  uint64_t old = __atomic_load_n(p, __ATOMIC_SEQ_CST);
+  while ((old & mask) == (compare & mask)) {
+    uint64_t val = (old & ~mask) | (swap & mask);
+    if (__atomic_compare_exchange_n(p, &old, val, false, __ATOMIC_SEQ_CST,
+                                    __ATOMIC_SEQ_CST)) {
+      break;
+    }
+  }
+  return old;
+}
+
+// ext masked fetch_add: each set bit of field_boundary ends a field, and carries
+// never cross into the next field
+static inline uint64_t atomicFaaBoundary(uint64_t dest, uint64_t add,
+                                         uint64_t field_boundary) {
+  auto p = (uint64_t *)dest;
+  uint64_t old = __atomic_load_n(p, __ATOMIC_SEQ_CST);
+  uint64_t val;
+  do {
+    val = 0;
+    int start = 0;
+    for (int i = 0; i < 64; ++i) {
+      if (i == 63 || (field_boundary & (1ull << i))) {
+        uint64_t m = (i - start == 63) ? ~0ull : (((1ull << (i - start + 1)) - 1) << start);
+        val |= ((old & m) + (add & m)) & m;
+        start = i + 1;
+      }
+    }
+  } while (!__atomic_compare_exchange_n(p, &old, val, false, __ATOMIC_SEQ_CST,
+                                        __ATOMIC_SEQ_CST));
+  return old;
+}
+
+int pollWithCQ(ibv_cq *cq, int pollNumber, struct ibv_wc *wc) {
+  auto lcq = toLoopbackCQ(cq);
+  int count = 0;
+
+  while (count < pollNumber) {
+    if (lcq->head == lcq->tail) {
+      Debug::notifyError("Poll Completion failed: no outstanding work request.");
+      return -1;
+    }
+    wc->wr_id = lcq->wr_ids[lcq->head++ % kLoopbackCQDepth];
+    wc->status = IBV_WC_SUCCESS;
+    ++count;
+  }
+  return count;
+}
+
+int pollOnce(ibv_cq *cq, int pollNumber, struct ibv_wc *wc) {
+  auto lcq = toLoopbackCQ(cq);
+  int count = 0;
+
+  while (count < pollNumber && lcq->head != lcq->tail) {
+    wc[count].wr_id = lcq->wr_ids[lcq->head++ % kLoopbackCQDepth];
+    wc[count].status = IBV_WC_SUCCESS;
+    ++count;
+  }
+  return count;
+}
+
+bool rdmaRead(ibv_qp *qp, uint64_t source, uint64_t dest, uint64_t size,
+              uint32_t lkey, uint32_t remoteRKey, bool signal, uint64_t wrID) {
+  memcpy((void *)source, (void *)dest, size);
+  complete(qp, signal, wrID);
+  return true;
+}
+
+bool rdmaWrite(ibv_qp *qp, uint64_t source, uint64_t dest, uint64_t size,
+               uint32_t lkey, uint32_t remoteRKey, int32_t imm, bool isSignaled,
+               uint64_t wrID) {
+  memcpy((void *)dest, (void *)source, size);
+  complete(qp, isSignaled, wrID);
+  return true;
+}
+
+bool rdmaFetchAndAddBoundary(ibv_qp *qp, uint64_t source, uint64_t dest,
+                             uint64_t add, uint32_t lkey, uint32_t remoteRKey,
+                             uint64_t boundary, bool singal, uint64_t wr_id) {
+  *(uint64_t *)source = atomicFaaBoundary(dest, add, 1ull << boundary);
+  complete(qp, singal, wr_id);
+  return true;
+}
+
+bool rdmaCompareAndSwap(ibv_qp *qp, uint64_t source, uint64_t dest,
+                        uint64_t compare, uint64_t swap, uint32_t lkey,
+                        uint32_t remoteRKey, bool signal, uint64_t wrID) {
+  *(uint64_t *)source = atomicCas(dest, compare, swap);
+  complete(qp, signal, wrID);
+  return true;
+}
+
+bool rdmaCompareAndSwapMask(ibv_qp *qp, uint64_t source, uint64_t dest,
+                            uint64_t compare, uint64_t swap, uint32_t lkey,
+                            uint32_t remoteRKey, uint64_t mask, bool singal,
+                            uint64_t wrID) {
+  *(uint64_t *)source = atomicCasMask(dest, compare, swap, mask);
+  complete(qp, singal, wrID);
+  return true;
+}
+
+bool rdmaWriteBatch(ibv_qp *qp, RdmaOpRegion *ror, int k, bool isSignaled,
+                    uint64_t wrID) {
+  for (int i = 0; i < k; ++i) {
+    memcpy((void *)ror[i].dest, (void *)ror[i].source, ror[i].size);
+  }
+  complete(qp, isSignaled, wrID);
+  return true;
+}
+
+bool rdmaReadBatch(ibv_qp *qp, RdmaOpRegion *ror, int k, bool isSignaled,
+                   uint64_t wrID) {
+  for (int i = 0; i < k; ++i) {
+    memcpy((void *)ror[i].source, (void *)ror[i].dest, ror[i].size);
+  }
+  complete(qp, isSignaled, wrID);
+  return true;
+}
+
+bool rdmaCasRead(ibv_qp *qp, const RdmaOpRegion &cas_ror,
+                 const RdmaOpRegion &read_ror, uint64_t compare, uint64_t swap,
+                 bool isSignaled, uint64_t wrID) {
+  *(uint64_t *)cas_ror.source = atomicCas(cas_ror.dest, compare, swap);
+  memcpy((void *)read_ror.source, (void *)read_ror.dest, read_ror.size);
+  complete(qp, isSignaled, wrID);
+  return true;
+}
+
+bool rdmaReadCas(ibv_qp *qp, const RdmaOpRegion &read_ror,
+                 const RdmaOpRegion &cas_ror, uint64_t compare, uint64_t swap,
+                 bool isSignaled, uint64_t wrID) {
+  memcpy((void *)read_ror.source, (void *)read_ror.dest, read_ror.size);
+  *(uint64_t *)cas_ror.source = atomicCas(cas_ror.dest, compare, swap);
+  complete(qp, isSignaled, wrID);
+  return true;
+}
+
+bool rdmaCasWrite(ibv_qp *qp, const RdmaOpRegion &cas_ror,
+                  const RdmaOpRegion &write_ror, uint64_t compare, uint64_t swap,
+                  bool isSignaled, uint64_t wrID) {
+  *(uint64_t *)cas_ror.source = atomicCas(cas_ror.dest, compare, swap);
+  memcpy((void *)write_ror.dest, (void *)write_ror.source, write_ror.size);
+  complete(qp, isSignaled, wrID);
+  return true;
+}
+
+bool rdmaWriteFaa(ibv_qp *qp, const RdmaOpRegion &write_ror,
+                  const RdmaOpRegion &faa_ror, uint64_t add_val,
+                  bool isSignaled, uint64_t wrID) {
+  memcpy((void *)write_ror.dest, (void *)write_ror.source, write_ror.size);
+  *(uint64_t *)faa_ror.source =
+      __atomic_fetch_add((uint64_t *)faa_ror.dest, add_val, __ATOMIC_SEQ_CST);
+  complete(qp, isSignaled, wrID);
+  return true;
+}
+
+bool rdmaWriteCas(ibv_qp *qp, const RdmaOpRegion &write_ror,
+                  const RdmaOpRegion &cas_ror, uint64_t compare, uint64_t swap,
+                  bool isSignaled, uint64_t wrID) {
+  memcpy((void *)write_ror.dest, (void *)write_ror.source, write_ror.size);
+  *(uint64_t *)cas_ror.source = atomicCas(cas_ror.dest, compare, swap);
+  complete(qp, isSignaled, wrID);
+  return true;
+}
+
+bool rdmaWriteCasMask(ibv_qp *qp, const RdmaOpRegion &write_ror,
+                      const RdmaOpRegion &cas_ror, uint64_t compare,
+                      uint64_t swap, uint64_t mask, bool isSignaled,
+                      uint64_t wrID) {
+  memcpy((void *)write_ror.dest, (void *)write_ror.source, write_ror.size);
+  *(uint64_t *)cas_ror.source = atomicCasMask(cas_ror.dest, compare, swap, mask);
+  complete(qp, isSignaled, wrID);
+  return true;
+}
+
+bool rdmaTwoCasMask(ibv_qp *qp, const RdmaOpRegion &cas_ror_1, uint64_t compare_1,
+                    uint64_t swap_1, uint64_t mask_1,
+                    const RdmaOpRegion &cas_ror_2, uint64_t compare_2,
+                    uint64_t swap_2, uint64_t mask_2, bool isSignaled,
+                    uint64_t wrID) {
+  *(uint64_t *)cas_ror_1.source =
+      atomicCasMask(cas_ror_1.dest, compare_1, swap_1, mask_1);
+  *(uint64_t *)cas_ror_2.source =
+      atomicCasMask(cas_ror_2.dest, compare_2, swap_2, mask_2);
+  complete(qp, isSignaled, wrID);
+  return true;
+}
@@ -0,0 +1,85 @@
+#include "Loopback.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+ibv_cq *createLoopbackCQ() {
+  auto cq = new ibv_cq;
+  memset(cq, 0, sizeof(ibv_cq));
+  cq->cq_context = new LoopbackCQ();
+  cq->cqe = kLoopbackCQDepth;
+  return cq;
+}
+
+ibv_qp *createLoopbackQP(ibv_cq *cq) {
+  auto qp = new ibv_qp;
+  memset(qp, 0, sizeof(ibv_qp));
+  qp->send_cq = cq;
+  qp->recv_cq = cq;
+  qp->qp_type = IBV_QPT_RC;
+  qp->state = IBV_QPS_RTS;
+  return qp;
+}
+
+void *loopbackRegionAlloc(size_t size) {
+  // hugepage backed first, then fall back to normal pages (sparse, so a big
+  // dsmSize only costs what the tree actually touches)
+  for (auto flags : {MFD_CLOEXEC | MFD_HUGETLB, (unsigned int)MFD_CLOEXEC}) {
+    int fd = memfd_create("smart-mn", flags);
+    if (fd < 0) {
+      continue;
+    }
+    if (ftruncate(fd, size) != 0) {
+      close(fd);
+      continue;
+    }
+    void *res = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (res != MAP_FAILED) {
+      return res;
+    }
+  }
+  Debug::notifyError("loopback region mmap failed!");
+  return nullptr;
+}
+
+void loopbackRegionFree(void *addr, size_t size) {
+  if (munmap(addr, size) == -1) {
+    Debug::notifyError("loopback region munmap failed! %d", errno);
+  }
+}
+
+LoopbackDirectory::LoopbackDirectory(RemoteConnection *remoteInfo,
+                                     uint64_t dsmSize, uint16_t nodeID)
+    : dsmSize(dsmSize) {
+  dsmPool = loopbackRegionAlloc(dsmSize);
+  lockPool = loopbackRegionAlloc(define::kLockChipMemSize);
+
+  auto &remote = remoteInfo[nodeID];
+  remote.dsmBase = (uint64_t)dsmPool;
+  remote.lockBase = (uint64_t)lockPool;
+  for (int i = 0; i < NR_DIRECTORY; ++i) {
+    remote.dsmRKey[i] = 0;
+    remote.lockRKey[i] = 0;
+  }
+
+  { // chunck alloctor, same layout as the Directory of dirID 0
+    GlobalAddress dsm_start;
+    dsm_start.nodeID = nodeID;
+    dsm_start.offset = 0;
+    chunckAlloc = new GlobalAllocator(dsm_start, dsmSize / NR_DIRECTORY);
+  }
+}
+
+LoopbackDirectory::~LoopbackDirectory() {
+  delete chunckAlloc;
+  loopbackRegionFree(lockPool, define::kLockChipMemSize);
+  loopbackRegionFree(dsmPool, dsmSize);
+}
+
+GlobalAddress LoopbackDirectory::alloc_chunck() {
+  lock.wLock();
+  auto addr = chunckAlloc->alloc_chunck();
+  lock.wUnlock();
+  return addr;
+}
@@ -32,14 +32,15 @@ int pollOnce(ibv_cq *cq, int pollNumber, struct ibv_wc *wc) {
   if (count <= 0) {
     return 0;
   }
-  if (wc->status != IBV_WC_SUCCESS) {
-    Debug::notifyError("Failed status %s (%d) for wr_id %d",
-                       ibv_wc_status_str(wc->status), wc->status,
-                       (int)wc->wr_id);
-    return -1;
-  } else {
-    return count;
+  for (int i = 0; i < count; ++ i) {
+    if (wc[i].status != IBV_WC_SUCCESS) {
+      Debug::notifyError("Failed status %s (%d) for wr_id %d",
+                         ibv_wc_status_str(wc[i].status), wc[i].status,
+                         (int)wc[i].wr_id);
+      return -1;
+    }
   }
+  return count;
 }
 
 static inline void fillSgeWr(ibv_sge &sg, ibv_send_wr &wr, uint64_t source,
@@ -355,15 +356,10 @@ bool rdmaCompareAndSwapMask(ibv_qp *qp, uint64_t source, uint64_t dest,
 
 bool rdmaReadBatch(ibv_qp *qp, RdmaOpRegion *ror, int k, bool isSignaled,
                    uint64_t wrID) {
-  // For range_query corotine safety
-  // thread_local struct ibv_sge coro_sg[MAX_CORO_NUM][kReadOroMax];
-  // thread_local struct ibv_send_wr coro_wr[MAX_CORO_NUM][kReadOroMax];
-
-  // auto& sg = coro_sg[wrID];
-  // auto& wr = coro_wr[wrID];
-
-  struct ibv_sge sg[kReadOroMax];
-  struct ibv_send_wr wr[kReadOroMax];
+  // For range_query corotine safety: too big for a coroutine stack, and
+  // ibv_post_send copies them before any yield, so one copy per thread is enough
+  thread_local struct ibv_sge sg[kReadOroMax];
+  thread_local struct ibv_send_wr wr[kReadOroMax];
   struct ibv_send_wr *wrBad;
 
   for (int i = 0; i < k; ++i) {
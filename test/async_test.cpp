@@ -0,0 +1,120 @@
+#include "Tree.h"
+#include "Timer.h"
+
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+#include <random>
+
+// Benchmark of the asynchronous API: kClientCount threads without RDMA connections submit uniform searches (and kUpdateRatio% updates),
+// each keeping kWindow requests outstanding, which are served by kServerCount threads with kCoroCnt coroutines each.
+
+extern volatile bool need_stop;
+
+int kNodeCount = 1;
+int kServerCount = 1;
+int kCoroCnt = 8;
+int kClientCount = 1;
+uint64_t kOpNum = 1000000;  // per client
+uint64_t kKeyNum = 1000000;
+int kUpdateRatio = 0;
+int kWindow = 64;
+
+DSM *dsm;
+Tree *tree;
+std::thread servers[MAX_APP_THREAD];
+std::thread clients[MAX_APP_THREAD];
+double tp[MAX_APP_THREAD];
+std::atomic<uint64_t> search_cnt{0}, found_cnt{0};
+
+
+void parse_args(int argc, char *argv[]) {
+  if (argc < 5) {
+    printf("Usage: ./async_test kNodeCount kServerCount kCoroCnt kClientCount [op_num] [update_ratio]\n");
+    exit(-1);
+  }
+  kNodeCount = atoi(argv[1]);
+  kServerCount = atoi(argv[2]);
+  kCoroCnt = atoi(argv[3]);
+  kClientCount = atoi(argv[4]);
+  if (argc > 5) kOpNum = atoll(argv[5]);
+  if (argc > 6) kUpdateRatio = atoi(argv[6]);
+  printf("kNodeCount %d, kServerCount %d, kCoroCnt %d, kClientCount %d, op_num %lu, update_ratio %d\n",
+         kNodeCount, kServerCount, kCoroCnt, kClientCount, kOpNum, kUpdateRatio);
+}
+
+
+void server_run(int id) {
+  bindCore(id);
+  dsm->registerThread();
+  tree->run_async(kCoroCnt);
+}
+
+
+void client_run(int id) {
+  bindCore(kServerCount + id);
+  std::mt19937_64 e(id);
+  std::uniform_int_distribution<uint64_t> u(1, kKeyNum);
+  std::atomic<int> outstanding{0};
+
+  Timer timer;
+  timer.begin();
+  for (uint64_t i = 0; i < kOpNum; ++ i) {
+    while (outstanding.load(std::memory_order_relaxed) >= kWindow);
+    outstanding ++;
+    auto k = int2key(u(e));
+    if ((int)(e() % 100) < kUpdateRatio) {
+      tree->insert_async(k, key2int(k) * 2, true, [&]() { outstanding --; });
+    }
+    else {
+      search_cnt ++;
+      tree->search_async(k, [&](bool found, Value) { found_cnt += found; outstanding --; });
+    }
+  }
+  while (outstanding.load());
+  auto ns = timer.end();
+  tp[id] = kOpNum * 1.0 / ns * 1000;  // Mops
+}
+
+
+int main(int argc, char *argv[]) {
+  parse_args(argc, argv);
+
+  DSMConfig config;
+#ifndef DSM_LOOPBACK
+  assert(kNodeCount >= MEMORY_NODE_NUM);
+#endif
+  config.machineNR = kNodeCount;
+  config.threadNR = kServerCount;
+  dsm = DSM::getInstance(config);
+  dsm->registerThread();
+  tree = new Tree(dsm);
+
+  for (uint64_t i = 1 + dsm->getMyNodeID(); i <= kKeyNum; i += kNodeCount) {
+    tree->insert(int2key(i), i * 2, nullptr, 0, false, true);
+  }
+  dsm->barrier("load");
+
+  for (int i = 0; i < kServerCount; ++ i) {
+    servers[i] = std::thread(server_run, i);
+  }
+  for (int i = 0; i < kClientCount; ++ i) {
+    clients[i] = std::thread(client_run, i);
+  }
+  for (int i = 0; i < kClientCount; ++ i) {
+    clients[i].join();
+  }
+  need_stop = true;
+  for (int i = 0; i < kServerCount; ++ i) {
+    servers[i].join();
+  }
+
+  double all_tp = 0;
+  for (int i = 0; i < kClientCount; ++ i) {
+    all_tp += tp[i];
+  }
+  printf("%d, throughput %.3f Mops (%.3f Mops/server), found rate of searches: %lf\n", dsm->getMyNodeID(),
+         all_tp, all_tp / kServerCount, found_cnt * 1.0 / search_cnt);
+  dsm->barrier("fin");
+  return 0;
+}
@@ -0,0 +1,125 @@
+#include "RadixCache.h"
+#include "zipf.h"
+
+#include <stdlib.h>
+#include <vector>
+#include <algorithm>
+#include <random>
+
+// Hit ratio of RadixCache versus cache size under zipfian YCSB-C. A lookup hits if the cache leads it to the leaf directly,
+// otherwise the nodes below the deepest cached one are read from a simulated tree of kKeyNum random keys and cached.
+
+double zipfan = 0.99;
+uint64_t kKeyNum = 1000000;
+uint64_t kLookupNum = 10000000;
+std::vector<int> kCacheSizes{1, 2, 4, 8, 16, 32};  // MB
+
+struct SimNode {
+  uint64_t first_key;  // index in keys
+  int depth;
+  std::vector<std::pair<uint8_t, bool> > children;  // (partial, is_leaf)
+};
+
+std::vector<Key> keys;
+std::vector<SimNode> nodes;
+std::vector<std::vector<uint32_t> > paths;  // node ids from top to bottom for each key
+
+
+void parse_args(int argc, char *argv[]) {
+  if (argc > 1) zipfan = atof(argv[1]);
+  if (argc > 2) kKeyNum = atoll(argv[2]);
+  if (argc > 3) kLookupNum = atoll(argv[3]);
+  printf("zipfan: %lf, key_num: %lu, lookup_num: %lu\n", zipfan, kKeyNum, kLookupNum);
+}
+
+
+// nodes that a tree built from the sorted keys would have (except the root), i.e., one for each prefix shared by more than one key
+void build_tree() {
+  paths.resize(keys.size());
+  for (int depth = 1; depth < (int)define::keyLen; ++ depth) {
+    bool has_node = false;
+    for (uint64_t l = 0, r; l < keys.size(); l = r) {
+      for (r = l + 1; r < keys.size() && std::equal(keys[l].begin(), keys[l].begin() + depth, keys[r].begin()); ++ r);
+      if (r - l < 2) continue;
+      SimNode node{l, depth + 1, {}};
+      for (auto i = l, j = l; i < r; i = j) {
+        for (j = i + 1; j < r && keys[j][depth] == keys[i][depth]; ++ j);
+        node.children.push_back(std::make_pair(keys[i][depth], j - i == 1));
+      }
+      for (auto i = l; i < r; ++ i) {
+        paths[i].push_back(nodes.size());
+      }
+      nodes.push_back(node);
+      has_node = true;
+    }
+    if (!has_node) break;
+  }
+}
+
+
+void read_node(RadixCache *cache, const Key& k, uint32_t id) {
+  const auto& node = nodes[id];
+  InternalPage page(keys[node.first_key], 0, node.depth, num_to_node_type(node.children.size() - 1), GlobalAddress::Null());
+  for (int i = 0; i < (int)node.children.size(); ++ i) {
+    const auto& c = node.children[i];
+    GlobalAddress addr{0, ((uint64_t)id * 256 + i + 1) << ALLOC_ALLIGN_BIT};
+    page.records[i] = c.second ? InternalEntry(c.first, (uint8_t)(define::allocAlignLeafSize / define::kvLenUnit), addr)
+                               : InternalEntry(c.first, NODE_256, addr);
+  }
+  cache->add_to_cache(k, &page, GlobalAddress{0, ((uint64_t)id + 1) << 20});
+}
+
+
+void run(int cache_size) {
+  auto cache = new RadixCache(cache_size, nullptr);
+  struct zipf_gen_state state;
+  mehcached_zipf_init(&state, keys.size(), zipfan, 2024);
+  std::vector<uint64_t> rank(keys.size());  // scatter the hot keys over the key space
+  for (uint64_t i = 0; i < rank.size(); ++ i) rank[i] = i;
+  std::shuffle(rank.begin(), rank.end(), std::mt19937_64(2024));
+
+  volatile CacheEntry** entry_ptr_ptr = nullptr;
+  CacheEntry* entry_ptr = nullptr;
+  int entry_idx = -1;
+  uint64_t hit = 0, node_read = 0;
+  for (uint64_t i = 0; i < kLookupNum; ++ i) {
+    auto key_idx = rank[mehcached_zipf_next(&state)];
+    const auto& k = keys[key_idx];
+    int cached_depth = 0;
+    if (cache->search_from_cache(k, entry_ptr_ptr, entry_ptr, entry_idx)) {
+      if (entry_ptr->records[entry_idx].is_leaf) {
+        hit ++;
+        continue;
+      }
+      cached_depth = entry_ptr->depth;
+    }
+    for (auto id : paths[key_idx]) {
+      if (nodes[id].depth > cached_depth) {
+        read_node(cache, k, id);
+        node_read ++;
+      }
+    }
+  }
+  printf("cache size: %d MB, hit ratio: %lf, node reads per lookup: %lf\n",
+         cache_size, hit * 1.0 / kLookupNum, node_read * 1.0 / kLookupNum);
+  cache->statistics();
+}
+
+
+int main(int argc, char *argv[]) {
+  parse_args(argc, argv);
+
+  std::mt19937_64 e(2024);
+  for (uint64_t i = 0; i < kKeyNum; ++ i) {
+    keys.push_back(int2key(e()));
+  }
+  std::sort(keys.begin(), keys.end());
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+  build_tree();
+  printf("%lu nodes\n", nodes.size());
+
+  for (auto cache_size : kCacheSizes) {
+    run(cache_size);
+  }
+  return 0;
+}
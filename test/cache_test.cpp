@@ -0,0 +1,138 @@
+#include "RadixCache.h"
+#include "Timer.h"
+
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <random>
+
+// Microbenchmark of RadixCache lookups against a cache populated with the internal nodes of a tree holding kKeyNum random keys.
+
+int kThreadCount = 1;
+uint64_t kKeyNum = 1000000;
+uint64_t kLookupNum = 10000000;  // per thread
+uint64_t kRangeSpan = 1000;  // keys covered by a range lookup
+uint64_t kRangeNum = 100000;
+
+std::vector<Key> keys;
+RadixCache *cache;
+std::thread th[MAX_APP_THREAD];
+double tp[MAX_APP_THREAD];
+uint64_t hit_cnt[MAX_APP_THREAD];
+
+
+void parse_args(int argc, char *argv[]) {
+  if (argc > 1) kThreadCount = atoi(argv[1]);
+  if (argc > 2) kKeyNum = atoll(argv[2]);
+  if (argc > 3) kLookupNum = atoll(argv[3]);
+  if (argc > 4) kRangeSpan = atoll(argv[4]);
+  printf("thread_num: %d, key_num: %lu, lookup_num: %lu, range_span: %lu\n", kThreadCount, kKeyNum, kLookupNum, kRangeSpan);
+}
+
+
+// cache the nodes that a tree built from the sorted keys would have, i.e., one for each prefix shared by more than one key
+uint64_t populate() {
+  uint64_t node_cnt = 0;
+  for (int depth = 1; depth < (int)define::keyLen; ++ depth) {
+    bool has_node = false;
+    for (uint64_t l = 0, r; l < keys.size(); l = r) {
+      for (r = l + 1; r < keys.size() && std::equal(keys[l].begin(), keys[l].begin() + depth, keys[r].begin()); ++ r);
+      if (r - l < 2) continue;
+      // children of the node at hdr.depth = depth + 1
+      std::vector<uint8_t> partials;
+      for (auto i = l; i < r; ++ i) {
+        if (partials.empty() || partials.back() != keys[i][depth]) partials.push_back(keys[i][depth]);
+      }
+      InternalPage page(keys[l], 0, depth + 1, num_to_node_type(partials.size() - 1), GlobalAddress::Null());
+      for (int i = 0; i < (int)partials.size(); ++ i) {
+        page.records[i] = InternalEntry(partials[i], NODE_256, GlobalAddress{0, (node_cnt * 256 + i + 1) << ALLOC_ALLIGN_BIT});
+      }
+      cache->add_to_cache(keys[l], &page, GlobalAddress{0, (++ node_cnt) << 20});
+      has_node = true;
+    }
+    if (!has_node) break;
+  }
+  return node_cnt;
+}
+
+
+void thread_run(int id) {
+  bindCore(id);
+  std::mt19937_64 e(id);
+  std::uniform_int_distribution<uint64_t> u(0, keys.size() - 1);
+
+  volatile CacheEntry** entry_ptr_ptr = nullptr;
+  CacheEntry* entry_ptr = nullptr;
+  int entry_idx = -1;
+  uint64_t hit = 0;
+
+  Timer timer;
+  timer.begin();
+  for (uint64_t i = 0; i < kLookupNum; ++ i) {
+    hit += cache->search_from_cache(keys[u(e)], entry_ptr_ptr, entry_ptr, entry_idx);
+  }
+  auto ns = timer.end();
+  tp[id] = kLookupNum * 1.0 / ns * 1000;  // Mops
+  hit_cnt[id] = hit;
+}
+
+
+int main(int argc, char *argv[]) {
+  parse_args(argc, argv);
+
+  std::mt19937_64 e(2024);
+  for (uint64_t i = 0; i < kKeyNum; ++ i) {
+    keys.push_back(int2key(e()));
+  }
+  std::sort(keys.begin(), keys.end());
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+  cache = new RadixCache(define::kIndexCacheSize, nullptr);
+  auto node_cnt = populate();
+  printf("%lu nodes cached\n", node_cnt);
+  cache->statistics();
+
+  for (int i = 0; i < kThreadCount; ++ i) {
+    th[i] = std::thread(thread_run, i);
+  }
+  for (int i = 0; i < kThreadCount; ++ i) {
+    th[i].join();
+  }
+
+  double all_tp = 0;
+  uint64_t all_hit = 0;
+  for (int i = 0; i < kThreadCount; ++ i) {
+    all_tp += tp[i];
+    all_hit += hit_cnt[i];
+  }
+  printf("lookup throughput: %.3f Mops/thread, %.3f Mops in total, hit rate: %lf\n",
+         all_tp / kThreadCount, all_tp, all_hit * 1.0 / (kLookupNum * kThreadCount));
+
+  // range lookups spanning kRangeSpan keys of the key space, starting at existing keys
+  std::uniform_int_distribution<uint64_t> u(0, keys.size() - 1);
+  std::vector<RangeCache> result;
+  uint64_t record_cnt = 0;
+  Timer timer;
+  timer.begin();
+  for (uint64_t i = 0; i < kRangeNum; ++ i) {
+    const auto& from = keys[u(e)];
+    result.clear();
+    cache->search_range_from_cache(from, int2key(key2int(from) + kRangeSpan), result);
+    record_cnt += result.size();
+  }
+  auto ns = timer.end();
+  printf("range lookup: %.3f us/op, %.1f records/op\n", ns / 1000.0 / kRangeNum, record_cnt * 1.0 / kRangeNum);
+
+  // warm start: a fresh cache loaded from a snapshot of the populated one
+  timer.begin();
+  cache->dump("cache_test.dump");
+  auto dump_ns = timer.end();
+  cache = new RadixCache(define::kIndexCacheSize, nullptr);
+  timer.begin();
+  cache->load("cache_test.dump");
+  auto load_ns = timer.end();
+  thread_run(0);
+  printf("dump: %.3f ms, load: %.3f ms, hit rate after load: %lf\n", dump_ns / 1e6, load_ns / 1e6, hit_cnt[0] * 1.0 / kLookupNum);
+  return 0;
+}
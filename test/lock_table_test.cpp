@@ -0,0 +1,94 @@
+#include "LocalLockTable.h"
+#include "Timer.h"
+
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+#include <random>
+
+// Microbenchmark of LocalLockTable read delegation and write combining, with the threads on
+// distinct keys (uncontended), on one key (hot-key), or on distinct keys hashed to one lock (hash-conflict).
+
+int kThreadCount = 1;
+uint64_t kOpNum = 10000000;  // per thread, half reads and half writes
+
+LocalLockTable *lock_table;
+std::vector<Key> keys;  // of each thread
+std::thread th[MAX_APP_THREAD];
+double tp[MAX_APP_THREAD];
+uint64_t handover_cnt[MAX_APP_THREAD];
+
+
+void parse_args(int argc, char *argv[]) {
+  if (argc > 1) kThreadCount = atoi(argv[1]);
+  if (argc > 2) kOpNum = atoll(argv[2]);
+  printf("thread_num: %d, op_num: %lu\n", kThreadCount, kOpNum);
+}
+
+
+void thread_run(int id) {
+  bindCore(id);
+  const auto& k = keys[id];
+  uint64_t handover = 0;
+
+  Timer timer;
+  timer.begin();
+  for (uint64_t i = 0; i < kOpNum / 2; ++ i) {
+    auto w_ret = lock_table->acquire_local_write_lock(k, i);
+    handover += (w_ret.first && !w_ret.second);
+    lock_table->release_local_write_lock(k, w_ret);
+
+    bool res = true;
+    Value v = i;
+    auto r_ret = lock_table->acquire_local_read_lock(k);
+    handover += (r_ret.first && !r_ret.second);
+    lock_table->release_local_read_lock(k, r_ret, res, v);
+  }
+  auto ns = timer.end();
+  tp[id] = kOpNum * 1.0 / ns * 1000;  // Mops
+  handover_cnt[id] = handover;
+}
+
+
+void run(const char *name) {
+  for (int i = 0; i < kThreadCount; ++ i) {
+    th[i] = std::thread(thread_run, i);
+  }
+  for (int i = 0; i < kThreadCount; ++ i) {
+    th[i].join();
+  }
+  double all_tp = 0;
+  uint64_t all_handover = 0;
+  for (int i = 0; i < kThreadCount; ++ i) {
+    all_tp += tp[i];
+    all_handover += handover_cnt[i];
+  }
+  printf("%s: %.3f Mops/thread, %.3f Mops in total, handover rate: %lf\n",
+         name, all_tp / kThreadCount, all_tp, all_handover * 1.0 / (kOpNum * kThreadCount));
+}
+
+
+int main(int argc, char *argv[]) {
+  parse_args(argc, argv);
+  lock_table = new LocalLockTable();
+  Hash hasher;
+
+  std::mt19937_64 e(2024);
+  keys.clear();
+  for (int i = 0; i < kThreadCount; ++ i) {
+    keys.push_back(int2key(e()));
+  }
+  run("uncontended");
+
+  keys.assign(kThreadCount, int2key(e()));
+  run("hot-key");
+
+  keys.resize(1);
+  auto idx = hasher.get_hashed_lock_index(keys[0]);
+  for (uint64_t i = 1; (int)keys.size() < kThreadCount; ++ i) {
+    auto k = int2key(i);
+    if (k != keys[0] && hasher.get_hashed_lock_index(k) == idx) keys.push_back(k);
+  }
+  run("hash-conflict");
+  return 0;
+}
@@ -0,0 +1,279 @@
+#if !defined(_WORKLOAD_H_)
+#define _WORKLOAD_H_
+
+#include "Tree.h"
+#include "zipf.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <random>
+
+
+/*
+  Binary workloads: a header and fixed-size records, converted once from a YCSB text trace ("OP key [range_size]" per line)
+  and then mmap-ed, so that a run neither parses nor copies the trace
+*/
+enum WorkloadOp : uint8_t {
+  WL_INSERT,
+  WL_READ,
+  WL_UPDATE,
+  WL_DELETE,
+  WL_SCAN,
+};
+
+struct WorkloadRecord {
+  Key k;
+  uint32_t range_size;
+  WorkloadOp op;
+};
+
+struct WorkloadHeader {
+  uint64_t magic;
+  uint32_t key_len;
+  uint32_t record_size;
+  uint64_t record_num;
+};
+constexpr uint64_t kWorkloadMagic = 0x314c575452414d53ull;  // "SMARTWL1"
+
+
+inline Request to_request(const WorkloadRecord &rec) {
+  Request r{};
+  r.is_search = (rec.op == WL_READ);
+  r.is_insert = (rec.op == WL_INSERT);
+  r.is_update = (rec.op == WL_UPDATE);
+  r.is_delete = (rec.op == WL_DELETE);
+  r.k = rec.k;
+  r.range_size = rec.range_size;
+  return r;
+}
+
+
+// writes to path.tmp and renames it to path at close(), so that a binary workload is either complete or missing
+class WorkloadWriter {
+public:
+  WorkloadWriter(const std::string &path) : path(path), out(path + ".tmp", std::ios::binary | std::ios::trunc) {
+    WorkloadHeader hdr{kWorkloadMagic, define::keyLen, sizeof(WorkloadRecord), 0};
+    out.write((char *)&hdr, sizeof(hdr));
+  }
+
+  void append(const WorkloadRecord &rec) {
+    out.write((char *)&rec, sizeof(rec));
+    ++ record_num;
+  }
+
+  bool close() {
+    out.seekp(STRUCT_OFFSET(WorkloadHeader, record_num));
+    out.write((char *)&record_num, sizeof(record_num));
+    out.close();
+    return out.good() && rename((path + ".tmp").c_str(), path.c_str()) == 0;
+  }
+
+private:
+  std::string path;
+  std::ofstream out;
+  uint64_t record_num = 0;
+};
+
+
+class WorkloadFile {
+public:
+  WorkloadFile(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      printf("Error opening workload %s\n", path.c_str());
+      assert(false);
+    }
+    struct stat st;
+    fstat(fd, &st);
+    map_size = st.st_size;
+    addr = (char *)mmap(nullptr, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    auto hdr = (const WorkloadHeader *)addr;
+    if (addr == MAP_FAILED || map_size < sizeof(WorkloadHeader) || hdr->magic != kWorkloadMagic ||
+        hdr->key_len != define::keyLen || hdr->record_size != sizeof(WorkloadRecord) ||
+        map_size != sizeof(WorkloadHeader) + hdr->record_num * sizeof(WorkloadRecord)) {
+      printf("Invalid workload %s\n", path.c_str());
+      assert(false);
+    }
+    records = (const WorkloadRecord *)(addr + sizeof(WorkloadHeader));
+    record_num = hdr->record_num;
+  }
+
+  ~WorkloadFile() { munmap(addr, map_size); }
+
+  uint64_t size() const { return record_num; }
+  const WorkloadRecord& operator[](uint64_t i) const { return records[i]; }
+
+  // the binary workload of a text trace (at trace_path.bin), converted if it is missing or older than the trace
+  static WorkloadFile *open(const std::string &trace_path, bool is_str) {
+    auto bin_path = trace_path + ".bin";
+    struct stat trace_st, bin_st;
+    bool has_trace = (stat(trace_path.c_str(), &trace_st) == 0);
+    bool has_bin = (stat(bin_path.c_str(), &bin_st) == 0);
+    if (has_trace && (!has_bin || bin_st.st_mtime < trace_st.st_mtime)) {
+      if (!convert(trace_path, bin_path, is_str)) {
+        printf("Fail to convert %s\n", trace_path.c_str());
+        assert(false);
+      }
+    }
+    return new WorkloadFile(bin_path);
+  }
+
+  static bool convert(const std::string &trace_path, const std::string &bin_path, bool is_str) {
+    std::ifstream in(trace_path);
+    if (!in.is_open()) return false;
+    WorkloadWriter writer(bin_path);
+    std::string op, line, str_k;
+    WorkloadRecord rec{};
+    while (std::getline(in, line)) {
+      if (!line.size()) continue;
+      std::istringstream tmp(line);
+      tmp >> op;
+      rec.op = op == "READ" ? WL_READ : op == "UPDATE" ? WL_UPDATE : op == "INSERT" ? WL_INSERT :
+               op == "DELETE" ? WL_DELETE : WL_SCAN;
+      assert(rec.op != WL_SCAN || op == "SCAN");
+      if (is_str) {
+        tmp >> str_k;
+        assert(rec.op != WL_SCAN);  // string workloads currently does not support SCAN
+        rec.k = str2key(str_k);
+      }
+      else {
+        uint64_t int_k;
+        tmp >> int_k;
+        rec.k = int2key(int_k);
+      }
+      rec.range_size = 0;
+      if (rec.op == WL_SCAN) tmp >> rec.range_size;
+      writer.append(rec);
+    }
+    return writer.close();
+  }
+
+private:
+  char *addr;
+  size_t map_size;
+  const WorkloadRecord *records;
+  uint64_t record_num;
+};
+
+
+/*
+  In-process YCSB CoreWorkload with int keys, following the spec files in ycsb/full_workload_spec and ycsb/small_workload_spec
+*/
+struct YcsbSpec {
+  uint64_t record_cnt = 1000;
+  uint64_t op_cnt = 1000;
+  double read = 0.95, update = 0.05, insert = 0, scan = 0, del = 0;  // proportions
+  std::string distribution = "uniform";  // uniform / zipfian / latest
+  uint32_t max_scan_len = 1000;
+
+  // spec_dir/workload<idx>, with the UPDATE ops of workloadx rewritten into DELETE ops as gen_workload.py does
+  bool load(const std::string &spec_dir, const std::string &idx) {
+    std::ifstream in(spec_dir + "/workload" + idx);
+    if (!in.is_open()) return false;
+    std::string line;
+    while (std::getline(in, line)) {
+      auto pos = line.find('=');
+      if (line.empty() || line[0] == '#' || pos == std::string::npos) continue;
+      auto name = line.substr(0, pos), val = line.substr(pos + 1);
+      val.erase(val.find_last_not_of(" \t\r") + 1);
+      if (name == "recordcount") record_cnt = std::stoull(val);
+      else if (name == "operationcount") op_cnt = std::stoull(val);
+      else if (name == "readproportion") read = std::stod(val);
+      else if (name == "updateproportion") update = std::stod(val);
+      else if (name == "insertproportion") insert = std::stod(val);
+      else if (name == "scanproportion") scan = std::stod(val);
+      else if (name == "deleteproportion") del = std::stod(val);
+      else if (name == "requestdistribution") distribution = val;
+      else if (name == "maxscanlength") max_scan_len = std::stoul(val);
+    }
+    if (idx == "x") {
+      del += update;
+      update = 0;
+    }
+    return distribution == "uniform" || distribution == "zipfian" || distribution == "latest";
+  }
+};
+
+
+// YCSB hashes the record numbers into keys (FNV-1a 64, as Utils.fnvhash64)
+inline uint64_t ycsb_hash(uint64_t val) {
+  uint64_t h = 0xCBF29CE484222325ull;
+  for (int i = 0; i < 8; ++ i) {
+    h = (h ^ (val & 0xff)) * 1099511628211ull;
+    val >>= 8;
+  }
+  return (int64_t)h < 0 ? -h : h;
+}
+
+inline uint64_t ycsb_int_key(uint64_t record_id) {
+  return std::max<uint64_t>(ycsb_hash(record_id), kKeyMin);
+}
+
+inline Key ycsb_key(uint64_t record_id) {
+  return int2key(ycsb_int_key(record_id));
+}
+
+
+// the requests of one of thread_num threads, which insert the records from record_cnt on in turn;
+// a generator only depends on the spec, its thread_id and the seed
+class YcsbTxnGen {
+public:
+  YcsbTxnGen(const YcsbSpec &spec, uint64_t thread_id, uint64_t thread_num, uint64_t seed) :
+             spec(spec), thread_id(thread_id), thread_num(thread_num), e(seed * thread_num + thread_id) {
+    mehcached_zipf_init(&zipf, spec.record_cnt, spec.distribution == "uniform" ? 0 : 0.99,
+                        (seed * thread_num + thread_id) & ((1ull << 48) - 1));
+  }
+
+  WorkloadRecord next() {
+    WorkloadRecord rec{};
+    uint64_t record_id;
+    rec.op = next(record_id, rec.range_size);
+    rec.k = ycsb_key(record_id);
+    return rec;
+  }
+
+  // the op of the next request, and the id of its record, which is inserted by the op or accessed
+  WorkloadOp next(uint64_t &record_id, uint32_t &range_size) {
+    WorkloadOp op;
+    double p = std::uniform_real_distribution<double>(0, 1)(e);
+    if ((p -= spec.read) < 0) op = WL_READ;
+    else if ((p -= spec.update) < 0) op = WL_UPDATE;
+    else if ((p -= spec.insert) < 0) op = WL_INSERT;
+    else if ((p -= spec.scan) < 0) op = WL_SCAN;
+    else op = spec.del > 0 ? WL_DELETE : WL_READ;
+
+    range_size = 0;
+    if (op == WL_INSERT) {
+      record_id = spec.record_cnt + thread_id + thread_num * (insert_cnt ++);
+      if (spec.distribution == "latest") mehcached_zipf_change_n(&zipf, spec.record_cnt + insert_cnt * thread_num);
+      return op;
+    }
+    record_id = next_record_id();
+    if (op == WL_SCAN) range_size = std::uniform_int_distribution<uint32_t>(1, spec.max_scan_len)(e);
+    return op;
+  }
+
+private:
+  uint64_t next_record_id() {
+    auto z = mehcached_zipf_next(&zipf);
+    if (spec.distribution == "latest") return zipf.n - 1 - z;  // the records inserted so far by all threads, recent ones first
+    if (spec.distribution == "zipfian") return ycsb_hash(z) % spec.record_cnt;  // scrambled, so that hot records spread out
+    return z;
+  }
+
+  YcsbSpec spec;
+  uint64_t thread_id;
+  uint64_t thread_num;
+  std::mt19937_64 e;
+  zipf_gen_state zipf;
+  uint64_t insert_cnt = 0;
+};
+
+#endif // _WORKLOAD_H_
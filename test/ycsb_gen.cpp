@@ -0,0 +1,236 @@
+#include "Timer.h"
+#include "workload.h"
+
+#include <stdlib.h>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <algorithm>
+
+// Generates the YCSB workload files of ycsb_test in parallel, split for CN_num x client_num_per_CN clients and LOADER_NUM
+// loaders per CN as split_workload.py does, into the directory in ../workloads.conf. The records are loaded in YCSB's order,
+// and the requests of each client are the ones ycsb_test generates in process for it from the seed.
+
+#define LOADER_NUM 8  // per CN, as in ycsb_test
+
+std::string kWorkload;
+std::string kKeyType;
+int kNodeCount;
+int kClientCount;
+std::string kSpecDir = "../ycsb/full_workload_spec";
+bool kBinary = false;
+uint64_t kSeed = 2024;  // GEN_SEED of ycsb_test
+
+YcsbSpec spec;
+std::string load_path;
+std::string trans_path;
+int load_shard_num;
+int trans_shard_num;
+
+// email keys are the lines of the email list gen_workload.py picks: every gap-th line for the loaded records,
+// and the lines right after them (or the lines after the loaded ones, if there is no gap) for the inserted ones
+const char *kEmailListPath = "../ycsb/emails.txt";
+const char *email_list;
+size_t email_list_size;
+std::vector<uint64_t> load_email;    // line offsets
+std::vector<uint64_t> insert_email;
+
+const char *kOpName[] = {"INSERT", "READ", "UPDATE", "DELETE", "SCAN"};
+
+
+void parse_args(int argc, char *argv[]) {
+  if (argc < 5 || argc > 8) {
+    printf("Usage: ./ycsb_gen workload_name[a/b/c/d/e/x/la/...] key_type[randint/email] CN_num client_num_per_CN [spec[full/small]] [format[text/bin]] [seed]\n");
+    exit(-1);
+  }
+  kWorkload = argv[1];
+  kKeyType = argv[2];
+  kNodeCount = atoi(argv[3]);
+  kClientCount = atoi(argv[4]);
+  if (argc >= 6) kSpecDir = std::string("../ycsb/") + argv[5] + "_workload_spec";
+  if (argc >= 7) kBinary = (std::string(argv[6]) == "bin");
+  if (argc >= 8) kSeed = atoll(argv[7]);
+  assert(kKeyType == "randint" || kKeyType == "email");
+
+  if (!spec.load(kSpecDir, kWorkload)) {
+    printf("Error opening workload spec\n");
+    assert(false);
+  }
+  std::string workload_dir;
+  std::ifstream workloads_dir_in("../workloads.conf");
+  if (!workloads_dir_in.is_open()) {
+    printf("Error opening workloads.conf\n");
+    assert(false);
+  }
+  workloads_dir_in >> workload_dir;
+  load_path = workload_dir + "/load_" + kKeyType + "_workload" + kWorkload;
+  trans_path = workload_dir + "/txn_" + kKeyType + "_workload" + kWorkload;
+  load_shard_num = kNodeCount * std::min(kClientCount, LOADER_NUM);
+  trans_shard_num = kNodeCount * kClientCount;
+
+  printf("workload %s: %lu records, %lu operations, %s\n", kWorkload.c_str(), spec.record_cnt, spec.op_cnt, spec.distribution.c_str());
+  printf("%d load files and %d txn files (%s) in %s, seed %lu\n", load_shard_num, trans_shard_num,
+         kBinary ? "bin" : "text", workload_dir.c_str(), kSeed);
+}
+
+
+void load_email_list() {
+  int fd = open(kEmailListPath, O_RDONLY);
+  if (fd < 0) {
+    printf("Error opening %s\n", kEmailListPath);
+    assert(false);
+  }
+  struct stat st;
+  fstat(fd, &st);
+  email_list_size = st.st_size;
+  email_list = (const char *)mmap(nullptr, email_list_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  assert(email_list != MAP_FAILED);
+
+  uint64_t line_cnt = 0;
+  for (const char *p = email_list; p < email_list + email_list_size; ++ p) line_cnt += (*p == '\n');
+  bool dense = (kWorkload == "la" || kWorkload.back() == '-');  // the insert-heavy workloads
+  uint64_t gap = dense ? 1 : line_cnt / spec.record_cnt;
+  assert(gap >= 1 && (dense || gap >= 2));
+
+  uint64_t line = 0;
+  for (uint64_t off = 0; off < email_list_size; ++ line) {
+    if (line < spec.record_cnt * gap && line % gap == 0) load_email.push_back(off);
+    else if (dense ? line >= spec.record_cnt : line % gap == 1) insert_email.push_back(off);
+    auto end = (const char *)memchr(email_list + off, '\n', email_list_size - off);
+    off = end ? end - email_list + 1 : email_list_size;
+  }
+  assert(load_email.size() == spec.record_cnt);
+  printf("%lu emails, %lu of them for inserts\n", line, insert_email.size());
+}
+
+// "name@host.com" -> "com.host@name" without spaces, as reverseHostName() of gen_workload.py
+std::string email_key(uint64_t off) {
+  auto end = (const char *)memchr(email_list + off, '\n', email_list_size - off);
+  std::string email(email_list + off, end ? end : email_list + email_list_size);
+  auto at = email.find('@');
+  std::string name = email.substr(0, at), sep, host, r_host;
+  if (at != std::string::npos) {
+    sep = "@";
+    host = email.substr(at + 1);
+    host.erase(0, host.find_first_not_of(" \t\r"));
+    host.erase(host.find_last_not_of(" \t\r") + 1);
+  }
+  std::vector<std::string> parts;
+  size_t s = 0;
+  for (size_t dot; (dot = host.find('.', s)) != std::string::npos; s = dot + 1) parts.push_back(host.substr(s, dot - s));
+  parts.push_back(host.substr(s));
+  for (auto it = parts.rbegin(); it != parts.rend(); ++ it) r_host += (it == parts.rbegin() ? "" : ".") + *it;
+
+  auto key = r_host + sep + name;
+  key.erase(std::remove(key.begin(), key.end(), ' '), key.end());
+  key.erase(0, key.find_first_not_of(" \t\r"));
+  key.erase(key.find_last_not_of(" \t\r") + 1);
+  return key;
+}
+
+
+// a load or txn file, in text or as the binary workload ycsb_test converts the text to
+class ShardWriter {
+public:
+  ShardWriter(const std::string &path) {
+    if (kBinary) {
+      bin = new WorkloadWriter(path + ".bin");
+      unlink(path.c_str());  // or the stale text would be converted again
+    }
+    else {
+      text = fopen(path.c_str(), "w");
+      assert(text);
+      setvbuf(text, nullptr, _IOFBF, 4 * define::MB);
+      unlink((path + ".bin").c_str());
+    }
+  }
+
+  void append(WorkloadOp op, uint64_t record_id, uint32_t range_size = 0) {
+    if (kKeyType == "randint") {
+      if (kBinary) bin->append(WorkloadRecord{ycsb_key(record_id), range_size, op});
+      else fprintf(text, "%s %lu", kOpName[op], ycsb_int_key(record_id));
+    }
+    else {
+      auto key = email_key(record_id < spec.record_cnt ? load_email[record_id] : insert_email.at(record_id - spec.record_cnt));
+      if (kBinary) bin->append(WorkloadRecord{str2key(key), range_size, op});
+      else fprintf(text, "%s %s", kOpName[op], key.c_str());
+    }
+    if (!kBinary) fprintf(text, op == WL_SCAN ? " %u\n" : "\n", range_size);
+  }
+
+  bool close() {
+    if (kBinary) {
+      auto ret = bin->close();
+      delete bin;
+      return ret;
+    }
+    return fclose(text) == 0;
+  }
+
+private:
+  WorkloadWriter *bin = nullptr;
+  FILE *text = nullptr;
+};
+
+
+// the load files, split by the loaders in turn, followed by the whole one (for rm_write_conflict of ycsb_test)
+void gen_load(int shard) {
+  uint64_t start = 0, end = spec.record_cnt;
+  if (shard < load_shard_num) {
+    start = spec.record_cnt / load_shard_num * shard;
+    end = shard == load_shard_num - 1 ? spec.record_cnt : start + spec.record_cnt / load_shard_num;
+  }
+  auto path = shard < load_shard_num ? load_path + std::to_string(shard) : load_path;
+  ShardWriter out(path);
+  for (uint64_t i = start; i < end; ++ i) {
+    out.append(WL_INSERT, i);
+  }
+  if (!out.close()) {
+    printf("Fail to write %s\n", path.c_str());
+    assert(false);
+  }
+}
+
+void gen_trans(int shard) {
+  uint64_t op_num = spec.op_cnt / trans_shard_num + (shard == trans_shard_num - 1 ? spec.op_cnt % trans_shard_num : 0);
+  YcsbTxnGen gen(spec, shard, trans_shard_num, kSeed);
+  auto path = trans_path + std::to_string(shard);
+  ShardWriter out(path);
+  uint64_t record_id;
+  uint32_t range_size;
+  for (uint64_t i = 0; i < op_num; ++ i) {
+    auto op = gen.next(record_id, range_size);
+    out.append(op, record_id, range_size);
+  }
+  if (!out.close()) {
+    printf("Fail to write %s\n", path.c_str());
+    assert(false);
+  }
+}
+
+
+int main(int argc, char *argv[]) {
+  parse_args(argc, argv);
+
+  Timer timer;
+  timer.begin();
+  if (kKeyType == "email") load_email_list();
+
+  int task_num = load_shard_num + 1 + trans_shard_num;
+  std::atomic<int> next_task{0};
+  std::vector<std::thread> th;
+  for (unsigned i = 0; i < std::max(1u, std::thread::hardware_concurrency()); ++ i) {
+    th.emplace_back([&]() {
+      for (int t; (t = next_task.fetch_add(1)) < task_num; ) {
+        if (t <= load_shard_num) gen_load(t);
+        else gen_trans(t - load_shard_num - 1);
+      }
+    });
+  }
+  for (auto& t : th) t.join();
+  printf("generated in %.1fs\n", timer.end() / 1e9);
+  return 0;
+}
@@ -1,5 +1,7 @@
 #include "Tree.h"
+#include "Metrics.h"
 #include "Timer.h"
+#include "workload.h"
 #include <city.h>
 
 #include <stdlib.h>
@@ -29,31 +31,16 @@
 #endif
 #endif
 
-#define MAX_THREAD_REQUEST 10000000
 #define LOAD_HEARTBEAT 100000
 #define EPOCH_LAT_TEST
 #define LOADER_NUM 8
-
-extern double cache_miss[MAX_APP_THREAD];
-extern double cache_hit[MAX_APP_THREAD];
-extern uint64_t lock_fail[MAX_APP_THREAD];
-// extern uint64_t try_lock[MAX_APP_THREAD];
-extern uint64_t write_handover_num[MAX_APP_THREAD];
-extern uint64_t try_write_op[MAX_APP_THREAD];
-extern uint64_t read_handover_num[MAX_APP_THREAD];
-extern uint64_t try_read_op[MAX_APP_THREAD];
-extern uint64_t read_leaf_retry[MAX_APP_THREAD];
-extern uint64_t leaf_cache_invalid[MAX_APP_THREAD];
-extern uint64_t try_read_leaf[MAX_APP_THREAD];
-extern uint64_t read_node_repair[MAX_APP_THREAD];
-extern uint64_t try_read_node[MAX_APP_THREAD];
-extern uint64_t read_node_type[MAX_APP_THREAD][MAX_NODE_TYPE_NUM];
-extern uint64_t retry_cnt[MAX_APP_THREAD][MAX_FLAG_NUM];
+#define GEN_SEED 2024  // of the requests generated in process
 
 int kThreadCount;
 int kNodeCount;
 int kCoroCnt = 8;
 bool kIsStr;
+bool kIsGen;  // requests are generated in process from a YCSB spec instead of read from the workload files
 bool kIsScan;
 #ifdef USE_CORO
 bool kUseCoro = true;
@@ -63,17 +50,25 @@ bool kUseCoro = false;
 
 std::string ycsb_load_path;
 std::string ycsb_trans_path;
+std::string ycsb_spec_dir;
+YcsbSpec ycsb_spec;
 int fix_range_size = -1;
+#ifdef TREE_ENABLE_VAR_LEN_VALUE
+uint32_t value_size = sizeof(Value);
+#endif
 // turn it on if want to eliminate impact of write conflicts
 bool rm_write_conflict = false;
+WorkloadFile *key_space;  // the whole load workload, of which each thread writes its own part without conflicts
+// open loop: requests are issued at kOfferedLoad Kops in total across CNs instead of right after the previous ones
+double kOfferedLoad = 0;
+bool kPoissonArrival = true;  // or at a constant rate
 
 
 std::thread th[MAX_APP_THREAD];
 uint64_t tp[MAX_APP_THREAD][MAX_CORO_NUM];
 
 extern volatile bool need_stop;
-extern uint64_t latency[MAX_APP_THREAD][MAX_CORO_NUM][LATENCY_WINDOWS];
-uint64_t latency_th_all[LATENCY_WINDOWS];
+extern Histogram latency[MAX_APP_THREAD][REQ_TYPE_NUM];
 
 std::default_random_engine e;
 std::uniform_int_distribution<Value> randval(kValueMin, kValueMax);
@@ -87,11 +82,47 @@ inline uint64_t key_hash(const Key &k) {
 }
 
 
+// scheduled start times of the requests of a thread in the open loop
+class ArrivalSchedule {
+public:
+  ArrivalSchedule(double ops_per_sec, uint64_t seed) : gap_ns(1e9 / ops_per_sec), next_ns(Timer::get_time_ns()), e(seed) {}
+
+  uint64_t next() {
+    auto start_ns = (uint64_t)next_ns;
+    next_ns += kPoissonArrival ? gap_ns * gap_dist(e) : gap_ns;
+    return start_ns;
+  }
+
+private:
+  double gap_ns;
+  double next_ns;
+  std::mt19937_64 e;
+  std::exponential_distribution<double> gap_dist{1.0};  // in units of gap_ns
+};
+
+ArrivalSchedule *arrival_schedule[MAX_APP_THREAD];  // shared by the coroutines of a thread
+
+// the requests of a thread are streamed from its mmap-ed workload or generated in process, shared by its coroutines
+WorkloadFile *trans_workload[MAX_APP_THREAD];
+YcsbTxnGen *trans_gen[MAX_APP_THREAD];
+uint64_t global_thread_id[MAX_APP_THREAD];
+
+
+Key get_no_conflict_key(uint64_t key_hash, uint64_t global_thread_id, uint64_t global_thread_num) {
+  uint64_t key_space_size = kIsGen ? ycsb_spec.record_cnt : key_space->size();
+  auto start = key_space_size / global_thread_num * global_thread_id;
+  auto i = start + key_hash % (key_space_size / global_thread_num);
+  return kIsGen ? ycsb_key(i) : (*key_space)[i].k;
+}
+
+
 class RequsetGenBench : public RequstGen {
 public:
-  RequsetGenBench(DSM* dsm, Request* req, int req_num, int coro_id, int coro_cnt) :
-                  dsm(dsm), req(req), req_num(req_num), coro_id(coro_id), coro_cnt(coro_cnt) {
+  RequsetGenBench(DSM* dsm, int coro_id, int coro_cnt) :
+                  dsm(dsm), coro_id(coro_id), coro_cnt(coro_cnt) {
     local_thread_id = dsm->getMyThreadID();
+    trans = trans_workload[local_thread_id];
+    gen = trans_gen[local_thread_id];
     cur = coro_id;
     epoch_id = 0;
     extra_k = MAX_KEY_SPACE_SIZE + kThreadCount * kCoroCnt * dsm->getMyNodeID() + local_thread_id * kCoroCnt + coro_id;
@@ -99,34 +130,49 @@ public:
   }
 
   Request next() override {
-    cur = (cur + coro_cnt) % req_num;
-    if (req[cur].is_insert) {
-      if (cur + coro_cnt >= req_num) {
-        // need_stop = true;
+    Request r;
+    if (gen) {
+      r = to_request(gen->next());  // inserted keys never repeat
+    }
+    else {
+      cur = (cur + coro_cnt) % trans->size();
+      r = to_request((*trans)[cur]);
+    }
+    if (rm_write_conflict && (r.is_update || r.is_insert || r.is_delete)) {
+      r.k = get_no_conflict_key(key_hash(r.k), global_thread_id[local_thread_id], kThreadCount * dsm->getClusterSize());
+    }
+    if (!gen && r.is_insert) {
+      if (cur + coro_cnt >= trans->size()) {
         ++ epoch_id;
         flag = true;
       }
       if (kIsStr) {
-        req[cur].k = req[cur].k + epoch_id;   // For insert workloads, key should remain nonexist
+        r.k = r.k + epoch_id;   // For insert workloads, key should remain nonexist
       }
       else if (flag) {
-        req[cur].k = int2key(extra_k);
+        r.k = int2key(extra_k);
         extra_k += kThreadCount * kCoroCnt * dsm->getClusterSize();
       }
     }
+    if (fix_range_size >= 0) {
+      r.range_size = fix_range_size;
+    }
     tp[local_thread_id][coro_id]++;
-    req[cur].v = randval(e);  // make value different per-epoch
-    return req[cur];
+    r.v = randval(e);  // make value different per-epoch
+    if (arrival_schedule[local_thread_id]) {
+      r.start_ns = arrival_schedule[local_thread_id]->next();
+    }
+    return r;
   }
 
 private:
   DSM *dsm;
-  Request* req;
-  int req_num;
   int coro_id;
   int coro_cnt;
   int local_thread_id;
-  int cur;
+  WorkloadFile *trans;
+  YcsbTxnGen *gen;
+  uint64_t cur;
   uint8_t epoch_id;
   uint64_t extra_k;
   bool flag;
@@ -134,21 +180,39 @@ private:
 
 
 RequstGen *gen_func(DSM* dsm, Request* req, int req_num, int coro_id, int coro_cnt) {
-  return new RequsetGenBench(dsm, req, req_num, coro_id, coro_cnt);
+  return new RequsetGenBench(dsm, coro_id, coro_cnt);
+}
+
+
+inline void insert_kv(const Key &k, Value v, CoroContext *ctx, int coro_id, bool is_update, bool is_load = false) {
+#ifdef TREE_ENABLE_VAR_LEN_VALUE
+  thread_local char val[define::valLenMax];
+  memcpy(val, &v, sizeof(Value));  // value_size bytes starting with the random value
+  tree->insert(k, val, value_size, ctx, coro_id, is_update, is_load);
+#else
+  tree->insert(k, v, ctx, coro_id, is_update, is_load);
+#endif
 }
 
 
 void work_func(Tree *tree, const Request& r, CoroContext *ctx, int coro_id) {
   if (r.is_search) {
+#ifdef TREE_ENABLE_VAR_LEN_VALUE
+    thread_local std::string val[MAX_CORO_NUM];
+    tree->search(r.k, val[coro_id], ctx, coro_id);
+#else
     Value v;
     tree->search(r.k, v, ctx, coro_id);
+#endif
   }
   else if (r.is_update || r.is_insert) {
-    tree->insert(r.k, r.v, ctx, coro_id, r.is_update);
+    insert_kv(r.k, r.v, ctx, coro_id, r.is_update);
   }
-  else {
-    std::map<Key, Value> ret;
-    tree->range_query(r.k, r.k + r.range_size, ret);
+  else if (r.is_delete) {
+    tree->remove(r.k, ctx, coro_id);
+  }
+  else {  // ycsb scan: start key + range_size records
+    tree->scan(r.k, r.range_size, [](const Key&, Value) {}, ctx, coro_id);
   }
 }
 
@@ -158,6 +222,70 @@ std::atomic<int64_t> warmup_cnt{0};
 std::atomic_bool ready{false};
 
 
+void read_load_file(uint64_t loader_id, const std::function<void (const Key&)>& func) {
+  uint64_t cnt = 0;
+  if (kIsGen) {  // the records are dealt out to the loaders of all CNs
+    uint64_t loader_num = std::min(kThreadCount, LOADER_NUM) * kNodeCount;
+    for (uint64_t i = loader_id; i < ycsb_spec.record_cnt; i += loader_num) {
+      func(ycsb_key(i));
+      if (++ cnt % LOAD_HEARTBEAT == 0) {
+        printf("thread %lu: %lu load entries loaded.\n", loader_id, cnt);
+      }
+    }
+    return;
+  }
+  auto load = WorkloadFile::open(ycsb_load_path + std::to_string(loader_id), kIsStr);
+  for (uint64_t i = 0; i < load->size(); ++ i) {
+    assert((*load)[i].op == WL_INSERT);
+    func((*load)[i].k);
+    if (++ cnt % LOAD_HEARTBEAT == 0) {
+      printf("thread %lu: %lu load entries loaded.\n", loader_id, cnt);
+    }
+  }
+  delete load;
+}
+
+
+#ifdef YCSB_BULK_LOAD
+std::vector<Key> bulk_keys[LOADER_NUM];
+std::atomic<int> bulk_read_cnt{0};
+
+// node 0 reads the load files of all CNs in parallel, then builds the tree at once
+void thread_bulk_load(int id) {
+  if (dsm->getMyNodeID() != 0) return;
+
+  int loader_num = std::min(kThreadCount, LOADER_NUM);
+  for (int i = 0; i < kNodeCount; ++ i) {
+    read_load_file(loader_num * i + id, [=](const Key& k){ bulk_keys[id].push_back(k); });
+  }
+  bulk_read_cnt.fetch_add(1);
+  if (id != 0) return;
+
+  while (bulk_read_cnt.load() != loader_num)
+    ;
+  for (int i = 1; i < loader_num; ++ i) {
+    bulk_keys[0].insert(bulk_keys[0].end(), bulk_keys[i].begin(), bulk_keys[i].end());
+    std::vector<Key>().swap(bulk_keys[i]);
+  }
+  auto& keys = bulk_keys[0];
+  std::sort(keys.begin(), keys.end());
+
+  Timer timer;
+  timer.begin();
+  uint64_t i = 0;
+  bool res = tree->bulk_load([&](Key& k, Value& v){
+    if (i == keys.size()) return false;
+    k = keys[i ++];
+    v = randval(e);
+    return true;
+  });
+  assert(res);
+  printf("bulk load %lu entries in %.3fs\n", keys.size(), timer.end() / 1e9);
+  std::vector<Key>().swap(keys);
+}
+#endif
+
+
 void thread_load(int id) {
   // use LOADER_NUM threads to load ycsb
   uint64_t loader_id = std::min(kThreadCount, LOADER_NUM) * dsm->getMyNodeID() + id;
@@ -165,40 +293,11 @@ void thread_load(int id) {
   printf("I am loader %lu\n", loader_id);
 
   // 1. insert ycsb_load
-  std::string op;
-  std::ifstream load_in(ycsb_load_path + std::to_string(loader_id));
-  if (!load_in.is_open()) {
-    printf("Error opening load file\n");
-    assert(false);
-  }
-  Key k;
-  int cnt = 0;
-  if (!kIsStr) {  // int workloads
-    uint64_t int_k;
-    while (load_in >> op >> int_k) {
-      k = int2key(int_k);
-      assert(op == "INSERT");
-      tree->insert(k, randval(e), nullptr, 0, false, true);
-      if (++ cnt % LOAD_HEARTBEAT == 0) {
-        printf("thread %lu: %d load entries loaded.\n", loader_id, cnt);
-      }
-    }
-  }
-  else {  // string workloads
-    std::string str_k;
-    std::string line;
-    while (std::getline(load_in, line)) {
-      if (!line.size()) continue;
-      std::istringstream tmp(line);
-      tmp >> op >> str_k;
-      k = str2key(str_k);
-      assert(op == "INSERT");
-      tree->insert(k, randval(e), nullptr, 0, false, true);
-      if (++ cnt % LOAD_HEARTBEAT == 0) {
-        printf("thread %lu: %d load entries loaded.\n", loader_id, cnt);
-      }
-    }
-  }
+#ifdef YCSB_BULK_LOAD
+  thread_bulk_load(id);
+#else
+  read_load_file(loader_id, [=](const Key& k){ insert_kv(k, randval(e), nullptr, 0, false, true); });
+#endif
   printf("loader %lu load finish\n", loader_id);
 }
 
@@ -220,66 +319,13 @@ void thread_run(int id) {
     thread_load(id);
   }
 
-  // 2. load ycsb_trans
-  Request* req = new Request[MAX_THREAD_REQUEST];
-  int req_num = 0;
-  std::ifstream trans_in(ycsb_trans_path + std::to_string(my_id));
-  if (!trans_in.is_open()) {
-    printf("Error opening trans file\n");
-    assert(false);
-  }
-  std::string op;
-  int cnt = 0;
-  if (!kIsStr) {  // int workloads
-    int range_size = 0;
-    uint64_t int_k;
-    while(trans_in >> op >> int_k) {
-      if (op == "SCAN") trans_in >> range_size;
-      else range_size = 0;
-      Request r;
-      r.is_search = (op == "READ");
-      r.is_insert = (op == "INSERT");
-      r.is_update = (op == "UPDATE");
-      r.range_size = fix_range_size >= 0 ? fix_range_size : range_size;
-      r.k = int2key(int_k);
-      if (rm_write_conflict) {
-        if (r.is_update || r.is_insert) {
-          uint64_t all_thread_num = kThreadCount * dsm->getClusterSize();
-          r.k = dsm->getNoComflictKey(key_hash(r.k), my_id, all_thread_num);
-        }
-      }
-      req[req_num ++] = r;
-      if (++ cnt % LOAD_HEARTBEAT == 0) {
-        printf("thread %d: %d trans entries loaded.\n", id, cnt);
-      }
-    }
+  // 2. open ycsb_trans
+  global_thread_id[dsm->getMyThreadID()] = my_id;
+  if (kIsGen) {
+    trans_gen[dsm->getMyThreadID()] = new YcsbTxnGen(ycsb_spec, my_id, kThreadCount * dsm->getClusterSize(), GEN_SEED);
   }
   else {
-    std::string str_k;
-    std::string line;
-    while (std::getline(trans_in, line)) {
-      if (!line.size()) continue;
-      std::istringstream tmp(line);
-      tmp >> op >> str_k;
-      assert(op != "SCAN");  // string workloads currently does not support SCAN
-      Request r;
-      r.is_search = (op == "READ");
-      r.is_insert = (op == "INSERT");
-      r.is_update = (op == "UPDATE");
-      assert(r.is_search || r.is_insert || r.is_update);
-      r.range_size = 0;
-      r.k = str2key(str_k);
-      if (rm_write_conflict) {
-        if (r.is_update || r.is_insert) {
-          uint64_t all_thread_num = kThreadCount * dsm->getClusterSize();
-          r.k = dsm->getNoComflictKey(key_hash(r.k), my_id, all_thread_num);
-        }
-      }
-      req[req_num ++] = r;
-      if (++ cnt % LOAD_HEARTBEAT == 0) {
-        printf("thread %d: %d trans entries loaded.\n", id, cnt);
-      }
-    }
+    trans_workload[dsm->getMyThreadID()] = WorkloadFile::open(ycsb_trans_path + std::to_string(my_id), kIsStr);
   }
 
   warmup_cnt.fetch_add(1);
@@ -300,34 +346,34 @@ void thread_run(int id) {
     ;
 
   // 3. start ycsb test
-  if (!kIsScan && kUseCoro) {
-    tree->run_coroutine(gen_func, work_func, kCoroCnt, req, req_num);
+  if (kOfferedLoad > 0) {
+    arrival_schedule[dsm->getMyThreadID()] = new ArrivalSchedule(kOfferedLoad * 1000 / (kThreadCount * dsm->getClusterSize()), my_id);
+  }
+  if (kUseCoro) {
+    tree->run_coroutine(gen_func, work_func, kCoroCnt);
   }
   else {
     /// without coro
     Timer timer;
-    auto gen = new RequsetGenBench(dsm, req, req_num, 0, 0);
+    auto gen = new RequsetGenBench(dsm, 0, 1);
     auto thread_id = dsm->getMyThreadID();
 
     while (!need_stop) {
       auto r = gen->next();
 
+      while (r.start_ns && Timer::get_time_ns() < r.start_ns && !need_stop)
+        ;
       timer.begin();
       work_func(tree, r, nullptr, 0);
-      auto us_10 = timer.end() / 100;
-
-      if (us_10 >= LATENCY_WINDOWS) {
-        us_10 = LATENCY_WINDOWS - 1;
-      }
-      latency[thread_id][0][us_10]++;
+      latency[thread_id][r.type()].record(r.start_ns ? Timer::get_time_ns() - r.start_ns : timer.end());
     }
   }
   printf("thread %d exit.\n", id);
 }
 
 void parse_args(int argc, char *argv[]) {
-  if (argc != 6 && argc != 7) {
-    printf("Usage: ./ycsb_test kNodeCount kThreadCount kCoroCnt workload_type[randint/email] workload_idx[a/b/c/d/e] [fix_range_size/rm_write_conflict]\n");
+  if (argc < 6 || argc > 10) {
+    printf("Usage: ./ycsb_test kNodeCount kThreadCount kCoroCnt workload_type[randint/email/gen/gen_small] workload_idx[a/b/c/d/e/x] [fix_range_size/rm_write_conflict] [value_size] [offered_load(Kops)] [arrival[poisson/const]]\n");
     exit(-1);
   }
 
@@ -335,54 +381,103 @@ void parse_args(int argc, char *argv[]) {
   kThreadCount = atoi(argv[2]);
   kCoroCnt = atoi(argv[3]);
   kIsStr = (std::string(argv[4]) == "email");
+  kIsGen = (std::string(argv[4]) == "gen" || std::string(argv[4]) == "gen_small");
+#ifndef TREE_ENABLE_VAR_LEN_KEY
+  if (kIsStr) printf("warning: string keys are truncated to %u bytes, build with -DVAR_LEN_KEY=ON\n", define::keyLen);
+#endif
   kIsScan = (std::string(argv[5]) == "e");
 
-  std::string workload_dir;
-  std::ifstream workloads_dir_in("../workloads.conf");
-  if (!workloads_dir_in.is_open()) {
-    printf("Error opening workloads.conf\n");
-    assert(false);
+  if (kIsGen) {  // as specified in ycsb/full_workload_spec or ycsb/small_workload_spec
+    ycsb_spec_dir = std::string("../ycsb/") + (std::string(argv[4]) == "gen" ? "full" : "small") + "_workload_spec";
+    if (!ycsb_spec.load(ycsb_spec_dir, argv[5])) {
+      printf("Error opening workload spec\n");
+      assert(false);
+    }
+  }
+  else {
+    std::string workload_dir;
+    std::ifstream workloads_dir_in("../workloads.conf");
+    if (!workloads_dir_in.is_open()) {
+      printf("Error opening workloads.conf\n");
+      assert(false);
+    }
+    workloads_dir_in >> workload_dir;
+    ycsb_load_path = workload_dir + "/load_" + std::string(argv[4]) + "_workload" + std::string(argv[5]);
+    ycsb_trans_path = workload_dir + "/txn_" + std::string(argv[4]) + "_workload" + std::string(argv[5]);
   }
-  workloads_dir_in >> workload_dir;
-  ycsb_load_path = workload_dir + "/load_" + std::string(argv[4]) + "_workload" + std::string(argv[5]);
-  ycsb_trans_path = workload_dir + "/txn_" + std::string(argv[4]) + "_workload" + std::string(argv[5]);
-  if (argc == 7) {
+  if (argc >= 7) {
     if(kIsScan) fix_range_size = atoi(argv[6]);
     else rm_write_conflict = (atoi(argv[6]) != 0);
   }
+  if (argc >= 8) {
+#ifdef TREE_ENABLE_VAR_LEN_VALUE
+    value_size = atoi(argv[7]);
+    assert(value_size >= sizeof(Value) && value_size <= define::valLenMax);
+#else
+    if (atoi(argv[7]) != sizeof(Value)) printf("warning: value_size is ignored, build with -DVAR_LEN_VALUE=ON\n");
+#endif
+  }
+  if (argc >= 9) {
+    kOfferedLoad = atof(argv[8]);
+  }
+  if (argc == 10) {
+    kPoissonArrival = (std::string(argv[9]) != "const");
+  }
 
   printf("kNodeCount %d, kThreadCount %d, kCoroCnt %d\n", kNodeCount, kThreadCount, kCoroCnt);
-  printf("ycsb_load: %s\n", ycsb_load_path.c_str());
-  printf("ycsb_trans: %s\n", ycsb_trans_path.c_str());
-  if (argc == 7) {
+  if (kIsGen) {
+    printf("ycsb_spec: %s/workload%s, %lu records, %s\n", ycsb_spec_dir.c_str(), argv[5], ycsb_spec.record_cnt, ycsb_spec.distribution.c_str());
+  }
+  else {
+    printf("ycsb_load: %s\n", ycsb_load_path.c_str());
+    printf("ycsb_trans: %s\n", ycsb_trans_path.c_str());
+  }
+  if (argc >= 7) {
     if(kIsScan) printf("fix_range_size: %d\n", fix_range_size);
     else printf("rm_write_conflict: %s\n", rm_write_conflict ? "true" : "false");
   }
+#ifdef TREE_ENABLE_VAR_LEN_VALUE
+  printf("value_size: %u\n", value_size);
+#endif
+  if (kOfferedLoad > 0) {
+    printf("open loop: %.1f Kops, %s arrival\n", kOfferedLoad, kPoissonArrival ? "poisson" : "constant");
+  }
+}
+
+void clear_latency() {
+  for (int k = 0; k < MAX_APP_THREAD; ++k) {
+    for (int t = 0; t < REQ_TYPE_NUM; ++t) {
+      latency[k][t].clear();
+    }
+  }
 }
 
 void save_latency(int epoch_id) {
-  // sum up local latency cnt
-  for (int i = 0; i < LATENCY_WINDOWS; ++i) {
-    latency_th_all[i] = 0;
-    for (int k = 0; k < MAX_APP_THREAD; ++k)
-      for (int j = 0; j < MAX_CORO_NUM; ++j) {
-        latency_th_all[i] += latency[k][j][i];
+  // merge the histograms of all threads, for each type of requests and for all
+  Histogram all, h;
+  for (int t = 0; t < REQ_TYPE_NUM; ++t) {
+    h.clear();
+    for (int k = 0; k < MAX_APP_THREAD; ++k) {
+      h.merge(latency[k][t]);
+      latency[k][t].clear();
     }
+    if (!h.count()) continue;
+    printf("%s latency: p50 %.1fus, p99 %.1fus, p999 %.1fus, max %.1fus\n", kRequestTypeName[t],
+           h.percentile(0.5) / 1000.0, h.percentile(0.99) / 1000.0, h.percentile(0.999) / 1000.0, h.max() / 1000.0);
+    std::ofstream f_out("../us_lat/epoch_" + std::to_string(epoch_id) + "_" + kRequestTypeName[t] + ".lat");
+    h.save(f_out);
+    all.merge(h);
   }
   // store in file
   std::ofstream f_out("../us_lat/epoch_" + std::to_string(epoch_id) + ".lat");
-  f_out << std::setiosflags(std::ios::fixed) << std::setprecision(1);
   if (f_out.is_open()) {
-    for (int i = 0; i < LATENCY_WINDOWS; ++i) {
-      f_out << i / 10.0 << "\t" << latency_th_all[i] << std::endl;
-    }
+    all.save(f_out);
     f_out.close();
   }
   else {
     printf("Fail to write file!\n");
     assert(false);
   }
-  memset(latency, 0, sizeof(uint64_t) * MAX_APP_THREAD * MAX_CORO_NUM * LATENCY_WINDOWS);
 }
 
 int main(int argc, char *argv[]) {
@@ -390,16 +485,21 @@ int main(int argc, char *argv[]) {
   parse_args(argc, argv);
 
   DSMConfig config;
+#ifndef DSM_LOOPBACK
   assert(kNodeCount >= MEMORY_NODE_NUM);
+#endif
   config.machineNR = kNodeCount;
   config.threadNR = kThreadCount;
   dsm = DSM::getInstance(config);
   bindCore(kThreadCount * 2 + 1);
-  if (rm_write_conflict) {
-    dsm->loadKeySpace(ycsb_load_path, kIsStr);
+  if (rm_write_conflict && !kIsGen) {
+    key_space = WorkloadFile::open(ycsb_load_path, kIsStr);
   }
   dsm->registerThread();
   tree = new Tree(dsm);
+  if (getenv("SMART_METRICS_EXPORT")) {  // a file or a local port
+    metrics.start_exporter(getenv("SMART_METRICS_EXPORT"), dsm->getMyNodeID());
+  }
   dsm->barrier("benchmark");
 
   for (int i = 0; i < kThreadCount; i ++) {
@@ -410,6 +510,7 @@ int main(int argc, char *argv[]) {
     ;
   timespec s, e;
   uint64_t pre_tp = 0;
+  auto pre_metrics = metrics.snapshot();
   int count = 0;
 
   clock_gettime(CLOCK_REALTIME, &s);
@@ -430,72 +531,22 @@ int main(int argc, char *argv[]) {
     uint64_t cap = all_tp - pre_tp;
     pre_tp = all_tp;
 
-    double all = 0, hit = 0;
-    for (int i = 0; i < MAX_APP_THREAD; ++i) {
-      all += (cache_hit[i] + cache_miss[i]);
-      hit += cache_hit[i];
-    }
-
-    uint64_t lock_fail_cnt = 0;
-    for (int i = 0; i < MAX_APP_THREAD; ++i) {
-      lock_fail_cnt += lock_fail[i];
-      // try_lock_cnt += try_lock[i];
-    }
-
-    uint64_t try_write_op_cnt = 0, write_handover_cnt = 0;
-    for (int i = 0; i < MAX_APP_THREAD; ++i) {
-      write_handover_cnt += write_handover_num[i];
-      try_write_op_cnt += try_write_op[i];
-    }
-
-    uint64_t try_read_op_cnt = 0, read_handover_cnt = 0;
-    for (int i = 0; i < MAX_APP_THREAD; ++i) {
-      read_handover_cnt += read_handover_num[i];
-      try_read_op_cnt += try_read_op[i];
-    }
-
-    uint64_t try_read_leaf_cnt = 0, read_leaf_retry_cnt = 0, leaf_cache_invalid_cnt = 0;
-    for (int i = 0; i < MAX_APP_THREAD; ++i) {
-      try_read_leaf_cnt += try_read_leaf[i];
-      read_leaf_retry_cnt += read_leaf_retry[i];
-      leaf_cache_invalid_cnt += leaf_cache_invalid[i];
-    }
-
-    uint64_t try_read_node_cnt = 0, read_node_repair_cnt = 0;
-    for (int i = 0; i < MAX_APP_THREAD; ++i) {
-      try_read_node_cnt += try_read_node[i];
-      read_node_repair_cnt += read_node_repair[i];
-    }
-
-    uint64_t read_node_type_cnt[MAX_NODE_TYPE_NUM];
-    memset(read_node_type_cnt, 0, sizeof(uint64_t) * MAX_NODE_TYPE_NUM);
-    for (int i = 0; i < MAX_NODE_TYPE_NUM; ++i) {
-      for (int j = 0; j < MAX_APP_THREAD; ++j) {
-        read_node_type_cnt[i] += read_node_type[j][i];
-      }
-    }
-
-    uint64_t all_retry_cnt[MAX_FLAG_NUM];
-    memset(all_retry_cnt, 0, sizeof(uint64_t) * MAX_FLAG_NUM);
-    for (int i = 0; i < MAX_FLAG_NUM; ++i) {
-      for (int j = 0; j < MAX_APP_THREAD; ++j) {
-        all_retry_cnt[i] += retry_cnt[j][i];
-      }
-    }
-    tree->clear_debug_info();
+    auto cur_metrics = metrics.snapshot();
+    auto m = cur_metrics - pre_metrics;
+    pre_metrics = cur_metrics;
 
 #ifdef EPOCH_LAT_TEST
     save_latency(++ count);
 #else
     if (++ count == TEST_EPOCH / 2) {  // rm latency during warm up
-      memset(latency, 0, sizeof(uint64_t) * MAX_APP_THREAD * MAX_CORO_NUM * LATENCY_WINDOWS);
+      clear_latency();
     }
 #endif
 
     if (dsm->getMyNodeID() == 1) {
-      printf("total %lu", all_retry_cnt[0]);
+      printf("total %lu", m.retry_cnt[0]);
       for (int i = 1; i < MAX_FLAG_NUM; ++ i) {
-        printf(",  retry%d %lu", i, all_retry_cnt[i]);
+        printf(",  retry%d %lu", i, m.retry_cnt[i]);
       }
       printf("\n");
     }
@@ -508,16 +559,17 @@ int main(int argc, char *argv[]) {
     if (dsm->getMyNodeID() == 0) {
       printf("epoch %d passed!\n", count);
       printf("cluster throughput %.3f Mops\n", cluster_tp / 1000.0);
-      printf("cache hit rate: %lf\n", hit * 1.0 / all);
-      printf("avg. lock/cas fail cnt: %lf\n", lock_fail_cnt * 1.0 / try_write_op_cnt);
-      printf("write combining rate: %lf\n", write_handover_cnt * 1.0 / try_write_op_cnt);
-      printf("read delegation rate: %lf\n", read_handover_cnt * 1.0 / try_read_op_cnt);
-      printf("read leaf retry rate: %lf\n", read_leaf_retry_cnt * 1.0 / try_read_leaf_cnt);
-      printf("read invalid leaf rate: %lf\n", leaf_cache_invalid_cnt * 1.0 / try_read_leaf_cnt);
-      printf("read node repair rate: %lf\n", read_node_repair_cnt * 1.0 / try_read_node_cnt);
-      printf("read invalid node rate: %lf\n", all_retry_cnt[INVALID_NODE] * 1.0 / try_read_node_cnt);
+      printf("cache hit rate: %lf\n", m.cache_hit_rate());
+      printf("avg. lock/cas fail cnt: %lf\n", m.rate(LOCK_FAIL, TRY_WRITE_OP));
+      printf("write combining rate: %lf\n", m.rate(WRITE_HANDOVER_NUM, TRY_WRITE_OP));
+      printf("read delegation rate: %lf\n", m.rate(READ_HANDOVER_NUM, TRY_READ_OP));
+      printf("read leaf retry rate: %lf\n", m.rate(READ_LEAF_RETRY, TRY_READ_LEAF));
+      printf("read invalid leaf rate: %lf\n", m.rate(LEAF_CACHE_INVALID, TRY_READ_LEAF));
+      printf("read node repair rate: %lf\n", m.rate(READ_NODE_REPAIR, TRY_READ_NODE));
+      printf("read invalid node rate: %lf\n", m.retry_cnt[INVALID_NODE] * 1.0 / m[TRY_READ_NODE]);
+      printf("root read saved: %lu\n", m[ROOT_READ_SAVED]);
       for (int i = 1; i < MAX_NODE_TYPE_NUM; ++ i) {
-        printf("node_type%d %lu   ", i, read_node_type_cnt[i]);
+        printf("node_type%d %lu   ", i, m.read_node_type[i]);
       }
       printf("\n\n");
     }
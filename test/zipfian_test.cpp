@@ -1,4 +1,5 @@
 #include "Tree.h"
+#include "Metrics.h"
 #include "Timer.h"
 #include "zipf.h"
 
@@ -16,22 +17,6 @@
 // #define NO_WRITE_CONFLICT
 // #define TEST_INSERT
 
-extern double cache_miss[MAX_APP_THREAD];
-extern double cache_hit[MAX_APP_THREAD];
-extern uint64_t lock_fail[MAX_APP_THREAD];
-// extern uint64_t try_lock[MAX_APP_THREAD];
-extern uint64_t write_handover_num[MAX_APP_THREAD];
-extern uint64_t try_write_op[MAX_APP_THREAD];
-extern uint64_t read_handover_num[MAX_APP_THREAD];
-extern uint64_t try_read_op[MAX_APP_THREAD];
-extern uint64_t read_leaf_retry[MAX_APP_THREAD];
-extern uint64_t leaf_cache_invalid[MAX_APP_THREAD];
-extern uint64_t try_read_leaf[MAX_APP_THREAD];
-extern uint64_t read_node_repair[MAX_APP_THREAD];
-extern uint64_t try_read_node[MAX_APP_THREAD];
-extern uint64_t read_node_type[MAX_APP_THREAD][MAX_NODE_TYPE_NUM];
-extern uint64_t retry_cnt[MAX_APP_THREAD][MAX_FLAG_NUM];
-
 int kReadRatio;
 int kThreadCount;
 int kNodeCount;
@@ -51,8 +36,7 @@ std::thread th[MAX_APP_THREAD];
 uint64_t tp[MAX_APP_THREAD][MAX_CORO_NUM];
 
 extern volatile bool need_stop;
-extern uint64_t latency[MAX_APP_THREAD][MAX_CORO_NUM][LATENCY_WINDOWS];
-uint64_t latency_th_all[LATENCY_WINDOWS];
+extern Histogram latency[MAX_APP_THREAD][REQ_TYPE_NUM];
 
 Tree *tree;
 DSM *dsm;
@@ -76,9 +60,10 @@ public:
   }
 
   Request next() override {
-    Request r;
+    Request r{};
     r.is_search = rand_r(&seed) % 100 < kReadRatio;
-    r.is_insert = !r.is_search;
+    r.is_insert = !r.is_search && test_insert;
+    r.is_update = !r.is_search && !test_insert;
 
 #ifdef TEST_INSERT
     if (r.is_insert) {
@@ -93,7 +78,7 @@ public:
 #else
     uint64_t dis = mehcached_zipf_next(&state);
 #ifdef NO_WRITE_CONFLICT
-    if (r.is_insert) {
+    if (!r.is_search) {
       auto tmp = CityHash64((char *)&dis, sizeof(dis)) % kKeySpace;
       tmp = tmp / all_thread * all_thread + my_global_id;
       while (tmp > kKeySpace) tmp -= all_thread;
@@ -211,12 +196,7 @@ void thread_run(int id) {
 
     timer.begin();
     work_func(tree, r, nullptr, 0);
-    auto us_10 = timer.end() / 100;
-
-    if (us_10 >= LATENCY_WINDOWS) {
-      us_10 = LATENCY_WINDOWS - 1;
-    }
-    latency[thread_id][0][us_10]++;
+    latency[thread_id][r.type()].record(timer.end());
   }
 #endif
   printf("thread %d exit.\n", id);
@@ -238,29 +218,40 @@ void parse_args(int argc, char *argv[]) {
          kReadRatio, kThreadCount, zipfan, kCoroCnt);
 }
 
+void clear_latency() {
+  for (int k = 0; k < MAX_APP_THREAD; ++k) {
+    for (int t = 0; t < REQ_TYPE_NUM; ++t) {
+      latency[k][t].clear();
+    }
+  }
+}
+
 void save_latency(int epoch_id) {
-  // sum up local latency cnt
-  for (int i = 0; i < LATENCY_WINDOWS; ++i) {
-    latency_th_all[i] = 0;
-    for (int k = 0; k < MAX_APP_THREAD; ++k)
-      for (int j = 0; j < MAX_CORO_NUM; ++j) {
-        latency_th_all[i] += latency[k][j][i];
+  // merge the histograms of all threads, for each type of requests and for all
+  Histogram all, h;
+  for (int t = 0; t < REQ_TYPE_NUM; ++t) {
+    h.clear();
+    for (int k = 0; k < MAX_APP_THREAD; ++k) {
+      h.merge(latency[k][t]);
+      latency[k][t].clear();
     }
+    if (!h.count()) continue;
+    printf("%s latency: p50 %.1fus, p99 %.1fus, p999 %.1fus, max %.1fus\n", kRequestTypeName[t],
+           h.percentile(0.5) / 1000.0, h.percentile(0.99) / 1000.0, h.percentile(0.999) / 1000.0, h.max() / 1000.0);
+    std::ofstream f_out("../us_lat/epoch_" + std::to_string(epoch_id) + "_" + kRequestTypeName[t] + ".lat");
+    h.save(f_out);
+    all.merge(h);
   }
   // store in file
   std::ofstream f_out("../us_lat/epoch_" + std::to_string(epoch_id) + ".lat");
-  f_out << std::setiosflags(std::ios::fixed) << std::setprecision(1);
   if (f_out.is_open()) {
-    for (int i = 0; i < LATENCY_WINDOWS; ++i) {
-      f_out << i / 10.0 << "\t" << latency_th_all[i] << std::endl;
-    }
+    all.save(f_out);
     f_out.close();
   }
   else {
     printf("Fail to write file!\n");
     assert(false);
   }
-  memset(latency, 0, sizeof(uint64_t) * MAX_APP_THREAD * MAX_CORO_NUM * LATENCY_WINDOWS);
 }
 
 int main(int argc, char *argv[]) {
@@ -268,13 +259,18 @@ int main(int argc, char *argv[]) {
   parse_args(argc, argv);
 
   DSMConfig config;
+#ifndef DSM_LOOPBACK
   assert(kNodeCount >= MEMORY_NODE_NUM);
+#endif
   config.machineNR = kNodeCount;
   config.threadNR = kThreadCount;
   dsm = DSM::getInstance(config);
   dsm->registerThread();
   bindCore(kThreadCount * 2 + 1);
   tree = new Tree(dsm);
+  if (getenv("SMART_METRICS_EXPORT")) {  // a file or a local port
+    metrics.start_exporter(getenv("SMART_METRICS_EXPORT"), dsm->getMyNodeID());
+  }
 
   dsm->barrier("benchmark");
 
@@ -287,6 +283,7 @@ int main(int argc, char *argv[]) {
 
   timespec s, e;
   uint64_t pre_tp = 0;
+  auto pre_metrics = metrics.snapshot();
   int count = 0;
 
   clock_gettime(CLOCK_REALTIME, &s);
@@ -305,59 +302,9 @@ int main(int argc, char *argv[]) {
     uint64_t cap = all_tp - pre_tp;
     pre_tp = all_tp;
 
-    double all = 0, hit = 0;
-    for (int i = 0; i < MAX_APP_THREAD; ++i) {
-      all += (cache_hit[i] + cache_miss[i]);
-      hit += cache_hit[i];
-    }
-
-    uint64_t lock_fail_cnt = 0;
-    for (int i = 0; i < MAX_APP_THREAD; ++i) {
-      lock_fail_cnt += lock_fail[i];
-      // try_lock_cnt += try_lock[i];
-    }
-
-    uint64_t try_write_op_cnt = 0, write_handover_cnt = 0;
-    for (int i = 0; i < MAX_APP_THREAD; ++i) {
-      write_handover_cnt += write_handover_num[i];
-      try_write_op_cnt += try_write_op[i];
-    }
-
-    uint64_t try_read_op_cnt = 0, read_handover_cnt = 0;
-    for (int i = 0; i < MAX_APP_THREAD; ++i) {
-      read_handover_cnt += read_handover_num[i];
-      try_read_op_cnt += try_read_op[i];
-    }
-
-    uint64_t try_read_leaf_cnt = 0, read_leaf_retry_cnt = 0, leaf_cache_invalid_cnt = 0;;
-    for (int i = 0; i < MAX_APP_THREAD; ++i) {
-      try_read_leaf_cnt += try_read_leaf[i];
-      read_leaf_retry_cnt += read_leaf_retry[i];
-      leaf_cache_invalid_cnt += leaf_cache_invalid[i];
-    }
-
-    uint64_t try_read_node_cnt = 0, read_node_repair_cnt = 0;
-    for (int i = 0; i < MAX_APP_THREAD; ++i) {
-      try_read_node_cnt += try_read_node[i];
-      read_node_repair_cnt += read_node_repair[i];
-    }
-
-    uint64_t read_node_type_cnt[MAX_NODE_TYPE_NUM];
-    memset(read_node_type_cnt, 0, sizeof(uint64_t) * MAX_NODE_TYPE_NUM);
-    for (int i = 0; i < MAX_NODE_TYPE_NUM; ++i) {
-      for (int j = 0; j < MAX_APP_THREAD; ++j) {
-        read_node_type_cnt[i] += read_node_type[j][i];
-      }
-    }
-
-    uint64_t all_retry_cnt[MAX_FLAG_NUM];
-    memset(all_retry_cnt, 0, sizeof(uint64_t) * MAX_FLAG_NUM);
-    for (int i = 0; i < MAX_FLAG_NUM; ++i) {
-      for (int j = 0; j < MAX_APP_THREAD; ++j) {
-        all_retry_cnt[i] += retry_cnt[j][i];
-      }
-    }
-    tree->clear_debug_info();
+    auto cur_metrics = metrics.snapshot();
+    auto m = cur_metrics - pre_metrics;
+    pre_metrics = cur_metrics;
 
     save_latency(++ count);
     if (count >= TEST_EPOCH) {
@@ -365,9 +312,9 @@ int main(int argc, char *argv[]) {
     }
 
     if (dsm->getMyNodeID() == 1) {
-      printf("total %lu", all_retry_cnt[0]);
+      printf("total %lu", m.retry_cnt[0]);
       for (int i = 1; i < MAX_FLAG_NUM; ++ i) {
-        printf(",  retry%d %lu", i, all_retry_cnt[i]);
+        printf(",  retry%d %lu", i, m.retry_cnt[i]);
       }
       printf("\n");
     }
@@ -380,16 +327,16 @@ int main(int argc, char *argv[]) {
     if (dsm->getMyNodeID() == 0) {
       printf("epoch %d passed!\n", count);
       printf("cluster throughput %.3f\n", cluster_tp / 1000.0);
-      printf("cache hit rate: %lf\n", hit * 1.0 / all);
-      printf("avg. lock/cas fail cnt: %lf\n", lock_fail_cnt * 1.0 / try_write_op_cnt);
-      printf("write combining rate: %lf\n", write_handover_cnt * 1.0 / try_write_op_cnt);
-      printf("read delegation rate: %lf\n", read_handover_cnt * 1.0 / try_read_op_cnt);
-      printf("read leaf retry rate: %lf\n", read_leaf_retry_cnt * 1.0 / try_read_leaf_cnt);
-      printf("read invalid leaf rate: %lf\n", leaf_cache_invalid_cnt * 1.0 / try_read_leaf_cnt);
-      printf("read node repair rate: %lf\n", read_node_repair_cnt * 1.0 / try_read_node_cnt);
-      printf("read invalid node rate: %lf\n", all_retry_cnt[INVALID_NODE] * 1.0 / try_read_node_cnt);
+      printf("cache hit rate: %lf\n", m.cache_hit_rate());
+      printf("avg. lock/cas fail cnt: %lf\n", m.rate(LOCK_FAIL, TRY_WRITE_OP));
+      printf("write combining rate: %lf\n", m.rate(WRITE_HANDOVER_NUM, TRY_WRITE_OP));
+      printf("read delegation rate: %lf\n", m.rate(READ_HANDOVER_NUM, TRY_READ_OP));
+      printf("read leaf retry rate: %lf\n", m.rate(READ_LEAF_RETRY, TRY_READ_LEAF));
+      printf("read invalid leaf rate: %lf\n", m.rate(LEAF_CACHE_INVALID, TRY_READ_LEAF));
+      printf("read node repair rate: %lf\n", m.rate(READ_NODE_REPAIR, TRY_READ_NODE));
+      printf("read invalid node rate: %lf\n", m.retry_cnt[INVALID_NODE] * 1.0 / m[TRY_READ_NODE]);
       for (int i = 1; i < MAX_NODE_TYPE_NUM; ++ i) {
-        printf("node_type%d %lu   ", i, read_node_type_cnt[i]);
+        printf("node_type%d %lu   ", i, m.read_node_type[i]);
       }
       printf("\n\n");
     }
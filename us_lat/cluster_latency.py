@@ -13,14 +13,15 @@ class bcolors:
     BOLD = '\033[1m'
     UNDERLINE = '\033[4m'
 
-if (len(sys.argv) != 4) :
+if (len(sys.argv) != 4 and len(sys.argv) != 5) :
     print(bcolors.WARNING + 'Usage:')
-    print('python3 cluster_latency.py compute_node_num epoch_start epoch_num' + bcolors.ENDC)
+    print('python3 cluster_latency.py compute_node_num epoch_start epoch_num [request_type(read/update/insert/delete/scan)]' + bcolors.ENDC)
     exit(0)
 
 node_num = int(sys.argv[1])
 epoch_start = int(sys.argv[2])
 epoch_num = int(sys.argv[3])
+lat_suffix = f'_{sys.argv[4]}.lat' if len(sys.argv) == 5 else '.lat'  # all requests by default
 
 
 # epoch_start = 1
@@ -94,8 +95,9 @@ def cal_lat(e_id):
       print(f'p99 {lat}', end='\t')
       th99 = all_lat + 1
     if cum >= th999:
-      print(f'p999 {lat}')
+      print(f'p999 {lat}', end='\t')
       th999 = all_lat + 1
+  print(f'max {max(lat_cnt, key=float)}')  # within the bucket width of the histograms
 
 
 if __name__ == '__main__':
@@ -103,5 +105,5 @@ if __name__ == '__main__':
   for e_id in range(epoch_start, epoch_start + epoch_num):
     lat_cnt.clear()
     for client in sftp_clients:
-      load_remote_lat(client, str(lat_dir / f'epoch_{e_id}.lat'))
+      load_remote_lat(client, str(lat_dir / f'epoch_{e_id}{lat_suffix}'))
     cal_lat(e_id)
@@ -51,6 +51,8 @@ print('key type = ' + key_type + bcolors.ENDC)
 email_list = 'emails.txt'            # NOTE: To generate email-key workloads, an email list is needed
 email_list_size = 125050709          # NOTE: change to the size of your email list (p.s. should be larger than twice of your YCSB LOAD size)
 
+delete_workloads = ['workloadx']   # their UPDATE ops are rewritten into DELETE ops
+
 out_ycsb_load = output_dir + 'ycsb_load_' + key_type + '_' + workload
 out_ycsb_txn = output_dir + 'ycsb_txn_' + key_type + '_' + workload
 out_load_ycsbkey = output_dir + 'load_' + 'ycsbkey' + '_' + workload
@@ -81,6 +83,8 @@ for line in f_txn :
     cols = line.split()
     if (cols[0] == 'SCAN') or (cols[0] == 'INSERT') or (cols[0] == 'READ') or (cols[0] == 'UPDATE'):
         startkey = cols[2][4:]
+        if cols[0] == 'UPDATE' and workload in delete_workloads :  # YCSB core emits no deletes
+            cols[0] = 'DELETE'
         if cols[0] == 'SCAN' :
             numkeys = cols[3]
             f_txn_out.write (cols[0] + ' ' + startkey + ' ' + numkeys + '\n')
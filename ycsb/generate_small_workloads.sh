@@ -2,7 +2,7 @@
 
 start_time=$(date +%s)
 
-for WORKLOAD_TYPE in la a b c d; do
+for WORKLOAD_TYPE in la a b c d x; do
   python3 gen_workload.py workload${WORKLOAD_TYPE} randint small
   python3 gen_workload.py workload${WORKLOAD_TYPE} email small
 done